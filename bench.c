@@ -0,0 +1,403 @@
+/**
+  Copyright © 2017 Odzhan. All Rights Reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  3. The name of the author may not be used to endorse or promote products
+  derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY AUTHORS "AS IS" AND ANY EXPRESS OR
+  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+  STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE. */
+
+// Benchmark for maru and maru2.
+//
+// Writes one JSON object per line: cycles, nanoseconds and hashes per
+// second for each entry point, input length, cache state and thread
+// count. Build with -DCHASKEY to measure the Chaskey version of maru2.
+//
+// ./bench [threads]
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <cpuid.h>
+#include <x86intrin.h>
+
+#ifndef CHASKEY
+#include "maru.h"
+#endif
+#include "maru2.h"
+
+#ifndef CHASKEY
+#define BENCH_CIPHER "speck"
+#else
+#define BENCH_CIPHER "chaskey"
+#endif
+
+#define BENCH_IV       0x15DF1E4BE5E7970FULL
+#define BENCH_KEYS     64                // keys hashed per sample
+#define BENCH_SAMPLES  201
+#define BENCH_ARENA    (64*1024*1024)    // cold keys are spread over this
+#define BENCH_MAX_LEN  (1024*1024)
+
+typedef struct _bench_api {
+  const char *variant;
+  const char *api;
+  const char *(*kernel)(int *lanes);  // NULL for one string at a time
+  int        stream;    // hashes len bytes of data, not strings
+  void       (*run)(const char **keys, const uint8_t *data, size_t len, size_t n);
+} bench_api;
+
+typedef struct _bench_thread {
+  pthread_t         id;
+  int               cpu;
+  const bench_api   *api;
+  size_t            len;
+  uint64_t          iter;
+  uint64_t          ns;     // time taken by this thread
+  pthread_barrier_t *start;
+} bench_thread;
+
+static volatile uint64_t sink;
+static double            tsc_ghz;
+static uint8_t           *arena;
+
+// serialize before reading the time stamp counter
+static inline uint64_t tsc_start(void) {
+    unsigned a, b, c, d;
+
+    __cpuid(0, a, b, c, d);
+    return __rdtsc();
+}
+
+// wait for prior instructions, and keep later ones from starting early
+static inline uint64_t tsc_stop(void) {
+    unsigned aux;
+    uint64_t t = __rdtscp(&aux);
+
+    _mm_lfence();
+    return t;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void pin_cpu(pthread_t t, int cpu) {
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(t, sizeof(set), &set);
+}
+
+// ticks of the time stamp counter per nanosecond
+static double tsc_calibrate(void) {
+    uint64_t t0, t1, c0, c1;
+
+    t0 = now_ns(); c0 = tsc_start();
+    while ((t1 = now_ns()) - t0 < 200000000ULL);
+    c1 = tsc_stop();
+    return (double)(c1 - c0) / (t1 - t0);
+}
+
+#ifndef CHASKEY
+static void run_maru(const char **keys, const uint8_t *data, size_t len, size_t n) {
+    uint64_t h = 0;
+    size_t   i;
+
+    for (i=0; i<n; i++) h ^= maru(keys[i], BENCH_IV);
+    sink ^= h;
+}
+
+static void run_maru_batch(const char **keys, const uint8_t *data, size_t len, size_t n) {
+    uint64_t h[BENCH_KEYS];
+
+    maru_batch(keys, n, BENCH_IV, h);
+    sink ^= h[0];
+}
+
+static void run_maru_stream(const char **keys, const uint8_t *data, size_t len, size_t n) {
+    maru_ctx ctx;
+    uint64_t h = 0;
+    size_t   i;
+
+    for (i=0; i<n; i++) {
+      maru_init(&ctx, BENCH_IV);
+      maru_update(&ctx, data, len);
+      h ^= maru_final(&ctx);
+    }
+    sink ^= h;
+}
+#endif
+
+static void run_maru2(const char **keys, const uint8_t *data, size_t len, size_t n) {
+    uint64_t h[2], x = 0;
+    size_t   i;
+
+    for (i=0; i<n; i++) {
+      maru2(keys[i], BENCH_IV, h);
+      x ^= h[0];
+    }
+    sink ^= x;
+}
+
+static void run_maru2_batch(const char **keys, const uint8_t *data, size_t len, size_t n) {
+    uint8_t h[BENCH_KEYS][MARU2_HASH_LEN];
+
+    maru2_batch(keys, n, BENCH_IV, h);
+    sink ^= h[0][0];
+}
+
+static void run_maru2_stream(const char **keys, const uint8_t *data, size_t len, size_t n) {
+    maru2_ctx ctx;
+    uint64_t  h[2], x = 0;
+    size_t    i;
+
+    for (i=0; i<n; i++) {
+      maru2_init(&ctx, BENCH_IV);
+      maru2_update(&ctx, data, len);
+      maru2_final(&ctx, h);
+      x ^= h[0];
+    }
+    sink ^= x;
+}
+
+static const bench_api api_tbl[]=
+{
+#ifndef CHASKEY
+  { "maru",  "maru",         NULL,         0, run_maru         },
+  { "maru",  "maru_batch",   maru_kernel,  0, run_maru_batch   },
+  { "maru",  "maru_update",  NULL,         1, run_maru_stream  },
+#endif
+  { "maru2", "maru2",        NULL,         0, run_maru2        },
+  { "maru2", "maru2_batch",  maru2_kernel, 0, run_maru2_batch  },
+  { "maru2", "maru2_update", NULL,         1, run_maru2_stream },
+};
+
+static const size_t str_len[]=
+{ 0, 1, 2, 4, 8, 12, 15, 16, 24, 27, 28, 31, 32, 40, 48, 56, 60, 63, 64 };
+
+static const size_t stream_len[]=
+{ 256, 1024, 4096, 65536, BENCH_MAX_LEN };
+
+// fill n keys of len bytes at random places in the arena
+static void make_keys(const char **keys, size_t n, size_t len, int spread) {
+    size_t i, j, off;
+    char   *k;
+
+    for (i=0; i<n; i++) {
+      off = spread ? ((size_t)rand() * 4096 + (size_t)rand()) % (BENCH_ARENA - 128) : i * 128;
+      off &= ~(size_t)63;
+      k = (char*)arena + off;
+      for (j=0; j<len; j++) k[j] = 'A' + (char)((i + j) % 26);
+      k[len] = 0;
+      keys[i] = k;
+    }
+}
+
+static void flush(const void *p, size_t len) {
+    const uint8_t *b = (const uint8_t*)((uintptr_t)p & ~(uintptr_t)63);
+    const uint8_t *e = (const uint8_t*)p + len;
+
+    for (; b<e; b+=64) _mm_clflush(b);
+    _mm_mfence();
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static void report(const bench_api *a, size_t len, int threads, const char *cache,
+  double cyc_med, double cyc_p99, double hps)
+{
+    const char *kernel = "scalar";
+    int        lanes = 1;
+
+    // kernel picked at run time, MARU_KERNEL can force another
+    if (a->kernel != NULL) kernel = a->kernel(&lanes);
+
+    printf ("{\"variant\":\"%s\",\"cipher\":\"%s\",\"api\":\"%s\",\"kernel\":\"%s\",\"lanes\":%d,"
+            "\"len\":%zu,\"threads\":%d,\"cache\":\"%s\","
+            "\"cycles_median\":%.1f,\"cycles_p99\":%.1f,"
+            "\"ns_median\":%.2f,\"ns_p99\":%.2f,\"hashes_per_sec\":%.0f}\n",
+      a->variant, BENCH_CIPHER, a->api, kernel, lanes, len, threads, cache,
+      cyc_med, cyc_p99, cyc_med / tsc_ghz, cyc_p99 / tsc_ghz, hps);
+    fflush(stdout);
+}
+
+// cycles per hash on one core
+static void bench_one(const bench_api *a, size_t len, int cold) {
+    const char *keys[BENCH_KEYS];
+    uint64_t   s[BENCH_SAMPLES], t0, t1;
+    size_t     n, i, k, ns;
+    double     med, p99;
+    uint8_t    *data = arena;
+
+    n  = a->stream ? 1 : BENCH_KEYS;
+    ns = (a->stream && len >= 65536) ? 21 : BENCH_SAMPLES;
+
+    make_keys(keys, n, a->stream ? 0 : len, cold);
+    a->run(keys, data, len, n);
+
+    for (i=0; i<ns; i++) {
+      if (cold) {
+        // new keys each time, and none of them cached
+        if (a->stream) {
+          data = arena + ((size_t)rand() % (BENCH_ARENA / 2 / 64)) * 64;
+          flush(data, len);
+        } else {
+          make_keys(keys, n, len, 1);
+          for (k=0; k<n; k++) flush(keys[k], len + 1);
+        }
+      }
+      t0 = tsc_start();
+      a->run(keys, data, len, n);
+      t1 = tsc_stop();
+      s[i] = t1 - t0;
+    }
+    qsort(s, ns, sizeof(uint64_t), cmp_u64);
+    med = (double)s[ns / 2] / n;
+    p99 = (double)s[(ns * 99) / 100] / n;
+    report(a, len, 1, cold ? "cold" : "warm", med, p99, 1e9 * tsc_ghz / med);
+}
+
+static void *bench_thread_main(void *arg) {
+    bench_thread *t = arg;
+    const char   *keys[BENCH_KEYS];
+    char         buf[BENCH_KEYS][MARU2_MAX_STR+1];
+    uint8_t      *data;
+    uint64_t     i;
+    size_t       j;
+
+    // private keys and data on each thread
+    for (i=0; i<BENCH_KEYS; i++) {
+      for (j=0; j<t->len && j<MARU2_MAX_STR; j++) buf[i][j] = 'a' + (char)((i + j) % 26);
+      buf[i][j] = 0;
+      keys[i] = buf[i];
+    }
+    data = calloc(1, t->len + 1);
+    pthread_barrier_wait(t->start);
+
+    t->ns = now_ns();
+    for (i=0; i<t->iter; i++)
+      t->api->run(keys, data, t->len, t->api->stream ? 1 : BENCH_KEYS);
+    t->ns = now_ns() - t->ns;
+
+    free(data);
+    return NULL;
+}
+
+// hashes per second on all cores, with median and slowest thread
+static void bench_all(const bench_api *a, size_t len, int nthreads) {
+    bench_thread      *t;
+    pthread_barrier_t start;
+    uint64_t          iter, t0, t1, total, *ns;
+    int               i, ncpu;
+    double            per;
+
+    t  = calloc(nthreads, sizeof(bench_thread));
+    ns = calloc(nthreads, sizeof(uint64_t));
+    iter = a->stream ? (len >= 65536 ? 64 : 20000) : 4000;
+    ncpu = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_barrier_init(&start, NULL, nthreads + 1);
+
+    for (i=0; i<nthreads; i++) {
+      t[i].cpu   = i % ncpu;
+      t[i].api   = a;
+      t[i].len   = len;
+      t[i].iter  = iter;
+      t[i].start = &start;
+      pthread_create(&t[i].id, NULL, bench_thread_main, &t[i]);
+      pin_cpu(t[i].id, t[i].cpu);
+    }
+    pthread_barrier_wait(&start);
+    t0 = now_ns();
+    for (i=0; i<nthreads; i++) {
+      pthread_join(t[i].id, NULL);
+      ns[i] = t[i].ns;
+    }
+    t1 = now_ns();
+
+    qsort(ns, nthreads, sizeof(uint64_t), cmp_u64);
+    per   = (double)iter * (a->stream ? 1 : BENCH_KEYS) / tsc_ghz;
+    total = iter * nthreads * (a->stream ? 1 : BENCH_KEYS);
+    report(a, len, nthreads, "warm", ns[nthreads / 2] / per, ns[nthreads - 1] / per,
+      1e9 * total / (t1 - t0));
+
+    pthread_barrier_destroy(&start);
+    free(ns);
+    free(t);
+}
+
+int main(int argc, char *argv[])
+{
+    const bench_api *a;
+    size_t          i, j, nl;
+    const size_t    *lens;
+    int             cpus, cold;
+
+    arena = aligned_alloc(64, BENCH_ARENA);
+    if (arena == NULL) {
+      printf ("out of memory\n");
+      return 1;
+    }
+    memset(arena, 'x', BENCH_ARENA);
+    srand(1);
+
+    cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (argc > 1) cpus = atoi(argv[1]);
+    if (cpus < 1) cpus = 1;
+
+    pin_cpu(pthread_self(), 0);
+    tsc_ghz = tsc_calibrate();
+
+    printf ("{\"tsc_ghz\":%.3f,\"cpus\":%d,\"cipher\":\"%s\",\"maru2_kernel\":\"%s\"}\n",
+      tsc_ghz, cpus, BENCH_CIPHER, maru2_kernel(NULL));
+
+    for (i=0; i<sizeof(api_tbl)/sizeof(bench_api); i++) {
+      a = &api_tbl[i];
+      lens = a->stream ? stream_len : str_len;
+      nl   = a->stream ? sizeof(stream_len)/sizeof(size_t) : sizeof(str_len)/sizeof(size_t);
+
+      for (cold=0; cold<2; cold++)
+        for (j=0; j<nl; j++) bench_one(a, lens[j], cold);
+
+      // short, longest and streaming input on every core
+      if (a->stream) {
+        bench_all(a, 65536, cpus);
+      } else {
+        bench_all(a, 16, cpus);
+        bench_all(a, MARU2_MAX_STR, cpus);
+      }
+      pin_cpu(pthread_self(), 0);
+    }
+    return 0;
+}
@@ -0,0 +1,388 @@
+/**
+  Copyright © 2017 Odzhan. All Rights Reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  3. The name of the author may not be used to endorse or promote products
+  derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY AUTHORS "AS IS" AND ANY EXPRESS OR
+  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+  STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE. */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "bloom.h"
+
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
+
+// Blocked Bloom filter. The upper 64 bits of the maru2 hash pick one
+// 64-byte block, and k bits of it come from the lower 64 bits by
+// double hashing, so a lookup misses the cache at most once.
+
+// keys hashed per call to maru2_batch
+#define MARU_BLOOM_BATCH  64
+// blocks prefetched ahead of the one used
+#define MARU_BLOOM_AHEAD  8
+
+#ifdef __GNUC__
+#define MARU_PREFETCH(p, rw) __builtin_prefetch(p, rw, 3)
+#else
+#define MARU_PREFETCH(p, rw)
+#endif
+
+// block from the upper 64 bits
+static uint64_t maru_bloom_block(const maru_bloom *b, const uint8_t *h) {
+    uint64_t hi;
+
+    memcpy(&hi, h + 8, 8);
+#ifdef __SIZEOF_INT128__
+    return (uint64_t)(((unsigned __int128)hi * b->hdr->nblocks) >> 64);
+#else
+    return hi % b->hdr->nblocks;
+#endif
+}
+
+// bits of the block, from the lower 64 bits
+static void maru_bloom_mask(const maru_bloom *b, const uint8_t *h, uint64_t *m) {
+    uint64_t lo;
+    uint32_t x, y, i, p;
+
+    memcpy(&lo, h, 8);
+    x = (uint32_t)lo;
+    // odd step, so the k bits are all different
+    y = (uint32_t)(lo >> 32) | 1;
+
+    memset(m, 0, MARU_BLOOM_BLK);
+    for (i=0; i<b->hdr->k; i++, x+=y) {
+      p = x & (MARU_BLOOM_BLK*8 - 1);
+      m[p >> 6] |= 1ULL << (p & 63);
+    }
+}
+
+// are all bits of m set in the block?
+static int maru_bloom_has(const uint64_t *blk, const uint64_t *m) {
+#if defined(__AVX2__)
+    return _mm256_testc_si256(_mm256_load_si256((const __m256i*)blk),
+                              _mm256_loadu_si256((const __m256i*)m)) &
+           _mm256_testc_si256(_mm256_load_si256((const __m256i*)(blk + 4)),
+                              _mm256_loadu_si256((const __m256i*)(m + 4)));
+#elif defined(__SSE4_1__)
+    int i, r = 1;
+
+    for (i=0; i<8; i+=2)
+      r &= _mm_testc_si128(_mm_load_si128((const __m128i*)(blk + i)),
+                           _mm_loadu_si128((const __m128i*)(m + i)));
+    return r;
+#else
+    uint64_t r = 0;
+    int      i;
+
+    for (i=0; i<8; i++) r |= m[i] & ~blk[i];
+    return r == 0;
+#endif
+}
+
+static void maru_bloom_set(uint64_t *blk, const uint64_t *m) {
+    int i;
+
+    for (i=0; i<8; i++) blk[i] |= m[i];
+}
+
+// room for nkeys with bits per key, 10 bits gives about 1% false positives
+int maru_bloom_new(maru_bloom *b, uint64_t nkeys, uint32_t bits, uint64_t iv) {
+    uint64_t nblocks;
+    uint32_t k;
+
+    memset(b, 0, sizeof(maru_bloom));
+    if (bits == 0) bits = 10;
+
+    // k = bits * ln(2)
+    k = (uint32_t)(((uint64_t)bits * 693 + 500) / 1000);
+    if (k < 1) k = 1;
+    if (k > MARU_BLOOM_MAX_K) k = MARU_BLOOM_MAX_K;
+
+    nblocks = (nkeys * bits + MARU_BLOOM_BLK*8 - 1) / (MARU_BLOOM_BLK*8);
+    if (nblocks == 0) nblocks = 1;
+
+    b->size = (size_t)(nblocks + 1) * MARU_BLOOM_BLK;
+    b->hdr  = aligned_alloc(MARU_BLOOM_BLK, b->size);
+    if (b->hdr == NULL) return 0;
+
+    memset(b->hdr, 0, b->size);
+    b->hdr->magic   = MARU_BLOOM_MAGIC;
+    b->hdr->k       = k;
+    b->hdr->iv      = iv;
+    b->hdr->nblocks = nblocks;
+    b->blk = (uint64_t(*)[MARU_BLOOM_BLK/8])(b->hdr + 1);
+    return 1;
+}
+
+void maru_bloom_free(maru_bloom *b) {
+    if (b->hdr != NULL) {
+      if (b->mapped) munmap(b->hdr, b->size);
+      else free(b->hdr);
+    }
+    memset(b, 0, sizeof(maru_bloom));
+}
+
+void maru_bloom_add_hash(maru_bloom *b, const uint8_t *h) {
+    uint64_t m[MARU_BLOOM_BLK/8];
+
+    if (b->mapped) return;
+    maru_bloom_mask(b, h, m);
+    maru_bloom_set(b->blk[maru_bloom_block(b, h)], m);
+    b->hdr->count++;
+}
+
+int maru_bloom_test_hash(const maru_bloom *b, const uint8_t *h) {
+    uint64_t m[MARU_BLOOM_BLK/8];
+
+    maru_bloom_mask(b, h, m);
+    return maru_bloom_has(b->blk[maru_bloom_block(b, h)], m);
+}
+
+void maru_bloom_add(maru_bloom *b, const char *key) {
+    uint8_t h[MARU2_HASH_LEN];
+
+    maru2(key, b->hdr->iv, h);
+    maru_bloom_add_hash(b, h);
+}
+
+int maru_bloom_test(const maru_bloom *b, const char *key) {
+    uint8_t h[MARU2_HASH_LEN];
+
+    maru2(key, b->hdr->iv, h);
+    return maru_bloom_test_hash(b, h);
+}
+
+// hash a batch of keys at once, and prefetch blocks ahead of use
+void maru_bloom_add_batch(maru_bloom *b, const char **keys, size_t n) {
+    uint8_t  h[MARU_BLOOM_BATCH][MARU2_HASH_LEN];
+    uint64_t idx[MARU_BLOOM_BATCH], m[MARU_BLOOM_BLK/8];
+    size_t   i, j, cnt;
+
+    if (b->mapped) return;
+
+    for (i=0; i<n; i+=cnt) {
+      cnt = (n - i) < MARU_BLOOM_BATCH ? n - i : MARU_BLOOM_BATCH;
+      maru2_batch(keys + i, cnt, b->hdr->iv, h);
+
+      for (j=0; j<cnt; j++) {
+        idx[j] = maru_bloom_block(b, h[j]);
+        if (j < MARU_BLOOM_AHEAD) MARU_PREFETCH(b->blk[idx[j]], 1);
+      }
+      for (j=0; j<cnt; j++) {
+        if (j + MARU_BLOOM_AHEAD < cnt)
+          MARU_PREFETCH(b->blk[idx[j + MARU_BLOOM_AHEAD]], 1);
+        maru_bloom_mask(b, h[j], m);
+        maru_bloom_set(b->blk[idx[j]], m);
+      }
+      b->hdr->count += cnt;
+    }
+}
+
+// res[i] is 1 if keys[i] may be in the filter, returns how many
+size_t maru_bloom_test_batch(const maru_bloom *b, const char **keys, size_t n, uint8_t *res) {
+    uint8_t  h[MARU_BLOOM_BATCH][MARU2_HASH_LEN];
+    uint64_t idx[MARU_BLOOM_BATCH], m[MARU_BLOOM_BLK/8];
+    size_t   i, j, cnt, hits = 0;
+    int      r;
+
+    for (i=0; i<n; i+=cnt) {
+      cnt = (n - i) < MARU_BLOOM_BATCH ? n - i : MARU_BLOOM_BATCH;
+      maru2_batch(keys + i, cnt, b->hdr->iv, h);
+
+      for (j=0; j<cnt; j++) {
+        idx[j] = maru_bloom_block(b, h[j]);
+        if (j < MARU_BLOOM_AHEAD) MARU_PREFETCH(b->blk[idx[j]], 0);
+      }
+      for (j=0; j<cnt; j++) {
+        if (j + MARU_BLOOM_AHEAD < cnt)
+          MARU_PREFETCH(b->blk[idx[j + MARU_BLOOM_AHEAD]], 0);
+        maru_bloom_mask(b, h[j], m);
+        r = maru_bloom_has(b->blk[idx[j]], m);
+        if (res != NULL) res[i + j] = (uint8_t)r;
+        hits += r;
+      }
+    }
+    return hits;
+}
+
+int maru_bloom_save(const maru_bloom *b, const char *path) {
+    const uint8_t *p = (const uint8_t*)b->hdr;
+    size_t        left = b->size;
+    ssize_t       w;
+    int           fd;
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return 0;
+
+    for (; left != 0; left -= w, p += w) {
+      w = write(fd, p, left);
+      if (w <= 0) break;
+    }
+    return close(fd) == 0 && left == 0;
+}
+
+// map a saved filter read only, processes that load it share its pages
+int maru_bloom_load(maru_bloom *b, const char *path) {
+    struct stat st;
+    int         fd;
+
+    memset(b, 0, sizeof(maru_bloom));
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < 2*MARU_BLOOM_BLK) {
+      close(fd);
+      return 0;
+    }
+    b->size = st.st_size;
+    b->hdr  = mmap(NULL, b->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (b->hdr == MAP_FAILED) {
+      b->hdr = NULL;
+      return 0;
+    }
+    b->mapped = 1;
+    b->blk = (uint64_t(*)[MARU_BLOOM_BLK/8])(b->hdr + 1);
+
+    if (b->hdr->magic != MARU_BLOOM_MAGIC ||
+        b->hdr->k < 1 || b->hdr->k > MARU_BLOOM_MAX_K ||
+        b->hdr->nblocks == 0 ||
+        b->hdr->nblocks != b->size / MARU_BLOOM_BLK - 1 ||
+        b->size % MARU_BLOOM_BLK != 0) {
+      maru_bloom_free(b);
+      return 0;
+    }
+    return 1;
+}
+
+#ifdef TEST
+
+#include <stdio.h>
+#include <time.h>
+#include <math.h>
+
+#define NKEYS   200000
+#define NOTHER  1000000
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// n keys named prefix and a number
+static const char **make_keys(const char *prefix, size_t n, char **arena) {
+    const char **keys = malloc(n * sizeof(char*));
+    char       *p = malloc(n * 24);
+    size_t     i;
+
+    for (i=0; i<n && keys != NULL && p != NULL; i++) {
+      keys[i] = p + i * 24;
+      snprintf(p + i * 24, 24, "%s%zu", prefix, i * 2654435761u);
+    }
+    *arena = p;
+    return keys;
+}
+
+int main(void) {
+    maru_bloom  a, b, c;
+    const char  **in, **out;
+    char        *pin, *pout;
+    uint8_t     *res;
+    size_t      i, fp, hits;
+    double      t0, t1, t2, fpr, std;
+    const char  *path = "bloom.bin";
+    int         equ;
+
+    in  = make_keys("in-", NKEYS, &pin);
+    out = make_keys("out-", NOTHER, &pout);
+    res = malloc(NOTHER);
+    if (in == NULL || out == NULL || pin == NULL || pout == NULL || res == NULL ||
+        !maru_bloom_new(&a, NKEYS, 10, 0x15DF1E4BE5E7970FULL) ||
+        !maru_bloom_new(&b, NKEYS, 10, 0x15DF1E4BE5E7970FULL)) {
+      printf ("out of memory\n");
+      return 1;
+    }
+    printf ("maru_bloom_new(%d keys, 10 bits) : k = %u, %llu blocks\n", NKEYS,
+      a.hdr->k, (unsigned long long)a.hdr->nblocks);
+
+    // one at a time, then batched: same filter
+    t0 = now();
+    for (i=0; i<NKEYS; i++) maru_bloom_add(&a, in[i]);
+    t1 = now();
+    maru_bloom_add_batch(&b, in, NKEYS);
+    t2 = now();
+    printf ("maru_bloom_add_batch() : %s, %.1f vs %.1f ns per key\n",
+      memcmp(a.hdr, b.hdr, a.size)==0 ? "OK" : "FAIL",
+      (t2 - t1) * 1e9 / NKEYS, (t1 - t0) * 1e9 / NKEYS);
+
+    // no false negatives
+    for (i=0, equ=1; i<NKEYS; i++) equ &= maru_bloom_test(&a, in[i]);
+    hits = maru_bloom_test_batch(&a, in, NKEYS, res);
+    printf ("maru_bloom_test(added keys) : %s\n", equ && hits == NKEYS ? "OK" : "FAIL");
+
+    // false positives, against (1 - e^(-kn/m))^k for an unblocked filter
+    t0 = now();
+    for (i=0, fp=0; i<NOTHER; i++) fp += maru_bloom_test(&a, out[i]);
+    t1 = now();
+    hits = maru_bloom_test_batch(&a, out, NOTHER, res);
+    t2 = now();
+    fpr = (double)fp / NOTHER;
+    std = 1.0;
+    for (i=0; i<a.hdr->k; i++)
+      std *= 1.0 - exp(-(double)a.hdr->k * NKEYS / (a.hdr->nblocks * MARU_BLOOM_BLK * 8));
+    printf ("maru_bloom_test(other keys) : %s, %.3f%% false positives, %.3f%% unblocked\n",
+      hits == fp && fpr < 2 * std ? "OK" : "FAIL", fpr * 100, std * 100);
+    printf ("maru_bloom_test_batch() : %.1f vs %.1f ns per key\n",
+      (t2 - t1) * 1e9 / NOTHER, (t1 - t0) * 1e9 / NOTHER);
+
+    // save, map back and compare
+    equ = maru_bloom_save(&a, path) && maru_bloom_load(&c, path);
+    if (equ) {
+      equ = memcmp(a.hdr, c.hdr, a.size)==0 &&
+            maru_bloom_test_batch(&c, out, NOTHER, res) == fp;
+      // read only
+      maru_bloom_add(&c, out[0]);
+      equ &= c.hdr->count == NKEYS;
+      maru_bloom_free(&c);
+    }
+    unlink(path);
+    printf ("maru_bloom_save/load() : %s\n", equ ? "OK" : "FAIL");
+
+    maru_bloom_free(&a);
+    maru_bloom_free(&b);
+    free(in); free(out); free(pin); free(pout); free(res);
+    return 0;
+}
+#endif
@@ -0,0 +1,79 @@
+/**
+  Copyright © 2017 Odzhan. All Rights Reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  3. The name of the author may not be used to endorse or promote products
+  derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY AUTHORS "AS IS" AND ANY EXPRESS OR
+  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+  STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE. */
+
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include "maru2.h"
+
+#define MARU_BLOOM_MAGIC  0x314D4C42 // "BLM1"
+#define MARU_BLOOM_BLK    64         // bytes per block, one cache line
+#define MARU_BLOOM_MAX_K  16         // most bits set per key
+
+// file and memory layout: this header, then nblocks blocks.
+// the header is one block, so blocks stay aligned when mapped.
+typedef struct _maru_bloom_hdr {
+  uint32_t magic;
+  uint32_t k;        // bits set per key
+  uint64_t iv;
+  uint64_t nblocks;
+  uint64_t count;    // keys added
+  uint8_t  pad[MARU_BLOOM_BLK - 32];
+} maru_bloom_hdr;
+
+typedef struct _maru_bloom {
+  maru_bloom_hdr *hdr;
+  uint64_t       (*blk)[MARU_BLOOM_BLK/8];
+  size_t         size;    // header and blocks
+  int            mapped;  // read only view of a file
+} maru_bloom;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  int maru_bloom_new (maru_bloom*, uint64_t, uint32_t, uint64_t);
+  void maru_bloom_free (maru_bloom*);
+
+  void maru_bloom_add (maru_bloom*, const char*);
+  int maru_bloom_test (const maru_bloom*, const char*);
+  void maru_bloom_add_hash (maru_bloom*, const uint8_t*);
+  int maru_bloom_test_hash (const maru_bloom*, const uint8_t*);
+
+  void maru_bloom_add_batch (maru_bloom*, const char**, size_t);
+  size_t maru_bloom_test_batch (const maru_bloom*, const char**, size_t, uint8_t*);
+
+  int maru_bloom_save (const maru_bloom*, const char*);
+  int maru_bloom_load (maru_bloom*, const char*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,288 @@
+/**
+  Copyright © 2017 Odzhan. All Rights Reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  3. The name of the author may not be used to endorse or promote products
+  derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY AUTHORS "AS IS" AND ANY EXPRESS OR
+  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+  STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE. */
+
+// Bulk hashing of keys in a file.
+//
+// Maps a file of keys, one per line or ending with NUL, and writes a
+// (hash, offset) record for each one. The file is cut into jobs on key
+// boundaries, threads hash the keys of a job with maru_batch or
+// maru2_batch into a buffer, and buffers are written in file order,
+// so the output is the same for any number of threads. Keys are C
+// strings of at most 64 bytes, as for maru and maru2. Empty keys are
+// skipped, and a CR before a newline is not part of the key.
+//
+// ./maru-bulk [-1] [-0] [-b] [-s seed] [-t threads] [-o out] file
+//
+//   -1  maru, 64-bit hashes. the default is maru2, 128-bit
+//   -0  keys end with NUL instead of newline
+//   -b  binary records: hash, then 64-bit offset, both little-endian.
+//       hex records are the hash, a space and the decimal offset.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "maru.h"
+#include "maru2.h"
+#include "keys.h"
+
+#define BULK_JOB    (4 << 20)  // bytes of input per job
+#define BULK_BATCH  1024       // keys per call to the batch API
+#define BULK_REC    (2*MARU2_HASH_LEN + 22) // longest hex record
+
+typedef struct _bulk_ctx {
+  const char      *data;
+  size_t          len;
+  uint64_t        njobs;
+  uint64_t        next;    // next job to hash
+  uint64_t        done;    // jobs written
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+  int             fd;
+  int             maru;    // 1 for maru, 2 for maru2
+  int             bin;
+  char            delim;
+  uint64_t        iv;
+  int             err;
+} bulk_ctx;
+
+typedef struct _bulk_buf {
+  char        *key;        // BULK_BATCH keys, NUL terminated
+  const char  *keys[BULK_BATCH];
+  uint64_t    off[BULK_BATCH];
+  uint64_t    h[BULK_BATCH];
+  uint8_t     h2[BULK_BATCH][MARU2_HASH_LEN];
+  size_t      n;
+  char        *out;
+  size_t      len, max;
+} bulk_buf;
+
+static const char bulk_hex[] = "0123456789abcdef";
+
+static char *bulk_u64(char *p, uint64_t x) {
+    char t[20];
+    int  i = 0;
+
+    do { t[i++] = (char)('0' + x % 10); x /= 10; } while (x != 0);
+    while (i != 0) *p++ = t[--i];
+    return p;
+}
+
+// hash the keys of the batch and add their records
+static int bulk_flush(bulk_ctx *b, bulk_buf *f) {
+    uint8_t h[MARU2_HASH_LEN];
+    char    *p;
+    size_t  i, hl;
+    int     j;
+
+    if (f->n == 0) return 1;
+
+    if (f->len + f->n * BULK_REC > f->max) {
+      f->max = (f->len + f->n * BULK_REC) * 2;
+      p = realloc(f->out, f->max);
+      if (p == NULL) return 0;
+      f->out = p;
+    }
+    if (b->maru == 1) {
+      maru_batch(f->keys, f->n, b->iv, f->h);
+      hl = 8;
+    } else {
+      maru2_batch(f->keys, f->n, b->iv, f->h2);
+      hl = MARU2_HASH_LEN;
+    }
+    p = f->out + f->len;
+
+    for (i=0; i<f->n; i++) {
+      if (b->maru == 1) memcpy(h, &f->h[i], 8);
+      else memcpy(h, f->h2[i], MARU2_HASH_LEN);
+
+      if (b->bin) {
+        memcpy(p, h, hl);
+        memcpy(p + hl, &f->off[i], 8);
+        p += hl + 8;
+        continue;
+      }
+      // maru prints the 64-bit value, maru2 the bytes
+      for (j=0; j<(int)hl; j++) {
+        uint8_t c = h[b->maru == 1 ? hl - 1 - j : (size_t)j];
+        *p++ = bulk_hex[c >> 4];
+        *p++ = bulk_hex[c & 15];
+      }
+      *p++ = ' ';
+      p = bulk_u64(p, f->off[i]);
+      *p++ = '\n';
+    }
+    f->len = p - f->out;
+    f->n   = 0;
+    return 1;
+}
+
+static int bulk_write(int fd, const char *p, size_t len) {
+    ssize_t r;
+
+    for (; len != 0; p += r, len -= r) {
+      r = write(fd, p, len);
+      if (r <= 0) return 0;
+    }
+    return 1;
+}
+
+static void *bulk_worker(void *arg) {
+    bulk_ctx  *b = (bulk_ctx*)arg;
+    bulk_buf  *f;
+    maru_keys k;
+    uint64_t  j;
+    int       ok;
+
+    f = calloc(1, sizeof(bulk_buf));
+    if (f != NULL) f->key = malloc(BULK_BATCH * MARU_KEY_LEN);
+
+    while ((j = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED)) < b->njobs) {
+      // out of memory still waits its turn, to fail the output
+      ok = f != NULL && f->key != NULL;
+      if (ok) f->len = 0;
+
+      maru_keys_job(&k, b->data, b->len, BULK_JOB, j, b->delim);
+      while (ok && maru_keys_next(&k, f->key + f->n * MARU_KEY_LEN, &f->off[f->n])) {
+        f->keys[f->n] = f->key + f->n * MARU_KEY_LEN;
+        if (++f->n == BULK_BATCH) ok = bulk_flush(b, f);
+      }
+      if (ok) ok = bulk_flush(b, f);
+
+      // wait for the jobs before this one
+      pthread_mutex_lock(&b->lock);
+      while (b->done != j) pthread_cond_wait(&b->cond, &b->lock);
+      if (ok && !b->err) ok = bulk_write(b->fd, f->out, f->len);
+      if (!ok) b->err = 1;
+      b->done++;
+      pthread_cond_broadcast(&b->cond);
+      pthread_mutex_unlock(&b->lock);
+    }
+    if (f != NULL) {
+      free(f->key);
+      free(f->out);
+      free(f);
+    }
+    return NULL;
+}
+
+static void usage(const char *s) {
+    printf("usage: %s [-1] [-0] [-b] [-s seed] [-t threads] [-o out] file\n", s);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    bulk_ctx    b;
+    struct stat st;
+    pthread_t   *id;
+    const char  *in = NULL, *out = NULL;
+    void        *m = NULL;
+    int         i, n, fd, threads = 0;
+
+    memset(&b, 0, sizeof(b));
+    b.maru  = 2;
+    b.delim = '\n';
+
+    for (i=1; i<argc; i++) {
+      if (argv[i][0] != '-' || argv[i][1] == 0) {
+        in = argv[i];
+        continue;
+      }
+      switch (argv[i][1]) {
+        case '1': b.maru = 1; break;
+        case '0': b.delim = 0; break;
+        case 'b': b.bin = 1; break;
+        case 's': if (++i == argc) usage(argv[0]);
+                  b.iv = strtoull(argv[i], NULL, 16); break;
+        case 't': if (++i == argc) usage(argv[0]);
+                  threads = atoi(argv[i]); break;
+        case 'o': if (++i == argc) usage(argv[0]);
+                  out = argv[i]; break;
+        default:  usage(argv[0]);
+      }
+    }
+    if (in == NULL) usage(argv[0]);
+
+    fd = open(in, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+      perror(in);
+      return 1;
+    }
+    b.len = (size_t)st.st_size;
+    if (b.len != 0) {
+      m = mmap(NULL, b.len, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (m == MAP_FAILED) {
+        perror(in);
+        return 1;
+      }
+      madvise(m, b.len, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    b.data = (const char*)m;
+    b.fd   = 1;
+    if (out != NULL) {
+      b.fd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (b.fd < 0) {
+        perror(out);
+        return 1;
+      }
+    }
+    b.njobs = (b.len + BULK_JOB - 1) / BULK_JOB;
+    pthread_mutex_init(&b.lock, NULL);
+    pthread_cond_init(&b.cond, NULL);
+
+    if (threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0) threads = 1;
+    if ((uint64_t)threads > b.njobs) threads = (int)b.njobs;
+
+    // this thread works too
+    id = malloc((threads + 1) * sizeof(pthread_t));
+    for (i=0, n=0; id != NULL && i<threads-1; i++) {
+      if (pthread_create(&id[n], NULL, bulk_worker, &b) == 0) n++;
+    }
+    bulk_worker(&b);
+    for (i=0; i<n; i++)
+      pthread_join(id[i], NULL);
+    free(id);
+
+    if (m != NULL) munmap(m, b.len);
+    if (out != NULL && close(b.fd) != 0) b.err = 1;
+    if (b.err) {
+      fprintf(stderr, "%s: write failed\n", out != NULL ? out : "stdout");
+      return 1;
+    }
+    return 0;
+}
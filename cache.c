@@ -0,0 +1,456 @@
+/**
+  Copyright © 2017 Odzhan. All Rights Reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  3. The name of the author may not be used to endorse or promote products
+  derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY AUTHORS "AS IS" AND ANY EXPRESS OR
+  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+  STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE. */
+
+#include <stdlib.h>
+
+#include "cache.h"
+
+// Concurrent cache of names and their hashes. There are two tables of
+// the same entries, one found by a cheap hash of the name and one by
+// the maru hash, so both directions are one probe. Each table is a
+// fixed array of buckets with MARU_CACHE_WAYS entries.
+//
+// Readers never write to an entry, except to set its reference bit.
+// Each entry has a sequence number that is odd while it's written, and
+// a reader copies the entry and checks the number didn't change.
+// Writers take an entry by making its number odd, so two writers never
+// share one; a writer that loses just skips the insert. The victim in
+// a full bucket is picked by a clock hand over the reference bits.
+
+#define MARU_CACHE_WAYS     8
+#define MARU_CACHE_NAME     MARU2_MAX_STR // maru and maru2 ignore the rest
+#define MARU_CACHE_STRIPES  64            // counter slots, threads share them
+#define MARU_CACHE_RETRY    4             // reads of an entry being written
+
+typedef struct _maru_cache_ent {
+  uint32_t seq;      // odd while written
+  uint8_t  ref;      // used since the clock hand passed
+  uint8_t  used;
+  uint8_t  len;      // name bytes
+  uint8_t  pad;
+  uint64_t tag;      // what the table is indexed by
+  uint64_t h[2];     // maru hash, zero padded
+  uint64_t name[MARU_CACHE_NAME/8]; // zero padded
+} maru_cache_ent;
+
+typedef struct _maru_cache_tbl {
+  maru_cache_ent *ent;
+  uint8_t        *hand;  // clock hand of each bucket
+  uint64_t       mask;   // buckets - 1
+} maru_cache_tbl;
+
+// one cache line per slot
+typedef struct _maru_cache_ctr {
+  uint64_t hits, misses, evictions;
+  uint64_t pad[5];
+} maru_cache_ctr;
+
+struct _maru_cache {
+  maru_cache_tbl byname;
+  maru_cache_tbl byhash;
+  int            type;
+  uint64_t       iv;
+  maru_cache_ctr ctr[MARU_CACHE_STRIPES];
+};
+
+// a copy of the fields of an entry
+typedef struct _maru_cache_val {
+  uint64_t tag;
+  uint64_t h[2];
+  uint64_t name[MARU_CACHE_NAME/8];
+  int      len;
+} maru_cache_val;
+
+static int maru_cache_tid_next;
+static __thread int maru_cache_tid = -1;
+
+static maru_cache_ctr *maru_cache_slot(maru_cache *c) {
+    if (maru_cache_tid < 0)
+      maru_cache_tid = __atomic_fetch_add(&maru_cache_tid_next, 1, __ATOMIC_RELAXED);
+    return &c->ctr[maru_cache_tid % MARU_CACHE_STRIPES];
+}
+
+// slots are shared once there are more threads than stripes
+#define MARU_CACHE_COUNT(c, f) \
+  __atomic_fetch_add(&maru_cache_slot(c)->f, 1, __ATOMIC_RELAXED)
+
+// copy name, at most MARU_CACHE_NAME bytes, into zeroed words.
+// returns a hash of it for the name table, not a maru hash.
+static uint64_t maru_cache_key(const char *name, maru_cache_val *v) {
+    uint64_t x;
+    int      i;
+
+    memset(v, 0, sizeof(*v));
+    for (v->len=0; v->len<MARU_CACHE_NAME && name[v->len] != 0; v->len++);
+    memcpy(v->name, name, v->len);
+
+    x = (uint64_t)v->len * 0x9E3779B97F4A7C15ULL;
+    for (i=0; i<(v->len + 7) / 8; i++) {
+      x = (x ^ v->name[i]) * 0xBF58476D1CE4E5B9ULL;
+      x ^= x >> 29;
+    }
+    x *= 0x94D049BB133111EBULL;
+    return x ^ (x >> 32);
+}
+
+static int maru_cache_tbl_new(maru_cache_tbl *t, size_t bytes) {
+    uint64_t n = 1;
+
+    while (n * 2 * MARU_CACHE_WAYS * sizeof(maru_cache_ent) <= bytes) n *= 2;
+
+    t->mask = n - 1;
+    t->ent  = calloc(n * MARU_CACHE_WAYS, sizeof(maru_cache_ent));
+    t->hand = calloc(n, 1);
+    return t->ent != NULL && t->hand != NULL;
+}
+
+// bytes is the memory for entries, split between the two tables.
+// type is MARU_CACHE_MARU or MARU_CACHE_MARU2.
+maru_cache *maru_cache_new(size_t bytes, int type, uint64_t iv) {
+    maru_cache *c;
+
+    if (type != MARU_CACHE_MARU && type != MARU_CACHE_MARU2) return NULL;
+
+    c = calloc(1, sizeof(maru_cache));
+    if (c == NULL) return NULL;
+
+    c->type = type;
+    c->iv   = iv;
+    if (!maru_cache_tbl_new(&c->byname, bytes / 2) ||
+        !maru_cache_tbl_new(&c->byhash, bytes / 2)) {
+      maru_cache_free(c);
+      return NULL;
+    }
+    return c;
+}
+
+void maru_cache_free(maru_cache *c) {
+    if (c == NULL) return;
+    free(c->byname.ent);
+    free(c->byname.hand);
+    free(c->byhash.ent);
+    free(c->byhash.hand);
+    free(c);
+}
+
+// consistent copy of e, 0 if it's empty or keeps changing
+static int maru_cache_read(const maru_cache_ent *e, maru_cache_val *v) {
+    uint32_t s;
+    int      i, r;
+
+    for (r=0; r<MARU_CACHE_RETRY; r++) {
+      s = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+      if (s & 1) continue;
+
+      if (!__atomic_load_n(&e->used, __ATOMIC_RELAXED)) return 0;
+      v->tag  = __atomic_load_n(&e->tag, __ATOMIC_RELAXED);
+      v->len  = __atomic_load_n(&e->len, __ATOMIC_RELAXED);
+      v->h[0] = __atomic_load_n(&e->h[0], __ATOMIC_RELAXED);
+      v->h[1] = __atomic_load_n(&e->h[1], __ATOMIC_RELAXED);
+      for (i=0; i<MARU_CACHE_NAME/8; i++)
+        v->name[i] = __atomic_load_n(&e->name[i], __ATOMIC_RELAXED);
+
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) == s) return 1;
+    }
+    return 0;
+}
+
+// entry of bucket tag that matches name, or the hash if name is NULL
+static maru_cache_ent *maru_cache_find(maru_cache_tbl *t, uint64_t tag,
+  const maru_cache_val *name, const uint64_t *h, maru_cache_val *v)
+{
+    maru_cache_ent *e = &t->ent[(tag & t->mask) * MARU_CACHE_WAYS];
+    int            i;
+
+    for (i=0; i<MARU_CACHE_WAYS; i++, e++) {
+      // cheap test first, the copy is checked below
+      if (__atomic_load_n(&e->tag, __ATOMIC_RELAXED) != tag) continue;
+      if (!maru_cache_read(e, v) || v->tag != tag) continue;
+
+      if (name != NULL ? (v->len == name->len && memcmp(v->name, name->name, sizeof(v->name)) == 0)
+                       : (v->h[0] == h[0] && v->h[1] == h[1])) {
+        // don't write the line if the bit is set already
+        if (!__atomic_load_n(&e->ref, __ATOMIC_RELAXED))
+          __atomic_store_n(&e->ref, 1, __ATOMIC_RELAXED);
+        return e;
+      }
+    }
+    return NULL;
+}
+
+// add v to bucket tag, replacing an empty entry or the clock victim
+static void maru_cache_add(maru_cache *c, maru_cache_tbl *t, uint64_t tag, const maru_cache_val *v) {
+    maru_cache_ent *b = &t->ent[(tag & t->mask) * MARU_CACHE_WAYS], *e = NULL;
+    uint8_t        *hand = &t->hand[tag & t->mask];
+    uint32_t       s;
+    int            i, h, old;
+
+    for (i=0; i<MARU_CACHE_WAYS; i++) {
+      if (!__atomic_load_n(&b[i].used, __ATOMIC_RELAXED)) {
+        e = &b[i];
+        break;
+      }
+    }
+    // second chance for entries used since the last pass
+    h = __atomic_load_n(hand, __ATOMIC_RELAXED);
+    for (i=0; e == NULL && i<2*MARU_CACHE_WAYS; i++, h = (h + 1) % MARU_CACHE_WAYS) {
+      if (__atomic_load_n(&b[h].ref, __ATOMIC_RELAXED))
+        __atomic_store_n(&b[h].ref, 0, __ATOMIC_RELAXED);
+      else
+        e = &b[h];
+    }
+    if (e == NULL) e = &b[h];
+    __atomic_store_n(hand, (uint8_t)((h + 1) % MARU_CACHE_WAYS), __ATOMIC_RELAXED);
+
+    // another writer has it, this insert can be dropped
+    s = __atomic_load_n(&e->seq, __ATOMIC_RELAXED);
+    if ((s & 1) || !__atomic_compare_exchange_n(&e->seq, &s, s + 1, 0,
+          __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) return;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    old = __atomic_load_n(&e->used, __ATOMIC_RELAXED);
+    __atomic_store_n(&e->used, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&e->ref, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&e->tag, tag, __ATOMIC_RELAXED);
+    __atomic_store_n(&e->len, (uint8_t)v->len, __ATOMIC_RELAXED);
+    __atomic_store_n(&e->h[0], v->h[0], __ATOMIC_RELAXED);
+    __atomic_store_n(&e->h[1], v->h[1], __ATOMIC_RELAXED);
+    for (i=0; i<MARU_CACHE_NAME/8; i++)
+      __atomic_store_n(&e->name[i], v->name[i], __ATOMIC_RELAXED);
+
+    __atomic_store_n(&e->seq, s + 2, __ATOMIC_RELEASE);
+    if (old) MARU_CACHE_COUNT(c, evictions);
+}
+
+// hash name and add it to both tables
+static void maru_cache_fill(maru_cache *c, uint64_t tag, maru_cache_val *v) {
+    char key[MARU_CACHE_NAME + 1];
+
+    memcpy(key, v->name, v->len);
+    key[v->len] = 0;
+
+    if (c->type == MARU_CACHE_MARU) {
+      v->h[0] = maru(key, c->iv);
+      v->h[1] = 0;
+    } else {
+      maru2(key, c->iv, v->h);
+    }
+    maru_cache_add(c, &c->byname, tag, v);
+    maru_cache_add(c, &c->byhash, v->h[0], v);
+}
+
+// hash of name, 8 bytes for maru and 16 for maru2
+void maru_cache_hash(maru_cache *c, const char *name, void *out) {
+    maru_cache_val k, v;
+    uint64_t       tag;
+
+    tag = maru_cache_key(name, &k);
+    if (maru_cache_find(&c->byname, tag, &k, NULL, &v) != NULL) {
+      MARU_CACHE_COUNT(c, hits);
+    } else {
+      MARU_CACHE_COUNT(c, misses);
+      maru_cache_fill(c, tag, &k);
+      v = k;
+    }
+    memcpy(out, v.h, c->type == MARU_CACHE_MARU ? 8 : MARU2_HASH_LEN);
+}
+
+// name of a hash seen before. copies at most size-1 bytes and a null.
+// returns the length of the name, or -1 if it isn't cached.
+int maru_cache_name(maru_cache *c, const void *hash, char *name, size_t size) {
+    maru_cache_val v;
+    uint64_t       h[2] = { 0, 0 };
+    size_t         n;
+
+    memcpy(h, hash, c->type == MARU_CACHE_MARU ? 8 : MARU2_HASH_LEN);
+
+    if (maru_cache_find(&c->byhash, h[0], NULL, h, &v) == NULL) {
+      MARU_CACHE_COUNT(c, misses);
+      return -1;
+    }
+    MARU_CACHE_COUNT(c, hits);
+    if (size != 0) {
+      n = (size_t)v.len < size - 1 ? (size_t)v.len : size - 1;
+      memcpy(name, v.name, n);
+      name[n] = 0;
+    }
+    return v.len;
+}
+
+// add a name without looking it up, e.g. from a symbol table
+void maru_cache_put(maru_cache *c, const char *name) {
+    maru_cache_val k;
+
+    maru_cache_fill(c, maru_cache_key(name, &k), &k);
+}
+
+// counters are per stripe, the sums are not a snapshot
+void maru_cache_counters(const maru_cache *c, maru_cache_stats *s) {
+    int i;
+
+    memset(s, 0, sizeof(*s));
+    for (i=0; i<MARU_CACHE_STRIPES; i++) {
+      s->hits      += __atomic_load_n(&c->ctr[i].hits, __ATOMIC_RELAXED);
+      s->misses    += __atomic_load_n(&c->ctr[i].misses, __ATOMIC_RELAXED);
+      s->evictions += __atomic_load_n(&c->ctr[i].evictions, __ATOMIC_RELAXED);
+    }
+}
+
+#ifdef TEST
+
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define NNAMES  20000
+#define NLOOKUP 2000000
+
+typedef struct _cache_thread {
+  pthread_t  id;
+  maru_cache *c;
+  char       (*names)[32];
+  int        n;        // names used
+  int        seed;
+  int        check;    // compare with maru, off when timing
+  int        ok;
+} cache_thread;
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// every answer must be right, whatever the other threads evict
+static void *cache_worker(void *arg) {
+    cache_thread *t = (cache_thread*)arg;
+    uint64_t     h, x = t->seed;
+    char         name[MARU_CACHE_NAME + 1];
+    int          i, j, r;
+
+    for (i=0; i<NLOOKUP; i++) {
+      x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+      j = (int)((x >> 33) % t->n);
+
+      maru_cache_hash(t->c, t->names[j], &h);
+      r = maru_cache_name(t->c, &h, name, sizeof(name));
+      if (!t->check) continue;
+
+      t->ok &= h == maru(t->names[j], 0);
+      t->ok &= r < 0 || (strcmp(name, t->names[j]) == 0 && r == (int)strlen(name));
+    }
+    return NULL;
+}
+
+static double cache_run(maru_cache *c, char (*names)[32], int n, int nt, int check, int *ok) {
+    cache_thread t[64];
+    double       t0;
+    int          i;
+
+    t0 = now();
+    for (i=0; i<nt; i++) {
+      t[i].c     = c;
+      t[i].names = names;
+      t[i].n     = n;
+      t[i].seed  = i + 1;
+      t[i].check = check;
+      t[i].ok    = 1;
+      pthread_create(&t[i].id, NULL, cache_worker, &t[i]);
+    }
+    for (i=0; i<nt; i++) {
+      pthread_join(t[i].id, NULL);
+      *ok &= t[i].ok;
+    }
+    return (now() - t0) * 1e9 / ((double)NLOOKUP * nt * 2);
+}
+
+int main(void) {
+    maru_cache       *c;
+    maru_cache_stats s;
+    char             (*names)[32], name[MARU_CACHE_NAME + 1];
+    uint8_t          h[MARU2_HASH_LEN], ref[MARU2_HASH_LEN];
+    double           ns, t0, t1;
+    int              i, ok, nt, ncpu;
+
+    names = malloc(NNAMES * sizeof(names[0]));
+    for (i=0; i<NNAMES; i++)
+      snprintf(names[i], sizeof(names[0]), "sym_%d_%x", i, i * 2654435761u);
+
+    // both directions, maru2
+    c = maru_cache_new(1 << 20, MARU_CACHE_MARU2, 0x15DF1E4BE5E7970FULL);
+    maru_cache_hash(c, names[0], h);
+    maru2(names[0], 0x15DF1E4BE5E7970FULL, ref);
+    ok = memcmp(h, ref, MARU2_HASH_LEN) == 0;
+    ok &= maru_cache_name(c, h, name, sizeof(name)) == (int)strlen(names[0]);
+    ok &= strcmp(name, names[0]) == 0;
+    h[15] ^= 1;
+    ok &= maru_cache_name(c, h, name, sizeof(name)) == -1;
+    maru_cache_counters(c, &s);
+    ok &= s.hits == 1 && s.misses == 2;
+    printf("maru_cache(maru2) : %s\n", ok ? "OK" : "FAIL");
+    maru_cache_free(c);
+
+    // more names than fit, from all cores
+    ncpu = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu > 64) ncpu = 64;
+    c = maru_cache_new(256 << 10, MARU_CACHE_MARU, 0);
+    ok = 1;
+    ns = cache_run(c, names, NNAMES, ncpu, 1, &ok);
+    maru_cache_counters(c, &s);
+    ok &= s.evictions != 0;
+    printf("maru_cache(%d names, %d threads) : %s, %.1f ns per lookup, %.0f%% hits, %llu evictions\n",
+      NNAMES, ncpu, ok ? "OK" : "FAIL", ns, 100.0 * s.hits / (s.hits + s.misses),
+      (unsigned long long)s.evictions);
+    maru_cache_free(c);
+
+    // names that fit, read only after warm up
+    c = maru_cache_new(4 << 20, MARU_CACHE_MARU, 0);
+    for (i=0; i<1000; i++) maru_cache_put(c, names[i]);
+    ok = 1;
+    cache_run(c, names, 1000, 1, 1, &ok);
+    maru_cache_counters(c, &s);
+    printf("maru_cache(1000 names) : %s, %llu misses\n", ok && s.misses == 0 ? "OK" : "FAIL",
+      (unsigned long long)s.misses);
+
+    for (nt=1; nt<=ncpu; nt*=2) {
+      ns = cache_run(c, names, 1000, nt, 0, &ok);
+      printf("maru_cache(1000 names, %d threads) : %.1f ns per lookup\n", nt, ns);
+    }
+    t0 = now();
+    for (i=0; i<NLOOKUP; i++) ok &= maru(names[i % 1000], 0) != 0;
+    t1 = now();
+    printf("maru(1000 names) : %.1f ns per hash\n", (t1 - t0) * 1e9 / NLOOKUP);
+    maru_cache_free(c);
+    free(names);
+    return 0;
+}
+#endif
@@ -0,0 +1,64 @@
+/**
+  Copyright © 2017 Odzhan. All Rights Reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  3. The name of the author may not be used to endorse or promote products
+  derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY AUTHORS "AS IS" AND ANY EXPRESS OR
+  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+  STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE. */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "maru.h"
+#include "maru2.h"
+
+#define MARU_CACHE_MARU   1 // 64-bit hashes
+#define MARU_CACHE_MARU2  2 // 128-bit hashes
+
+typedef struct _maru_cache maru_cache;
+
+typedef struct _maru_cache_stats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+} maru_cache_stats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  maru_cache *maru_cache_new (size_t, int, uint64_t);
+  void maru_cache_free (maru_cache*);
+
+  void maru_cache_hash (maru_cache*, const char*, void*);
+  int maru_cache_name (maru_cache*, const void*, char*, size_t);
+  void maru_cache_put (maru_cache*, const char*);
+
+  void maru_cache_counters (const maru_cache*, maru_cache_stats*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,734 @@
+/**
+  Copyright © 2017 Odzhan. All Rights Reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  3. The name of the author may not be used to endorse or promote products
+  derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY AUTHORS "AS IS" AND ANY EXPRESS OR
+  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+  STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE. */
+
+// Hash service for processes that hash a few names at a time. Clients
+// send requests over a Unix socket, the server gathers them from every
+// client for up to a window of time, then hashes them with maru2_batch
+// so the SIMD kernels get full lanes. Replies carry the id of the
+// request, so a client can have many requests in flight.
+//
+// One thread serves all clients with non-blocking sockets and poll.
+// Requests wait in one array until it's full or the oldest is older
+// than the window. They're sorted by iv, since a batch has one iv.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "hashd.h"
+
+#define HASHD_IN      4096          // read buffer of a connection
+#define HASHD_OUT_MAX (4*HASHD_IN)  // replies held before reading stops
+
+typedef struct _hashd_conn {
+  int      fd;             // -1 when free
+  uint32_t gen;            // changes when the slot is reused
+  size_t   ilen;
+  uint8_t  in[HASHD_IN];
+  uint8_t  *out;           // replies not written yet
+  size_t   olen, ocap;
+} hashd_conn;
+
+typedef struct _hashd_req {
+  uint64_t iv;
+  uint64_t t;              // when it was read
+  uint32_t id;
+  uint32_t gen;
+  int      conn;
+  char     key[MARU2_MAX_STR + 1];
+} hashd_req;
+
+struct _hashd_server {
+  int         lfd, wake[2], stop;
+  uint64_t    window;      // in nanoseconds
+  char        path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+  hashd_stats st;
+  int         nreq;
+  hashd_req   req[HASHD_BATCH];
+  hashd_conn  conn[HASHD_MAX_CONN];
+};
+
+struct _hashd_client {
+  int     fd;
+  size_t  ilen, olen;
+  uint8_t in[HASHD_IN];
+  uint8_t out[HASHD_IN];
+};
+
+static uint64_t hashd_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// write all of p, the socket may be blocking or not
+static ssize_t hashd_write(int fd, const void *p, size_t len) {
+    size_t  i;
+    ssize_t r;
+
+    for (i=0; i<len; i+=r) {
+      r = send(fd, (const uint8_t*)p + i, len - i, MSG_NOSIGNAL);
+      if (r < 0 && errno == EINTR) r = 0;
+      else if (r < 0) return (errno == EAGAIN && i != 0) ? (ssize_t)i : r;
+    }
+    return (ssize_t)i;
+}
+
+static void hashd_drop(hashd_conn *c) {
+    close(c->fd);
+    free(c->out);
+    c->fd   = -1;
+    c->out  = NULL;
+    c->ilen = c->olen = c->ocap = 0;
+    c->gen++;
+}
+
+// send what replies the socket takes, keep the rest for POLLOUT
+static void hashd_flush_out(hashd_conn *c) {
+    ssize_t r;
+
+    if (c->olen == 0) return;
+    r = hashd_write(c->fd, c->out, c->olen);
+    if (r < 0 && errno != EAGAIN) {
+      hashd_drop(c);
+      return;
+    }
+    if (r > 0) {
+      memmove(c->out, c->out + r, c->olen - r);
+      c->olen -= r;
+    }
+}
+
+static int hashd_cmp_iv(const void *a, const void *b) {
+    uint64_t x = ((const hashd_req*)a)->iv, y = ((const hashd_req*)b)->iv;
+
+    return (x > y) - (x < y);
+}
+
+// hash the waiting requests, one batch per iv, and queue the replies
+static void hashd_batch(hashd_server *s) {
+    const char *keys[HASHD_BATCH];
+    uint8_t    out[HASHD_BATCH][MARU2_HASH_LEN], *p;
+    hashd_conn *c;
+    hashd_req  *q;
+    uint64_t   t, w;
+    int        i, j;
+
+    qsort(s->req, s->nreq, sizeof(hashd_req), hashd_cmp_iv);
+
+    for (i=0; i<s->nreq; i=j) {
+      for (j=i; j<s->nreq && s->req[j].iv == s->req[i].iv; j++)
+        keys[j] = s->req[j].key;
+      maru2_batch(&keys[i], j - i, s->req[i].iv, &out[i]);
+      __atomic_add_fetch(&s->st.batches, 1, __ATOMIC_RELAXED);
+    }
+    t = hashd_now();
+
+    for (i=0; i<s->nreq; i++) {
+      q = &s->req[i];
+      c = &s->conn[q->conn];
+      // the client has gone
+      if (c->fd < 0 || c->gen != q->gen) continue;
+
+      if (c->olen + HASHD_REPLY_LEN > c->ocap) {
+        c->ocap = c->ocap ? c->ocap * 2 : HASHD_IN;
+        p = (uint8_t*)realloc(c->out, c->ocap);
+        if (p == NULL) {
+          hashd_drop(c);
+          continue;
+        }
+        c->out = p;
+      }
+      memcpy(c->out + c->olen, &q->id, 4);
+      memcpy(c->out + c->olen + 4, out[i], MARU2_HASH_LEN);
+      c->olen += HASHD_REPLY_LEN;
+
+      w = t - q->t;
+      __atomic_add_fetch(&s->st.requests, 1, __ATOMIC_RELAXED);
+      __atomic_add_fetch(&s->st.wait_ns, w, __ATOMIC_RELAXED);
+      if (w > s->st.wait_max) __atomic_store_n(&s->st.wait_max, w, __ATOMIC_RELAXED);
+    }
+    s->nreq = 0;
+
+    for (i=0; i<HASHD_MAX_CONN; i++)
+      if (s->conn[i].fd >= 0) hashd_flush_out(&s->conn[i]);
+}
+
+// read what the client sent and queue whole requests
+static void hashd_read(hashd_server *s, int ci) {
+    hashd_conn    *c = &s->conn[ci];
+    hashd_req_hdr h;
+    hashd_req     *q;
+    size_t        pos;
+    ssize_t       r;
+
+    for (;;) {
+      // a client that doesn't read its replies waits for them to drain
+      if (c->olen >= HASHD_OUT_MAX) return;
+
+      r = read(c->fd, c->in + c->ilen, HASHD_IN - c->ilen);
+      if (r < 0 && errno == EINTR) continue;
+      if (r < 0 && errno == EAGAIN) return;
+      if (r <= 0) {
+        hashd_drop(c);
+        return;
+      }
+      c->ilen += r;
+
+      for (pos=0; c->ilen - pos >= sizeof(h); pos += sizeof(h) + h.len) {
+        memcpy(&h, c->in + pos, sizeof(h));
+        if (h.len > MARU2_MAX_STR) {
+          hashd_drop(c);
+          return;
+        }
+        if (c->ilen - pos < sizeof(h) + h.len) break;
+
+        q = &s->req[s->nreq++];
+        q->iv   = h.iv;
+        q->id   = h.id;
+        q->conn = ci;
+        q->gen  = c->gen;
+        q->t    = hashd_now();
+        memcpy(q->key, c->in + pos + sizeof(h), h.len);
+        q->key[h.len] = 0;
+
+        if (s->nreq == HASHD_BATCH) hashd_batch(s);
+        // the batch may have dropped this client
+        if (c->fd < 0) return;
+      }
+      memmove(c->in, c->in + pos, c->ilen - pos);
+      c->ilen -= pos;
+    }
+}
+
+static void hashd_accept(hashd_server *s) {
+    int fd, i;
+
+    for (;;) {
+      fd = accept4(s->lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0) return;
+
+      for (i=0; i<HASHD_MAX_CONN && s->conn[i].fd >= 0; i++);
+      if (i == HASHD_MAX_CONN) {
+        close(fd);
+        continue;
+      }
+      s->conn[i].fd = fd;
+      __atomic_add_fetch(&s->st.clients, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// listen on path, requests wait up to window microseconds for a batch
+hashd_server *hashd_open(const char *path, int window) {
+    struct sockaddr_un sa;
+    hashd_server       *s;
+    int                i;
+
+    if (strlen(path) >= sizeof(sa.sun_path)) return NULL;
+
+    s = (hashd_server*)calloc(1, sizeof(hashd_server));
+    if (s == NULL) return NULL;
+
+    for (i=0; i<HASHD_MAX_CONN; i++) s->conn[i].fd = -1;
+    s->window = (uint64_t)(window < 0 ? HASHD_WINDOW : window) * 1000;
+    strcpy(s->path, path);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    strcpy(sa.sun_path, path);
+
+    s->lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (s->lfd < 0) {
+      free(s);
+      return NULL;
+    }
+    if (pipe2(s->wake, O_NONBLOCK | O_CLOEXEC) < 0) {
+      close(s->lfd);
+      free(s);
+      return NULL;
+    }
+    unlink(path);
+    if (bind(s->lfd, (struct sockaddr*)&sa, sizeof(sa)) < 0 || listen(s->lfd, 64) < 0) {
+      hashd_close(s);
+      return NULL;
+    }
+    return s;
+}
+
+// serve until hashd_stop
+int hashd_run(hashd_server *s) {
+    struct pollfd   pfd[HASHD_MAX_CONN + 2];
+    struct timespec ts, *tp;
+    uint64_t        now;
+    int             map[HASHD_MAX_CONN], n, i;
+    char            b[64];
+
+    while (!__atomic_load_n(&s->stop, __ATOMIC_ACQUIRE)) {
+      pfd[0].fd = s->wake[0]; pfd[0].events = POLLIN;
+      pfd[1].fd = s->lfd;     pfd[1].events = POLLIN;
+      for (i=0, n=2; i<HASHD_MAX_CONN; i++) {
+        if (s->conn[i].fd < 0) continue;
+        pfd[n].fd     = s->conn[i].fd;
+        pfd[n].events = (s->conn[i].olen < HASHD_OUT_MAX ? POLLIN : 0) |
+                        (s->conn[i].olen ? POLLOUT : 0);
+        map[n - 2]    = i;
+        n++;
+      }
+      // wake up when the oldest request has waited the window
+      tp = NULL;
+      if (s->nreq != 0) {
+        now = hashd_now();
+        now = (s->req[0].t + s->window > now) ? s->req[0].t + s->window - now : 0;
+        ts.tv_sec  = now / 1000000000ULL;
+        ts.tv_nsec = now % 1000000000ULL;
+        tp = &ts;
+      }
+      if (ppoll(pfd, n, tp, NULL) < 0 && errno != EINTR) return -1;
+
+      if (pfd[0].revents & POLLIN) while (read(s->wake[0], b, sizeof(b)) > 0);
+      if (pfd[1].revents & POLLIN) hashd_accept(s);
+
+      for (i=2; i<n; i++) {
+        if (s->conn[map[i - 2]].fd != pfd[i].fd) continue;
+        if (pfd[i].revents & POLLOUT) hashd_flush_out(&s->conn[map[i - 2]]);
+        if (s->conn[map[i - 2]].fd != pfd[i].fd) continue;
+        if (pfd[i].revents & (POLLIN | POLLHUP | POLLERR)) hashd_read(s, map[i - 2]);
+      }
+      if (s->nreq != 0 && hashd_now() - s->req[0].t >= s->window) hashd_batch(s);
+    }
+    if (s->nreq != 0) hashd_batch(s);
+    return 0;
+}
+
+// safe to call from a signal handler or another thread
+void hashd_stop(hashd_server *s) {
+    ssize_t r;
+
+    __atomic_store_n(&s->stop, 1, __ATOMIC_RELEASE);
+    r = write(s->wake[1], "", 1);
+    (void)r;
+}
+
+void hashd_close(hashd_server *s) {
+    int i;
+
+    for (i=0; i<HASHD_MAX_CONN; i++)
+      if (s->conn[i].fd >= 0) hashd_drop(&s->conn[i]);
+    close(s->wake[0]);
+    close(s->wake[1]);
+    close(s->lfd);
+    unlink(s->path);
+    free(s);
+}
+
+void hashd_counters(hashd_server *s, hashd_stats *st) {
+    st->requests = __atomic_load_n(&s->st.requests, __ATOMIC_RELAXED);
+    st->batches  = __atomic_load_n(&s->st.batches, __ATOMIC_RELAXED);
+    st->clients  = __atomic_load_n(&s->st.clients, __ATOMIC_RELAXED);
+    st->wait_ns  = __atomic_load_n(&s->st.wait_ns, __ATOMIC_RELAXED);
+    st->wait_max = __atomic_load_n(&s->st.wait_max, __ATOMIC_RELAXED);
+}
+
+hashd_client *hashd_connect(const char *path) {
+    struct sockaddr_un sa;
+    hashd_client       *c;
+
+    if (strlen(path) >= sizeof(sa.sun_path)) return NULL;
+
+    c = (hashd_client*)calloc(1, sizeof(hashd_client));
+    if (c == NULL) return NULL;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    strcpy(sa.sun_path, path);
+
+    c->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (c->fd < 0 || connect(c->fd, (struct sockaddr*)&sa, sizeof(sa)) < 0) {
+      if (c->fd >= 0) close(c->fd);
+      free(c);
+      return NULL;
+    }
+    return c;
+}
+
+static int hashd_client_flush(hashd_client *c) {
+    if (c->olen != 0 && hashd_write(c->fd, c->out, c->olen) != (ssize_t)c->olen)
+      return -1;
+    c->olen = 0;
+    return 0;
+}
+
+// queue a request, it's sent when the buffer fills or by hashd_recv
+int hashd_send(hashd_client *c, uint32_t id, const char *key, uint64_t iv) {
+    hashd_req_hdr h;
+    size_t        len;
+
+    for (len=0; len<MARU2_MAX_STR && key[len] != 0; len++);
+
+    if (c->olen + sizeof(h) + len > sizeof(c->out) && hashd_client_flush(c) < 0)
+      return -1;
+
+    h.iv  = iv;
+    h.id  = id;
+    h.len = (uint32_t)len;
+    memcpy(c->out + c->olen, &h, sizeof(h));
+    memcpy(c->out + c->olen + sizeof(h), key, len);
+    c->olen += sizeof(h) + len;
+    return 0;
+}
+
+// wait for the next reply, in any order
+int hashd_recv(hashd_client *c, uint32_t *id, void *out) {
+    ssize_t r;
+
+    if (hashd_client_flush(c) < 0) return -1;
+
+    while (c->ilen < HASHD_REPLY_LEN) {
+      r = read(c->fd, c->in + c->ilen, sizeof(c->in) - c->ilen);
+      if (r < 0 && errno == EINTR) continue;
+      if (r <= 0) return -1;
+      c->ilen += r;
+    }
+    memcpy(id, c->in, 4);
+    memcpy(out, c->in + 4, MARU2_HASH_LEN);
+    memmove(c->in, c->in + HASHD_REPLY_LEN, c->ilen - HASHD_REPLY_LEN);
+    c->ilen -= HASHD_REPLY_LEN;
+    return 0;
+}
+
+// one request and its reply, with nothing else in flight
+int hashd_hash(hashd_client *c, const char *key, uint64_t iv, void *out) {
+    uint32_t id;
+
+    if (hashd_send(c, 0, key, iv) < 0) return -1;
+    return hashd_recv(c, &id, out);
+}
+
+void hashd_disconnect(hashd_client *c) {
+    close(c->fd);
+    free(c);
+}
+
+#ifdef TEST
+
+#include <stdio.h>
+#include <pthread.h>
+
+#define NCLIENTS  8
+#define NKEYS     20000
+#define INFLIGHT  256
+
+typedef struct _hashd_thread {
+  pthread_t  id;
+  const char *path;
+  int        seed;
+  int        ok;
+} hashd_thread;
+
+void bin2hex(void *in, int len) {
+    int i;
+
+    for (i=0; i<len; i++) printf("%02x", ((uint8_t*)in)[i]);
+}
+
+static void key_of(char *key, int seed, int i) {
+    snprintf(key, 32, "Fn%d_%x", i, i * 2654435761u + seed);
+}
+
+// keep INFLIGHT requests in flight and check each reply
+static void *hashd_worker(void *arg) {
+    hashd_thread *t = (hashd_thread*)arg;
+    hashd_client *c;
+    uint8_t      h[MARU2_HASH_LEN], ref[MARU2_HASH_LEN];
+    uint32_t     id;
+    uint64_t     iv;
+    char         key[32];
+    int          sent, done;
+
+    c = hashd_connect(t->path);
+    if (c == NULL) return NULL;
+
+    for (sent=0, done=0, t->ok=1; done<NKEYS; done++) {
+      for (; sent<NKEYS && sent-done<INFLIGHT; sent++) {
+        key_of(key, t->seed, sent);
+        // two ivs, so batches are split
+        t->ok &= hashd_send(c, sent, key, sent & 1) == 0;
+      }
+      if (hashd_recv(c, &id, h) < 0 || id >= NKEYS) {
+        t->ok = 0;
+        break;
+      }
+      iv = id & 1;
+      key_of(key, t->seed, id);
+      maru2(key, iv, ref);
+      t->ok &= memcmp(h, ref, MARU2_HASH_LEN) == 0;
+    }
+    hashd_disconnect(c);
+    return NULL;
+}
+
+static void *hashd_serve(void *arg) {
+    hashd_run((hashd_server*)arg);
+    return NULL;
+}
+
+static hashd_server *hashd_sig;
+
+static void hashd_on_signal(int sig) {
+    (void)sig;
+    hashd_stop(hashd_sig);
+}
+
+// send NSLOW requests without reading replies until the socket stalls,
+// the server must stop reading instead of queueing every reply
+#define NSLOW 200000
+
+static void slow_req(uint8_t *req, int id) {
+    hashd_req_hdr h;
+
+    h.iv  = 0;
+    h.id  = id;
+    h.len = 8;
+    memcpy(req, &h, sizeof(h));
+    memcpy(req + sizeof(h), "slowread", 8);
+}
+
+static int slow_test(hashd_server *s, const char *path) {
+    struct sockaddr_un sa;
+    struct pollfd      p;
+    hashd_stats        st;
+    uint8_t            req[sizeof(hashd_req_hdr) + 8], rep[64 * HASHD_REPLY_LEN];
+    uint64_t           base, held = 0;
+    size_t             pos = 0, len = 0, got = 0, r;
+    ssize_t            n;
+    int                fd, sent = 0, ok = 1;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    strcpy(sa.sun_path, path);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&sa, sizeof(sa)) < 0) {
+      printf("slow reader       : FAIL, can't connect\n");
+      return 0;
+    }
+
+    hashd_counters(s, &st);
+    base = st.requests;
+
+    // write only, until the server stops taking requests
+    p.fd = fd;
+    p.events = POLLOUT;
+    for (;;) {
+      if (pos == len) {
+        if (sent == NSLOW) break;
+        slow_req(req, sent++);
+        pos = 0;
+        len = sizeof(req);
+      }
+      n = write(fd, req + pos, len - pos);
+      if (n > 0) {
+        pos += n;
+      } else if (poll(&p, 1, 200) == 0) {
+        break;
+      }
+    }
+    hashd_counters(s, &st);
+    held = st.requests - base;
+
+    // now read the replies and send the rest
+    while (got < (size_t)NSLOW * HASHD_REPLY_LEN) {
+      p.events = POLLIN | (sent < NSLOW || pos < len ? POLLOUT : 0);
+      if (poll(&p, 1, 5000) <= 0) {
+        ok = 0;
+        break;
+      }
+      if (p.revents & POLLIN) {
+        n = read(fd, rep, sizeof(rep));
+        if (n <= 0) {
+          ok = 0;
+          break;
+        }
+        got += n;
+      }
+      if (p.revents & POLLOUT) {
+        for (r=0; r<64 && (sent < NSLOW || pos < len); r++) {
+          if (pos == len) {
+            slow_req(req, sent++);
+            pos = 0;
+            len = sizeof(req);
+          }
+          n = write(fd, req + pos, len - pos);
+          if (n <= 0) break;
+          pos += n;
+        }
+      }
+    }
+    close(fd);
+    printf("slow reader       : %s, %llu of %d replies held\n",
+      ok && sent == NSLOW && held < NSLOW / 2 ? "OK" : "FAIL",
+      (unsigned long long)held, NSLOW);
+    return ok && held < NSLOW / 2;
+}
+
+static void hashd_print(hashd_server *s, double secs) {
+    hashd_stats st;
+
+    hashd_counters(s, &st);
+    printf("requests          : %llu in %.2f s, %.0f per second\n",
+      (unsigned long long)st.requests, secs, st.requests / secs);
+    printf("batch             : %.1f keys mean\n",
+      st.batches ? (double)st.requests / st.batches : 0.0);
+    printf("queue latency     : %.1f us mean, %.1f us max\n",
+      st.requests ? st.wait_ns / 1e3 / st.requests : 0.0, st.wait_max / 1e3);
+}
+
+static int self_test(int window) {
+    hashd_thread t[NCLIENTS];
+    hashd_server *s;
+    hashd_client *c;
+    pthread_t    srv;
+    uint8_t      h[MARU2_HASH_LEN], ref[MARU2_HASH_LEN];
+    char         path[64], key[MARU2_MAX_STR + 8];
+    double       t0;
+    int          i, ok;
+
+    snprintf(path, sizeof(path), "/tmp/hashd.%d", (int)getpid());
+    s = hashd_open(path, window);
+    if (s == NULL) {
+      printf("can't listen on %s\n", path);
+      return 1;
+    }
+    pthread_create(&srv, NULL, hashd_serve, s);
+
+    // one request at a time, keys longer than MARU2_MAX_STR are cut
+    c = hashd_connect(path);
+    ok = c != NULL;
+    for (i=0; ok && i<=MARU2_MAX_STR + 4; i++) {
+      memset(key, 'a' + i % 26, i);
+      key[i] = 0;
+      ok &= hashd_hash(c, key, 0x0123456789ABCDEFULL, h) == 0;
+      maru2(key, 0x0123456789ABCDEFULL, ref);
+      ok &= memcmp(h, ref, MARU2_HASH_LEN) == 0;
+    }
+    if (c != NULL) hashd_disconnect(c);
+    printf("hashd_hash        : %s\n", ok ? "OK" : "FAIL");
+
+    t0 = hashd_now() / 1e9;
+    for (i=0; i<NCLIENTS; i++) {
+      t[i].path = path;
+      t[i].seed = i;
+      t[i].ok   = 0;
+      pthread_create(&t[i].id, NULL, hashd_worker, &t[i]);
+    }
+    for (i=0, ok=1; i<NCLIENTS; i++) {
+      pthread_join(t[i].id, NULL);
+      ok &= t[i].ok;
+    }
+    printf("%d clients         : %s\n", NCLIENTS, ok ? "OK" : "FAIL");
+    hashd_print(s, hashd_now() / 1e9 - t0);
+
+    slow_test(s, path);
+
+    hashd_stop(s);
+    pthread_join(srv, NULL);
+    hashd_close(s);
+    return 0;
+}
+
+static void usage(void) {
+    printf("usage: hashd [-w us]             self test\n");
+    printf("       hashd -s path [-w us]     serve on path\n");
+    printf("       hashd -c path [-i iv] key...\n");
+}
+
+int main(int argc, char *argv[]) {
+    hashd_server *s;
+    hashd_client *c;
+    const char   *serve = NULL, *client = NULL;
+    uint8_t      h[MARU2_HASH_LEN];
+    uint64_t     iv = 0;
+    double       t0;
+    int          i, window = HASHD_WINDOW;
+
+    for (i=1; i<argc && argv[i][0] == '-'; i++) {
+      if (i + 1 == argc) {
+        usage();
+        return 1;
+      }
+      switch (argv[i][1]) {
+        case 's': serve = argv[++i]; break;
+        case 'c': client = argv[++i]; break;
+        case 'w': window = atoi(argv[++i]); break;
+        case 'i': iv = strtoull(argv[++i], NULL, 16); break;
+        default:
+          usage();
+          return 1;
+      }
+    }
+    if (client != NULL) {
+      c = hashd_connect(client);
+      if (c == NULL) {
+        printf("can't connect to %s\n", client);
+        return 1;
+      }
+      for (; i<argc; i++) {
+        if (hashd_hash(c, argv[i], iv, h) < 0) break;
+        bin2hex(h, MARU2_HASH_LEN);
+        printf("  %s\n", argv[i]);
+      }
+      hashd_disconnect(c);
+      return i < argc;
+    }
+    if (serve == NULL) return self_test(window);
+
+    s = hashd_open(serve, window);
+    if (s == NULL) {
+      printf("can't listen on %s\n", serve);
+      return 1;
+    }
+    hashd_sig = s;
+    signal(SIGINT, hashd_on_signal);
+    signal(SIGTERM, hashd_on_signal);
+
+    t0 = hashd_now() / 1e9;
+    hashd_run(s);
+    hashd_print(s, hashd_now() / 1e9 - t0);
+    hashd_close(s);
+    return 0;
+}
+#endif
@@ -0,0 +1,80 @@
+/**
+  Copyright © 2017 Odzhan. All Rights Reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  3. The name of the author may not be used to endorse or promote products
+  derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY AUTHORS "AS IS" AND ANY EXPRESS OR
+  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+  STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE. */
+
+#ifndef HASHD_H
+#define HASHD_H
+
+#include "maru2.h"
+
+#define HASHD_BATCH     1024 // most requests hashed by one maru2_batch
+#define HASHD_MAX_CONN   256 // clients at a time
+#define HASHD_WINDOW      50 // default wait in microseconds
+
+// a request is this header and len bytes of key,
+// a reply is the id and MARU2_HASH_LEN bytes of hash
+typedef struct _hashd_req_hdr {
+  uint64_t iv;
+  uint32_t id;
+  uint32_t len;
+} hashd_req_hdr;
+
+#define HASHD_REPLY_LEN (4 + MARU2_HASH_LEN)
+
+typedef struct _hashd_stats {
+  uint64_t requests;  // replies sent
+  uint64_t batches;   // calls to maru2_batch
+  uint64_t clients;   // connections accepted
+  uint64_t wait_ns;   // time from request to reply, total
+  uint64_t wait_max;  // and longest
+} hashd_stats;
+
+typedef struct _hashd_server hashd_server;
+typedef struct _hashd_client hashd_client;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  hashd_server *hashd_open (const char*, int);
+  int hashd_run (hashd_server*);
+  void hashd_stop (hashd_server*);
+  void hashd_close (hashd_server*);
+  void hashd_counters (hashd_server*, hashd_stats*);
+
+  hashd_client *hashd_connect (const char*);
+  int hashd_send (hashd_client*, uint32_t, const char*, uint64_t);
+  int hashd_recv (hashd_client*, uint32_t*, void*);
+  int hashd_hash (hashd_client*, const char*, uint64_t, void*);
+  void hashd_disconnect (hashd_client*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
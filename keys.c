@@ -0,0 +1,80 @@
+/**
+  Copyright © 2017 Odzhan. All Rights Reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  3. The name of the author may not be used to endorse or promote products
+  derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY AUTHORS "AS IS" AND ANY EXPRESS OR
+  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+  STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE. */
+
+// Splits a file of keys into jobs for threads. Job j is the bytes from
+// j * chunk, and a key belongs to the job its first byte is in, so every
+// key is in exactly one job whatever the chunk size. Keys end with delim,
+// a CR before a newline is dropped, empty keys are skipped and longer
+// ones are cut to MARU2_MAX_STR bytes, which is all maru and maru2 read.
+
+#include <string.h>
+
+#include "keys.h"
+
+// start job j of data, chunk bytes each
+void maru_keys_job(maru_keys *k, const char *data, size_t len, size_t chunk,
+  uint64_t j, char delim)
+{
+    const char *e;
+
+    k->data  = data;
+    k->len   = len;
+    k->delim = delim;
+    k->p     = j * chunk;
+    k->hi    = (len - k->p < chunk) ? len : k->p + chunk;
+
+    // skip the end of a key from the last job
+    if (k->p != 0 && data[k->p-1] != delim) {
+      e = memchr(data + k->p, delim, len - k->p);
+      k->p = (e != NULL) ? (size_t)(e - data) + 1 : len;
+    }
+}
+
+// copy the next key to key with a NUL and its offset to off.
+// key holds MARU_KEY_LEN bytes. returns 0 at the end of the job.
+int maru_keys_next(maru_keys *k, char *key, uint64_t *off) {
+    const char *e;
+    size_t     end, n;
+
+    for (; k->p < k->hi; k->p = end + 1) {
+      e   = memchr(k->data + k->p, k->delim, k->len - k->p);
+      end = (e != NULL) ? (size_t)(e - k->data) : k->len;
+      n   = end - k->p;
+      if (k->delim == '\n' && n != 0 && k->data[end-1] == '\r') n--;
+      if (n == 0) continue;
+      if (n > MARU2_MAX_STR) n = MARU2_MAX_STR;
+
+      memcpy(key, k->data + k->p, n);
+      key[n] = 0;
+      *off   = k->p;
+      k->p   = end + 1;
+      return 1;
+    }
+    return 0;
+}
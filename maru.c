@@ -28,9 +28,18 @@
   POSSIBILITY OF SUCH DAMAGE. */
 
 #include "maru.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(MARU_DISPATCH) || defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
 
 // SPECK-64/128
-uint64_t speck(void *mk, uint64_t p) {
+static uint64_t speck(const void *mk, uint64_t p) {
     uint32_t k[4], i, t;
     union {
       uint32_t w[2];
@@ -40,8 +49,9 @@ uint64_t speck(void *mk, uint64_t p) {
     // copy plaintext to local buffer
     x.q = p;
     
-    // copy master key to local buffer
-    for(i=0;i<4;i++) k[i]=((uint32_t*)mk)[i];
+    // copy master key to local buffer, callers may pass
+    // unaligned message bytes as the key
+    memcpy(k, mk, 16);
     
     for(i=0;i<27;i++) {
       // encrypt plaintext
@@ -57,9 +67,75 @@ uint64_t speck(void *mk, uint64_t p) {
     return x.q;
 }
 
-uint64_t maru(const char *api, uint64_t iv) {
-    uint64_t h;
-    uint32_t len, idx, end, i;
+#ifdef _MSC_VER
+#include <intrin.h>
+static __inline int maru_ctz64(uint64_t x) {
+    unsigned long i;
+    _BitScanForward64(&i, x);
+    return (int)i;
+}
+typedef uint64_t maru_word;
+#else
+#define maru_ctz64(x) __builtin_ctzll(x)
+typedef uint64_t __attribute__((__may_alias__)) maru_word;
+#endif
+
+// length of api up to max. Reads aligned words, which never cross a page,
+// so it may read past the end of api but never faults.
+static size_t maru_strnlen(const char *api, size_t max) {
+    const maru_word *w = (const maru_word*)((uintptr_t)api & ~(uintptr_t)7);
+    size_t          off = (uintptr_t)api & 7, i, n;
+    uint64_t        v, z;
+
+    // bytes before api are not zero
+    v = w[0] | ((1ULL << (off * 8)) - 1);
+
+    for(i=0; ; v=w[++i]) {
+      // high bit set in each zero byte
+      z = (v - 0x0101010101010101ULL) & ~v & 0x8080808080808080ULL;
+      if(z != 0) {
+        n = i * 8 + maru_ctz64(z) / 8 - off;
+        return n < max ? n : max;
+      }
+      if(i * 8 + 8 - off >= max) return max;
+    }
+}
+
+// copy r < MARU_BLK_LEN bytes to M and zero the rest, without
+// reading past p + r
+static void maru_load(uint8_t *m, const uint8_t *p, size_t r) {
+#if defined(__AVX512BW__) && defined(__AVX512VL__)
+    _mm_storeu_si128((__m128i*)m,
+      _mm_maskz_loadu_epi8((__mmask16)((1U << r) - 1), p));
+#else
+    uint64_t w = 0;
+    uint32_t a, b;
+    size_t   i;
+
+    memset(m, 0, MARU_BLK_LEN);
+
+    // whole words
+    for(i=0; i+8<=r; i+=8) memcpy(m + i, p + i, 8);
+    m += i; p += i; r -= i;
+
+    // 0 to 7 bytes left, with loads that overlap
+    if(r >= 4) {
+      memcpy(&a, p, 4);
+      memcpy(&b, p + r - 4, 4);
+      w = a | ((uint64_t)b << ((r - 4) * 8));
+    } else if(r != 0) {
+      w = p[0] | ((uint64_t)p[r / 2] << (r / 2 * 8)) |
+          ((uint64_t)p[r - 1] << ((r - 1) * 8));
+    }
+    memcpy(m, &w, 8);
+#endif
+}
+
+// len is at most MARU_MAX_STR
+static uint64_t maru_hash(const void *data, size_t len, uint64_t iv) {
+    const uint8_t *p = (const uint8_t*)data;
+    uint64_t      h;
+    size_t        r;
     
     union {
       uint8_t  b[MARU_BLK_LEN];
@@ -69,37 +145,426 @@ uint64_t maru(const char *api, uint64_t iv) {
     // set H to initial value
     h = iv;
     
-    for(idx=0, len=0, end=0;!end;) {
-      // end of string or max len?
-      if(api[len] == 0 || len == MARU_MAX_STR) {
-        // zero remainder of M
-        for(i=idx;i<MARU_BLK_LEN;i++) m.b[i]=0;
-        // store the end bit
-        m.b[idx] = 0x80;
-        // have we space in M for api length?
-        if(idx >= MARU_BLK_LEN - 4) {
-          // no, update H with E
-          h ^= MARU_CRYPT(&m, h);
-          // zero M
-          for(i=0;i<MARU_BLK_LEN;i++) m.b[i]=0;
-        }
-        // store total length in bits
-        m.w[(MARU_BLK_LEN/4)-1] = (len * 8);
-        idx = MARU_BLK_LEN;
-        end++;
-      } else {    
-        // store character from api string
-        m.b[idx] = (uint8_t)api[len]; 
-        idx++; len++;
+    // update H with full blocks straight from input
+    for(r=len; r>=MARU_BLK_LEN; r-=MARU_BLK_LEN, p+=MARU_BLK_LEN) {
+      h ^= MARU_CRYPT(p, h);
+    }
+    // store last bytes and the end bit
+    maru_load(m.b, p, r);
+    m.b[r] = 0x80;
+    // have we space in M for length?
+    if(r >= MARU_BLK_LEN - 4) {
+      // no, update H with E
+      h ^= MARU_CRYPT(&m, h);
+      // zero M
+      memset(m.b, 0, MARU_BLK_LEN);
+    }
+    // store total length in bits
+    m.w[(MARU_BLK_LEN/4)-1] = (uint32_t)(len * 8);
+    h ^= MARU_CRYPT(&m, h);
+    return h;
+}
+
+uint64_t maru_n(const void *data, size_t len, uint64_t iv) {
+    uint64_t h;
+    MARU_STAT_BEGIN(t0);
+
+    if(len > MARU_MAX_STR) len = MARU_MAX_STR;
+    h = maru_hash(data, len, iv);
+    MARU_STAT_KEY(MARU_FN_N, len, 1, MARU_BLK_LEN);
+    MARU_STAT_END(MARU_FN_N, "scalar", 1, t0);
+    return h;
+}
+
+uint64_t maru(const char *api, uint64_t iv) {
+    return maru_n(api, maru_strnlen(api, MARU_MAX_STR), iv);
+}
+
+typedef void (*maru_xN)(uint32_t[2][MARU_LANES], uint32_t[4][MARU_LANES], uint32_t);
+
+// a kernel hashes lanes strings at a time, scalar has no crypt
+typedef struct _maru_kern {
+  const char *name;
+  int        lanes;
+  maru_xN    crypt;
+} maru_kern;
+
+#if MARU_LANES > 1
+
+#ifdef MARU_DISPATCH
+#define MARU_TARGET(x) __attribute__((target(x)))
+#else
+#define MARU_TARGET(x)
+#endif
+
+typedef union { uint32_t w[MARU_BLK_LEN/4]; uint8_t b[MARU_BLK_LEN]; } maru_blk;
+
+// split api string into padded blocks, return number of blocks
+static int maru_pad(const char *api, maru_blk *m) {
+    int len, idx, nb;
+
+    memset(m, 0, sizeof(maru_blk) * MARU_MAX_BLK);
+
+    len = (int)maru_strnlen(api, MARU_MAX_STR);
+    nb  = len / MARU_BLK_LEN;
+    idx = len % MARU_BLK_LEN;
+
+    // store full blocks, then last bytes
+    memcpy(m, api, nb * MARU_BLK_LEN);
+    maru_load(m[nb].b, (const uint8_t*)api + nb * MARU_BLK_LEN, idx);
+    // store the end bit
+    m[nb].b[idx] = 0x80;
+    // have we space in M for api length? if not, use another block
+    if(idx >= MARU_BLK_LEN - 4) nb++;
+    // store total length in bits
+    m[nb].w[(MARU_BLK_LEN/4)-1] = (len * 8);
+    return nb + 1;
+}
+
+#if defined(MARU_DISPATCH) || MARU_LANES == 16
+
+// SPECK-64/128 in 16 lanes, H ^= E(M, H) for each active lane
+MARU_TARGET("avx512f")
+static void speck_x16(uint32_t h[2][MARU_LANES], uint32_t m[4][MARU_LANES], uint32_t act) {
+    __m512i  x0, x1, h0, h1, k0, k1, k2, k3, t;
+    uint32_t i;
+
+    // load 64-bit plaintext and 128-bit key of each lane
+    h0 = x0 = _mm512_loadu_si512(h[0]);
+    h1 = x1 = _mm512_loadu_si512(h[1]);
+    k0 = _mm512_loadu_si512(m[0]); k1 = _mm512_loadu_si512(m[1]);
+    k2 = _mm512_loadu_si512(m[2]); k3 = _mm512_loadu_si512(m[3]);
+
+    for(i=0;i<27;i++) {
+      // encrypt plaintext
+      x0 = _mm512_xor_si512(_mm512_add_epi32(_mm512_ror_epi32(x0, 8), x1), k0);
+      x1 = _mm512_xor_si512(_mm512_ror_epi32(x1, 29), x0); t = k3;
+
+      // create next subkey
+      k3 = _mm512_xor_si512(_mm512_add_epi32(_mm512_ror_epi32(k1, 8), k0),
+             _mm512_set1_epi32(i));
+      k0 = _mm512_xor_si512(_mm512_ror_epi32(k0, 29), k3);
+      k1 = k2, k2 = t;
+    }
+    // update H of active lanes only
+    _mm512_storeu_si512(h[0], _mm512_mask_xor_epi32(h0, (__mmask16)act, h0, x0));
+    _mm512_storeu_si512(h[1], _mm512_mask_xor_epi32(h1, (__mmask16)act, h1, x1));
+}
+
+#endif
+
+#if defined(MARU_DISPATCH) || MARU_LANES == 8
+
+#define ROTR32_8(v)  _mm256_shuffle_epi8(v, _mm256_setr_epi8( \
+    1, 2, 3, 0, 5, 6, 7, 4, 9,10,11, 8,13,14,15,12,         \
+    1, 2, 3, 0, 5, 6, 7, 4, 9,10,11, 8,13,14,15,12))
+#define ROTR32_29(v) _mm256_or_si256(_mm256_slli_epi32(v, 3), _mm256_srli_epi32(v, 29))
+
+// SPECK-64/128 in 8 lanes, H ^= E(M, H) for each active lane
+MARU_TARGET("avx2")
+static void speck_x8(uint32_t h[2][MARU_LANES], uint32_t m[4][MARU_LANES], uint32_t act) {
+    __m256i  x0, x1, h0, h1, k0, k1, k2, k3, t, msk;
+    uint32_t i;
+
+    // load 64-bit plaintext and 128-bit key of each lane
+    h0 = x0 = _mm256_loadu_si256((__m256i*)h[0]);
+    h1 = x1 = _mm256_loadu_si256((__m256i*)h[1]);
+    k0 = _mm256_loadu_si256((__m256i*)m[0]); k1 = _mm256_loadu_si256((__m256i*)m[1]);
+    k2 = _mm256_loadu_si256((__m256i*)m[2]); k3 = _mm256_loadu_si256((__m256i*)m[3]);
+
+    for(i=0;i<27;i++) {
+      // encrypt plaintext
+      x0 = _mm256_xor_si256(_mm256_add_epi32(ROTR32_8(x0), x1), k0);
+      x1 = _mm256_xor_si256(ROTR32_29(x1), x0); t = k3;
+
+      // create next subkey
+      k3 = _mm256_xor_si256(_mm256_add_epi32(ROTR32_8(k1), k0),
+             _mm256_set1_epi32(i));
+      k0 = _mm256_xor_si256(ROTR32_29(k0), k3);
+      k1 = k2, k2 = t;
+    }
+    // update H of active lanes only
+    msk = _mm256_cmpeq_epi32(
+            _mm256_and_si256(_mm256_set1_epi32(act), _mm256_setr_epi32(1,2,4,8,16,32,64,128)),
+            _mm256_setr_epi32(1,2,4,8,16,32,64,128));
+    _mm256_storeu_si256((__m256i*)h[0], _mm256_xor_si256(h0, _mm256_and_si256(x0, msk)));
+    _mm256_storeu_si256((__m256i*)h[1], _mm256_xor_si256(h1, _mm256_and_si256(x1, msk)));
+}
+
+#endif
+
+#ifdef MARU_DISPATCH
+
+#define ROTR32_8_X4(v)  _mm_shuffle_epi8(v, _mm_setr_epi8( \
+    1, 2, 3, 0, 5, 6, 7, 4, 9,10,11, 8,13,14,15,12))
+#define ROTR32_29_X4(v) _mm_or_si128(_mm_slli_epi32(v, 3), _mm_srli_epi32(v, 29))
+
+// SPECK-64/128 in 4 lanes, H ^= E(M, H) for each active lane
+MARU_TARGET("sse4.1")
+static void speck_x4(uint32_t h[2][MARU_LANES], uint32_t m[4][MARU_LANES], uint32_t act) {
+    __m128i  x0, x1, h0, h1, k0, k1, k2, k3, t, msk;
+    uint32_t i;
+
+    // load 64-bit plaintext and 128-bit key of each lane
+    h0 = x0 = _mm_loadu_si128((__m128i*)h[0]);
+    h1 = x1 = _mm_loadu_si128((__m128i*)h[1]);
+    k0 = _mm_loadu_si128((__m128i*)m[0]); k1 = _mm_loadu_si128((__m128i*)m[1]);
+    k2 = _mm_loadu_si128((__m128i*)m[2]); k3 = _mm_loadu_si128((__m128i*)m[3]);
+
+    for(i=0;i<27;i++) {
+      // encrypt plaintext
+      x0 = _mm_xor_si128(_mm_add_epi32(ROTR32_8_X4(x0), x1), k0);
+      x1 = _mm_xor_si128(ROTR32_29_X4(x1), x0); t = k3;
+
+      // create next subkey
+      k3 = _mm_xor_si128(_mm_add_epi32(ROTR32_8_X4(k1), k0), _mm_set1_epi32(i));
+      k0 = _mm_xor_si128(ROTR32_29_X4(k0), k3);
+      k1 = k2, k2 = t;
+    }
+    // update H of active lanes only
+    msk = _mm_cmpeq_epi32(
+            _mm_and_si128(_mm_set1_epi32(act), _mm_setr_epi32(1,2,4,8)),
+            _mm_setr_epi32(1,2,4,8));
+    _mm_storeu_si128((__m128i*)h[0], _mm_xor_si128(h0, _mm_and_si128(x0, msk)));
+    _mm_storeu_si128((__m128i*)h[1], _mm_xor_si128(h1, _mm_and_si128(x1, msk)));
+}
+
+#endif
+
+static void maru_batch_xN(const char **api, size_t n, uint64_t iv, uint64_t *out,
+  int lanes, maru_xN crypt, int count)
+{
+    maru_blk m[MARU_LANES][MARU_MAX_BLK];
+    uint32_t h[2][MARU_LANES], k[4][MARU_LANES], act;
+    int      nb[MARU_LANES], cnt, max, l, j, w;
+    size_t   i;
+
+    for(i=0; i<n; i+=cnt) {
+      cnt = (n - i) < (size_t)lanes ? (int)(n - i) : lanes;
+
+      // pad string of each lane and set H to initial value
+      for(l=0, max=0; l<lanes; l++) {
+        nb[l] = (l < cnt) ? maru_pad(api[i+l], m[l]) : 0;
+        if(nb[l] > max) max = nb[l];
+        h[0][l] = (uint32_t)iv;
+        h[1][l] = (uint32_t)(iv >> 32);
       }
-      if(idx == MARU_BLK_LEN) {
+      for(j=0; j<max; j++) {
+        // transpose block j of each lane, lanes without it are inactive
+        for(l=0, act=0; l<lanes; l++) {
+          if(j < nb[l]) {
+            for(w=0; w<4; w++) k[w][l] = m[l][j].w[w];
+            act |= 1 << l;
+          } else {
+            for(w=0; w<4; w++) k[w][l] = 0;
+          }
+        }
         // update H with E
-        h ^= MARU_CRYPT(&m, h);
-        // reset idx
-        idx = 0;
+        crypt(h, k, act);
       }
-    }  
-    return h;
+      for(l=0; l<cnt; l++) {
+        out[i+l] = ((uint64_t)h[1][l] << 32) | h[0][l];
+        // length in bits is the last word of the padding
+        if(count) MARU_STAT_KEY(MARU_FN_BATCH, m[l][nb[l]-1].w[3] / 8, 1, MARU_BLK_LEN);
+      }
+    }
+}
+
+#endif
+
+// slowest first, the last one the cpu supports is the default
+static const maru_kern maru_kern_tbl[] = {
+  { "scalar",  1, NULL      },
+#ifdef MARU_DISPATCH
+  { "sse4",    4, speck_x4  },
+  { "avx2",    8, speck_x8  },
+  { "avx512", 16, speck_x16 },
+#elif MARU_LANES == 16
+  { "avx512", 16, speck_x16 },
+#elif MARU_LANES == 8
+  { "avx2",    8, speck_x8  },
+#endif
+};
+
+#define MARU_NKERN (sizeof(maru_kern_tbl) / sizeof(maru_kern))
+
+static const maru_kern *maru_kern_cur;
+
+// kernels built without MARU_DISPATCH are enabled by compiler flags
+static int maru_kern_ok(const maru_kern *k) {
+#ifdef MARU_DISPATCH
+    __builtin_cpu_init();
+    switch(k->lanes) {
+      case 16: return __builtin_cpu_supports("avx512f");
+      case 8:  return __builtin_cpu_supports("avx2");
+      case 4:  return __builtin_cpu_supports("sse4.1");
+    }
+#endif
+    (void)k;
+    return 1;
+}
+
+// count is 0 for the self-test, which must not show in the statistics
+static void maru_kern_run(const maru_kern *k, const char **api, size_t n,
+  uint64_t iv, uint64_t *out, int count)
+{
+    size_t i, len;
+
+#if MARU_LANES > 1
+    if(k->crypt != NULL) {
+      maru_batch_xN(api, n, iv, out, k->lanes, k->crypt, count);
+      return;
+    }
+#endif
+    for(i=0; i<n; i++) {
+      len = maru_strnlen(api[i], MARU_MAX_STR);
+      if(count) MARU_STAT_KEY(MARU_FN_BATCH, len, 1, MARU_BLK_LEN);
+      out[i] = maru_hash(api[i], len, iv);
+    }
+}
+
+#ifndef NDEBUG
+// compare each kernel with speck() on every length up to MARU_MAX_STR
+static void maru_kern_test(const maru_kern *k) {
+    char       key[MARU_MAX_STR+2][MARU_MAX_STR+2];
+    const char *api[MARU_MAX_STR+2];
+    uint64_t   out[MARU_MAX_STR+2];
+    int        i, j;
+
+    for(i=0; i<MARU_MAX_STR+2; i++) {
+      for(j=0; j<i; j++) key[i][j] = (char)('a' + (i * 7 + j) % 26);
+      key[i][i] = 0;
+      api[i] = key[i];
+    }
+    maru_kern_run(k, api, MARU_MAX_STR+2, 0x0123456789ABCDEFULL, out, 0);
+
+    for(i=0; i<MARU_MAX_STR+2; i++) {
+      if(out[i] != maru_hash(key[i], i < MARU_MAX_STR ? i : MARU_MAX_STR, 0x0123456789ABCDEFULL)) {
+        fprintf(stderr, "maru: %s kernel fails self-test\n", k->name);
+        abort();
+      }
+    }
+}
+#endif
+
+// pick the fastest kernel once, MARU_KERNEL in the environment
+// can force another for testing. racing threads store the same one.
+static const maru_kern *maru_kern_get(void) {
+    const maru_kern *k, *sel = NULL, *best = NULL;
+    const char      *env;
+    size_t          i;
+
+#ifdef __GNUC__
+    k = __atomic_load_n(&maru_kern_cur, __ATOMIC_ACQUIRE);
+#else
+    k = maru_kern_cur;
+#endif
+    if(k != NULL) return k;
+
+    env = getenv("MARU_KERNEL");
+
+    for(i=0; i<MARU_NKERN; i++) {
+      k = &maru_kern_tbl[i];
+      if(!maru_kern_ok(k)) continue;
+#ifndef NDEBUG
+      maru_kern_test(k);
+#endif
+      best = k;
+      if(env != NULL && strcmp(env, k->name) == 0) sel = k;
+    }
+    // unknown or unsupported names get the default
+    if(sel == NULL) sel = best;
+#ifdef __GNUC__
+    __atomic_store_n(&maru_kern_cur, sel, __ATOMIC_RELEASE);
+#else
+    maru_kern_cur = sel;
+#endif
+    return sel;
+}
+
+const char *maru_kernel(int *lanes) {
+    const maru_kern *k = maru_kern_get();
+
+    if(lanes != NULL) *lanes = k->lanes;
+    return k->name;
+}
+
+void maru_batch(const char **api, size_t n, uint64_t iv, uint64_t *out) {
+    const maru_kern *k = maru_kern_get();
+    MARU_STAT_BEGIN(t0);
+
+    maru_kern_run(k, api, n, iv, out, 1);
+    MARU_STAT_END(MARU_FN_BATCH, k->name, n, t0);
+}
+
+void maru_init(maru_ctx *ctx, uint64_t iv) {
+    // set H to initial value
+    ctx->h   = iv;
+    ctx->len = 0;
+    ctx->idx = 0;
+    ctx->max = 0;
+}
+
+// same output as maru() for any input: bytes past MARU_MAX_STR are ignored
+void maru_init_compat(maru_ctx *ctx, uint64_t iv) {
+    maru_init(ctx, iv);
+    ctx->max = MARU_MAX_STR;
+}
+
+void maru_update(maru_ctx *ctx, const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t*)data;
+    size_t        r, i;
+
+    // truncate input in compatible mode
+    if(ctx->max != 0) {
+      r = (ctx->len < ctx->max) ? (size_t)(ctx->max - ctx->len) : 0;
+      if(len > r) len = r;
+    }
+    ctx->len += len;
+
+    // fill M if it holds a partial block
+    if(ctx->idx != 0) {
+      r = MARU_BLK_LEN - ctx->idx;
+      if(r > len) r = len;
+      for(i=0;i<r;i++) ctx->m.b[ctx->idx+i] = p[i];
+      ctx->idx += (uint32_t)r; p += r; len -= r;
+
+      if(ctx->idx < MARU_BLK_LEN) return;
+      // update H with E
+      ctx->h ^= MARU_CRYPT(&ctx->m, ctx->h);
+      ctx->idx = 0;
+    }
+    // update H with full blocks straight from input,
+    // the cipher copies its key so p needs no alignment
+    for(; len >= MARU_BLK_LEN; p += MARU_BLK_LEN, len -= MARU_BLK_LEN)
+      ctx->h ^= MARU_CRYPT(p, ctx->h);
+
+    // keep the rest for later
+    for(i=0;i<len;i++) ctx->m.b[i] = p[i];
+    ctx->idx = (uint32_t)len;
+}
+
+uint64_t maru_final(maru_ctx *ctx) {
+    uint32_t i;
+
+    // zero remainder of M
+    for(i=ctx->idx;i<MARU_BLK_LEN;i++) ctx->m.b[i]=0;
+    // store the end bit
+    ctx->m.b[ctx->idx] = 0x80;
+    // have we space in M for length?
+    if(ctx->idx >= MARU_BLK_LEN - 4) {
+      // no, update H with E
+      ctx->h ^= MARU_CRYPT(&ctx->m, ctx->h);
+      // zero M
+      for(i=0;i<MARU_BLK_LEN;i++) ctx->m.b[i]=0;
+    }
+    // store total length in bits
+    ctx->m.w[(MARU_BLK_LEN/4)-1] = (uint32_t)(ctx->len * 8);
+    ctx->h ^= MARU_CRYPT(&ctx->m, ctx->h);
+    // streams are counted, not timed
+    MARU_STAT_KEY(MARU_FN_STREAM, ctx->len, 1, MARU_BLK_LEN);
+    MARU_STAT_END(MARU_FN_STREAM, "scalar", 1, 0);
+    return ctx->h;
 }
 
 #ifdef TEST
@@ -194,17 +659,19 @@ void inc_buf(void *buf, int mlen) {
 void diehard(uint32_t iv) {
     uint8_t  key[MARU_MAX_STR+1];
     int      i;
-    uint64_t h;
+    uint64_t h[4096];
     
     memset(key, 1, sizeof(key));
 
-    for (i=0; ; i++) {
-      // increment string buffer
-      inc_buf(key, MARU_MAX_STR);
-      // generate hash
-      h = maru((const char*)key, iv);
+    for (;;) {
+      for (i=0; i<4096; i++) {
+        // increment string buffer
+        inc_buf(key, MARU_MAX_STR);
+        // generate hash
+        h[i] = maru((const char*)key, iv);
+      }
       // write to stdout
-      fwrite(&h, sizeof(h), 1, stdout);
+      fwrite(h, sizeof(h), 1, stdout);
     }
 }
 
@@ -242,9 +709,12 @@ char* getparam (int argc, char *argv[], int *i)
 int main(int argc, char *argv[])
 {
     uint64_t   h=0, x;
-    int        i, j;
+    uint64_t   batch[sizeof(api_tbl)/sizeof(char*)];
+    int        i, j, equ, lanes;
+    maru_ctx   ctx;
+    const char *name;
     const char **p=api_hash;
-    char       key[MARU_MAX_STR+1];
+    char       key[MARU_MAX_STR+1], big[MARU_MAX_STR*4];
     char       opt;
     char       *s;
     uint32_t   iv=0;
@@ -296,6 +766,55 @@ int main(int argc, char *argv[])
             (h==x) ? "OK" : "FAIL");
         }
       }
+      // hash each table of strings with one call
+      p=api_hash;
+      putchar('\n');
+      for (i=0; i<sizeof(iv_tbl)/sizeof(uint32_t); i++) {
+        maru_batch(api_tbl, sizeof(api_tbl)/sizeof(char*), iv_tbl[i], batch);
+        for (j=0, equ=1; j<sizeof(api_tbl)/sizeof(char*); j++) {
+          hex2bin((void*)&h, *p++);
+          equ &= SWAP64(h)==batch[j];
+        }
+        name = maru_kernel(&lanes);
+        printf ("  maru_batch(api_tbl, 0x%08x) using %s, %d lane(s) : %s\n",
+          iv_tbl[i], name, lanes, equ ? "OK" : "FAIL");
+      }
+      // absorb each string one byte at a time
+      p=api_hash;
+      putchar('\n');
+      for (i=0; i<sizeof(iv_tbl)/sizeof(uint32_t); i++) {
+        for (j=0, equ=1; j<sizeof(api_tbl)/sizeof(char*); j++) {
+          hex2bin((void*)&h, *p++);
+          maru_init(&ctx, iv_tbl[i]);
+          for (s=(char*)api_tbl[j]; *s!=0; s++)
+            maru_update(&ctx, s, 1);
+          equ &= SWAP64(h)==maru_final(&ctx);
+        }
+        printf ("  maru_update(api_tbl, 0x%08x) : %s\n",
+          iv_tbl[i], equ ? "OK" : "FAIL");
+      }
+      // compatible mode ignores bytes past MARU_MAX_STR
+      memset(big, 'A', sizeof(big)-1);
+      big[sizeof(big)-1] = 0;
+      maru_init_compat(&ctx, iv_tbl[0]);
+      maru_update(&ctx, big, 3);
+      maru_update(&ctx, big+3, sizeof(big)-4);
+      printf ("  maru_init_compat(%d+ bytes) : %s\n", MARU_MAX_STR,
+        maru(big, iv_tbl[0])==maru_final(&ctx) ? "OK" : "FAIL");
+      // every length and alignment against the byte at a time path
+      for (i=0, equ=1; i<MARU_MAX_STR+8; i++) {
+        for (j=0; j<8; j++) {
+          memset(big, 0, sizeof(big));
+          for (x=0; x<(uint64_t)i; x++) big[j+x] = (char)('a' + (x*7 + i) % 26);
+          maru_init_compat(&ctx, iv_tbl[1]);
+          maru_update(&ctx, big+j, i);
+          h = maru_final(&ctx);
+          equ &= h==maru_n(big+j, i, iv_tbl[1]);
+          equ &= h==maru(big+j, iv_tbl[1]);
+        }
+      }
+      printf ("  maru_n(0 to %d bytes, 8 alignments) : %s\n", MARU_MAX_STR+7,
+        equ ? "OK" : "FAIL");
     }
     return 0;
 }
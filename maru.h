@@ -30,6 +30,7 @@
 #ifndef MARU_H
 #define MARU_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define MARU_MAX_STR  64
@@ -38,6 +39,25 @@
 #define MARU_IV_LEN    MARU_HASH_LEN
 #define MARU_CRYPT     speck
 
+// maximum number of blocks for a string, including padding
+#define MARU_MAX_BLK  ((MARU_MAX_STR/MARU_BLK_LEN)+2)
+
+// maru_batch picks a kernel at run time on x86 with gcc or clang.
+// other compilers use the one enabled by compiler flags.
+#if !defined(MARU_NO_DISPATCH) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define MARU_DISPATCH
+#endif
+
+// most strings hashed in parallel by maru_batch
+#if defined(MARU_DISPATCH) || defined(__AVX512F__)
+#define MARU_LANES    16
+#elif defined(__AVX2__)
+#define MARU_LANES     8
+#else
+#define MARU_LANES     1
+#endif
+
 #ifndef ROTR32
 #define ROTR32(v,n)(((v)>>(n))|((v)<<(32-(n))))
 #endif
@@ -53,11 +73,28 @@
 #define MARU_INIT_B SWAP64(0x316B7D586E478442ULL) // hex(trunc(frac(cbrt(1/139))*(2^64)))
 #define MARU_INIT_D SWAP64(0x80FE410FFD2528DAULL) // hex(or(shr(hex(trunc(cos(1/137)*(2^64)));8);shl(0x80;56)))
 
+// streaming context
+typedef struct _maru_ctx {
+  uint64_t h;
+  union { uint8_t b[MARU_BLK_LEN]; uint32_t w[MARU_BLK_LEN/4]; } m;
+  uint64_t len;  // total bytes absorbed
+  uint32_t idx;  // bytes in M
+  uint32_t max;  // 0 for no limit, else MARU_MAX_STR
+} maru_ctx;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 uint64_t maru(const char *api, uint64_t iv);
+uint64_t maru_n(const void *data, size_t len, uint64_t iv);
+void maru_batch(const char **api, size_t n, uint64_t iv, uint64_t *out);
+const char *maru_kernel(int *lanes);
+
+void maru_init(maru_ctx *ctx, uint64_t iv);
+void maru_init_compat(maru_ctx *ctx, uint64_t iv);
+void maru_update(maru_ctx *ctx, const void *data, size_t len);
+uint64_t maru_final(maru_ctx *ctx);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,340 @@
+/**
+  Copyright © 2017 Odzhan. All Rights Reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  3. The name of the author may not be used to endorse or promote products
+  derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY AUTHORS "AS IS" AND ANY EXPRESS OR
+  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+  STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE. */
+
+#ifndef MARU_HPP
+#define MARU_HPP
+
+// Compile-time maru and maru2 for C++17 and later.
+//
+//   constexpr auto h = maru_ct("CreateProcessA", iv);
+//   constexpr auto x = maru2_ct("CreateProcessA", iv);
+//
+// Results match the C functions on a little-endian host, including
+// the Chaskey variant of maru2 when CHASKEY is defined.
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+
+#include "maru.h"
+#include "maru2.h"
+
+#if defined(__cpp_consteval)
+#define MARU_CONSTEVAL consteval
+#else
+#define MARU_CONSTEVAL constexpr
+#endif
+
+// seed used by the _maru and _maru2 literals
+#ifndef MARU_CT_IV
+#define MARU_CT_IV 0
+#endif
+
+namespace maru_detail {
+
+constexpr uint32_t rotr32(uint32_t v, int n) { return (v >> n) | (v << (32 - n)); }
+constexpr uint64_t rotr64(uint64_t v, int n) { return (v >> n) | (v << (64 - n)); }
+
+constexpr uint64_t swap64(uint64_t x) {
+    uint64_t r = 0;
+    for (int i=0; i<8; i++) r = (r << 8) | ((x >> (i * 8)) & 0xFF);
+    return r;
+}
+
+// little-endian word of n bytes at p, past the end of s reads zero
+constexpr uint64_t load(std::string_view s, std::size_t p, int n) {
+    uint64_t w = 0;
+    for (int i=n-1; i>=0; i--)
+      w = (w << 8) | (p + i < s.size() ? (uint8_t)s[p + i] : 0);
+    return w;
+}
+
+// SPECK-64/128
+constexpr uint64_t speck64(const uint32_t *mk, uint64_t p) {
+    uint32_t k[4] = { mk[0], mk[1], mk[2], mk[3] };
+    uint32_t x0 = (uint32_t)p, x1 = (uint32_t)(p >> 32), t = 0;
+
+    for (uint32_t i=0; i<27; i++) {
+      x0 = (rotr32(x0, 8) + x1) ^ k[0];
+      x1 =  rotr32(x1,29) ^ x0; t = k[3];
+
+      k[3] = (rotr32(k[1], 8) + k[0]) ^ i;
+      k[0] =  rotr32(k[0],29) ^ k[3];
+      k[1] = k[2]; k[2] = t;
+    }
+    return ((uint64_t)x1 << 32) | x0;
+}
+
+// SPECK-128/256, H ^= E(M, H)
+constexpr void speck128(uint64_t *h, const uint64_t *mk) {
+    uint64_t k[4] = { mk[0], mk[1], mk[2], mk[3] };
+    uint64_t r0 = h[0], r1 = h[1], t = 0;
+
+    for (uint64_t i=0; i<34; i++) {
+      r1 = (rotr64(r1, 8) + r0) ^ k[0];
+      r0 =  rotr64(r0,61) ^ r1; t = k[3];
+
+      k[3] = (rotr64(k[1], 8) + k[0]) ^ i;
+      k[0] =  rotr64(k[0],61) ^ k[3];
+      k[1] = k[2]; k[2] = t;
+    }
+    h[0] ^= r0; h[1] ^= r1;
+}
+
+// Chaskey permutation keyed with M, H ^= E(M, H)
+constexpr void chaskey(uint64_t *h, const uint64_t *mk) {
+    uint64_t r0 = h[0] ^ mk[0], r1 = h[1] ^ mk[1];
+    uint32_t x[4] = { (uint32_t)r0, (uint32_t)(r0 >> 32),
+                      (uint32_t)r1, (uint32_t)(r1 >> 32) };
+
+    for (int i=0; i<12; i++) {
+      x[0] += x[1];
+      x[1]  = rotr32(x[1], 27) ^ x[0];
+      x[2] += x[3];
+      x[3]  = rotr32(x[3], 24) ^ x[2];
+      x[2] += x[1];
+      x[0]  = rotr32(x[0], 16) + x[3];
+      x[3]  = rotr32(x[3], 19) ^ x[0];
+      x[1]  = rotr32(x[1], 25) ^ x[2];
+      x[2]  = rotr32(x[2], 16);
+    }
+    r0 = ((uint64_t)x[1] << 32 | x[0]) ^ mk[0];
+    r1 = ((uint64_t)x[3] << 32 | x[2]) ^ mk[1];
+    h[0] ^= r0; h[1] ^= r1;
+}
+
+constexpr void crypt2(uint64_t *h, const uint64_t *m) {
+#ifndef CHASKEY
+    speck128(h, m);
+#else
+    chaskey(h, m);
+#endif
+}
+
+// mixer for pilots, same as seed.c
+constexpr uint64_t mix(uint64_t x) {
+    x ^= x >> 30; x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27; x *= 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+}
+
+// 128-bit maru2 hash, b(i) is byte i of the C output
+struct maru2_hash {
+  uint64_t q[2];
+
+  constexpr uint8_t b(std::size_t i) const {
+    return (uint8_t)(q[i / 8] >> (i % 8 * 8));
+  }
+  constexpr bool operator==(const maru2_hash &x) const {
+    return q[0] == x.q[0] && q[1] == x.q[1];
+  }
+  constexpr bool operator!=(const maru2_hash &x) const { return !(*this == x); }
+};
+
+// same as maru_n(s.data(), s.size(), iv)
+constexpr uint64_t maru_ct(std::string_view s, uint64_t iv) {
+    uint32_t    m[MARU_BLK_LEN/4] = {};
+    uint64_t    h = iv;
+    std::size_t len = s.size() < MARU_MAX_STR ? s.size() : MARU_MAX_STR;
+    std::size_t p = 0, i = 0;
+
+    s = s.substr(0, len);
+
+    // full blocks, then last bytes, end bit and length
+    for (;; p+=MARU_BLK_LEN) {
+      for (i=0; i<MARU_BLK_LEN/4; i++)
+        m[i] = (uint32_t)maru_detail::load(s, p + i * 4, 4);
+      if (len - p < MARU_BLK_LEN) break;
+      h ^= maru_detail::speck64(m, h);
+    }
+    i = len - p;
+    m[i / 4] |= 0x80u << (i % 4 * 8);
+    // have we space in M for length?
+    if (i >= MARU_BLK_LEN - 4) {
+      h ^= maru_detail::speck64(m, h);
+      for (i=0; i<MARU_BLK_LEN/4; i++) m[i] = 0;
+    }
+    m[(MARU_BLK_LEN/4)-1] = (uint32_t)(len * 8);
+    return h ^ maru_detail::speck64(m, h);
+}
+
+// same as maru2_n(s.data(), s.size(), iv, out)
+constexpr maru2_hash maru2_ct(std::string_view s, uint64_t iv) {
+    uint64_t    m[4] = {};
+    uint64_t    h[2] = { maru_detail::swap64(0x316B7D586E478442ULL) ^ iv,
+                         maru_detail::swap64(0x80FE410FFD2528DAULL) ^ iv };
+    std::size_t len = s.size() < MARU2_MAX_STR ? s.size() : MARU2_MAX_STR;
+    std::size_t p = 0, i = 0;
+
+    s = s.substr(0, len);
+
+    for (;; p+=MARU2_BLK_LEN) {
+      for (i=0; i<MARU2_BLK_LEN/8; i++)
+        m[i] = maru_detail::load(s, p + i * 8, 8);
+      if (len - p < MARU2_BLK_LEN) break;
+      maru_detail::crypt2(h, m);
+    }
+    i = len - p;
+    m[i / 8] |= (uint64_t)0x80 << (i % 8 * 8);
+    // have we space in M for length?
+    if (i >= MARU2_BLK_LEN - 4) {
+      maru_detail::crypt2(h, m);
+      for (i=0; i<4; i++) m[i] = 0;
+    }
+    m[(MARU2_BLK_LEN/8)-1] |= (uint64_t)(uint32_t)(len * 8) << 32;
+    maru_detail::crypt2(h, m);
+    return maru2_hash{ { h[0], h[1] } };
+}
+
+MARU_CONSTEVAL uint64_t operator""_maru(const char *s, std::size_t n) {
+    return maru_ct(std::string_view(s, n), MARU_CT_IV);
+}
+
+MARU_CONSTEVAL maru2_hash operator""_maru2(const char *s, std::size_t n) {
+    return maru2_ct(std::string_view(s, n), MARU_CT_IV);
+}
+
+// Minimal perfect table for N names, built at compile time. find()
+// returns the position of a hash in the name list, or N, so a switch
+// on it has dense case labels and compiles to a jump table:
+//
+//   constexpr const char *api[] = { "LoadLibraryA", "GetProcAddress" };
+//   constexpr auto tbl = maru_switch_ct(api, iv);
+//
+//   switch (tbl.find(h)) {
+//     case tbl["LoadLibraryA"]: ...
+//     case tbl["GetProcAddress"]: ...
+//   }
+//
+// For maru2 the key is the first 8 bytes of the hash. Tables with
+// hundreds of names may need a higher -fconstexpr-steps on clang.
+template <std::size_t N>
+class maru_switch {
+  static_assert(N > 0, "empty table");
+
+  // keys per pilot bucket, as in seed.c
+  static constexpr std::size_t R = (N + 2) / 3;
+
+  uint64_t iv_ = 0;
+  bool     v2_ = false;
+  uint64_t key_[N] = {};  // hash in each slot
+  uint32_t idx_[N] = {};  // name position in each slot
+  uint64_t pilot_[R] = {};
+
+  static constexpr std::size_t bucket(uint64_t h) {
+    return (std::size_t)((uint32_t)(h >> 32) % R);
+  }
+  // multiply first, so every bit of the pilot reaches the slot
+  static constexpr std::size_t slot(uint64_t h, uint64_t x) {
+    return (std::size_t)((((h ^ x) * 0x9E3779B97F4A7C15ULL) >> 32) * N >> 32);
+  }
+public:
+  constexpr maru_switch(const char *const (&names)[N], uint64_t iv, bool v2)
+    : iv_(iv), v2_(v2)
+  {
+    uint64_t    h[N] = {};
+    std::size_t cnt[R] = {}, pos[N] = {};
+    bool        used[N] = {}, done[R] = {};
+    std::size_t i = 0, j = 0, k = 0, b = 0, n = 0, sz = 0;
+    uint64_t    p = 0, x = 0;
+
+    for (i=0; i<N; i++) {
+      h[i] = hash(names[i]);
+      for (j=0; j<i; j++)
+        if (h[j] == h[i]) throw std::invalid_argument("two names with the same hash");
+      cnt[bucket(h[i])]++;
+    }
+    // largest buckets first
+    for (n=0; n<R; n++) {
+      for (b=R, i=0; i<R; i++)
+        if (!done[i] && (b == R || cnt[i] > cnt[b])) b = i;
+      done[b] = true;
+      sz = cnt[b];
+      if (sz == 0) break;
+
+      for (p=0; p<(1 << 20); p++) {
+        x = maru_detail::mix(p);
+        for (k=0, i=0; i<N && k<sz; i++) {
+          if (bucket(h[i]) != b) continue;
+          pos[k] = slot(h[i], x);
+          if (used[pos[k]]) break;
+          for (j=0; j<k && pos[j]!=pos[k]; j++);
+          if (j != k) break;
+          k++;
+        }
+        if (k == sz) break;
+      }
+      if (p == (1 << 20)) throw std::runtime_error("no pilot found");
+
+      pilot_[b] = x;
+      for (k=0, i=0; i<N; i++) {
+        if (bucket(h[i]) != b) continue;
+        used[pos[k]] = true;
+        key_[pos[k]] = h[i];
+        idx_[pos[k]] = (uint32_t)i;
+        k++;
+      }
+    }
+  }
+
+  // hash used for keys
+  constexpr uint64_t hash(std::string_view s) const {
+    return v2_ ? maru2_ct(s, iv_).q[0] : maru_ct(s, iv_);
+  }
+
+  // position of hash h in the names, or N if missing
+  constexpr std::size_t find(uint64_t h) const {
+    std::size_t s = slot(h, pilot_[bucket(h)]);
+    return key_[s] == h ? idx_[s] : N;
+  }
+
+  // position of a name, fails to compile if missing
+  constexpr std::size_t operator[](std::string_view s) const {
+    std::size_t i = find(hash(s));
+    if (i == N) throw std::out_of_range("name not in table");
+    return i;
+  }
+
+  static constexpr std::size_t size() { return N; }
+};
+
+template <std::size_t N>
+constexpr maru_switch<N> maru_switch_ct(const char *const (&names)[N], uint64_t iv) {
+    return maru_switch<N>(names, iv, false);
+}
+
+template <std::size_t N>
+constexpr maru_switch<N> maru2_switch_ct(const char *const (&names)[N], uint64_t iv) {
+    return maru_switch<N>(names, iv, true);
+}
+
+#endif
@@ -27,7 +27,20 @@
   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
   POSSIBILITY OF SUCH DAMAGE. */
   
+#if defined(TEST) && defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
 #include "maru2.h"
+#include "stats.h"
+
+#include <stdlib.h>
+
+#if defined(MARU2_DISPATCH) || defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #ifdef TEST
 void bin2hex(void*, int);
@@ -35,15 +48,16 @@ void bin2hex(void*, int);
 
 #ifndef CHASKEY
 
-void speck(void *in, void *mk, void *out){
+static void speck(void *in, const void *mk, void *out){
     uint64_t i,t,k[4],
             *r=(uint64_t*)out,
             *h=(uint64_t*)in;
 
     // copy 128-bit plaintext to output
     r[0] = h[0]; r[1] = h[1];
-    // copy 256-bit master key to local buffer
-    for(i=0;i<4;i++) k[i] = ((uint64_t*)mk)[i];
+    // copy 256-bit master key to local buffer, callers may pass
+    // unaligned message bytes as the key
+    memcpy(k, mk, 32);
     
     for(i=0;i<34;i++) {
       // encrypt plaintext
@@ -57,18 +71,47 @@ void speck(void *in, void *mk, void *out){
     }
 }
 
+// round keys of a 256-bit Speck key
+static void maru2_expand(const uint64_t *mk, uint64_t *rk) {
+    uint64_t i, t, k[4];
+
+    for(i=0;i<4;i++) k[i] = mk[i];
+
+    for(i=0;i<34;i++) {
+      rk[i] = k[0], t = k[3],
+      k[3] = (ROTR64(k[1], 8) + k[0]) ^ i,
+      k[0] = ROTR64(k[0], 61) ^ k[3],
+      k[1] = k[2], k[2] = t;
+    }
+}
+
+// H ^= E(H) with expanded round keys
+static void maru2_speck_rk(const uint64_t *rk, uint64_t *h) {
+    uint64_t r0 = h[0], r1 = h[1];
+    int      i;
+
+    for(i=0;i<34;i++) {
+      r1 = (ROTR64(r1, 8) + r0) ^ rk[i],
+      r0 = ROTR64(r0, 61) ^ r1;
+    }
+    h[0] ^= r0;
+    h[1] ^= r1;
+}
+
 #else
 
 #define ROTR32(v,n)(((v)>>(n))|((v)<<(32-(n))))
 
 // 128-bit keys and 128-bit blocks
-void chaskey(void*in,void*mk,void*out) {
-    uint64_t *k=(uint64_t*)mk,*r=(uint64_t*)out,*h=(uint64_t*)in;
-    uint32_t i,*x=(uint32_t*)r;
+static void chaskey(void*in,const void*mk,void*out) {
+    uint32_t i,x[4],k[4];
     
-    // copy plaintext xor key to output 
-    for(i=0;i<2;i++) 
-      r[i] = h[i] ^ k[i];
+    // plaintext xor key, words are copied so callers
+    // can pass 64-bit arrays without breaking aliasing rules
+    memcpy(x, in, 16);
+    memcpy(k, mk, 16);
+    for(i=0;i<4;i++) 
+      x[i] ^= k[i];
     
     // apply 12 rounds of encryption
     for(i=0;i<12;i++) {
@@ -83,58 +126,1197 @@ void chaskey(void*in,void*mk,void*out) {
       x[2] = ROTR32(x[2], 16);
     }
     // xor ciphertext with key  
-    for(i=0;i<2;i++) 
-      r[i] ^= k[i];
+    for(i=0;i<4;i++) 
+      x[i] ^= k[i];
+    memcpy(out, x, 16);
 }
 
 #endif
 
-void maru2(const char *key, uint64_t iv, void *out) {
+#ifdef _MSC_VER
+#include <intrin.h>
+static __inline int maru2_ctz64(uint64_t x) {
+    unsigned long i;
+    _BitScanForward64(&i, x);
+    return (int)i;
+}
+typedef uint64_t maru2_word;
+#else
+#define maru2_ctz64(x) __builtin_ctzll(x)
+typedef uint64_t __attribute__((__may_alias__)) maru2_word;
+#endif
+
+// length of key up to max. Reads aligned words, which never cross a page,
+// so it may read past the end of key but never faults.
+static size_t maru2_strnlen(const char *key, size_t max) {
+    const maru2_word *w = (const maru2_word*)((uintptr_t)key & ~(uintptr_t)7);
+    size_t           off = (uintptr_t)key & 7, i, n;
+    uint64_t         v, z;
+
+    // bytes before key are not zero
+    v = w[0] | ((1ULL << (off * 8)) - 1);
+
+    for (i=0; ; v=w[++i]) {
+      // high bit set in each zero byte
+      z = (v - 0x0101010101010101ULL) & ~v & 0x8080808080808080ULL;
+      if (z != 0) {
+        n = i * 8 + maru2_ctz64(z) / 8 - off;
+        return n < max ? n : max;
+      }
+      if (i * 8 + 8 - off >= max) return max;
+    }
+}
+
+// copy r < MARU2_BLK_LEN bytes to M and zero the rest, without
+// reading past p + r
+static void maru2_load(uint8_t *m, const uint8_t *p, size_t r) {
+#if defined(__AVX512BW__) && defined(__AVX512VL__) && MARU2_BLK_LEN == 32
+    _mm256_storeu_si256((__m256i*)m,
+      _mm256_maskz_loadu_epi8((__mmask32)((1ULL << r) - 1), p));
+#elif defined(__AVX512BW__) && defined(__AVX512VL__) && MARU2_BLK_LEN == 16
+    _mm_storeu_si128((__m128i*)m,
+      _mm_maskz_loadu_epi8((__mmask16)((1U << r) - 1), p));
+#else
+    uint64_t w = 0;
+    uint32_t a, b;
+    size_t   i;
+
+    memset(m, 0, MARU2_BLK_LEN);
+
+    // whole words
+    for (i=0; i+8<=r; i+=8) memcpy(m + i, p + i, 8);
+    m += i; p += i; r -= i;
+
+    // 0 to 7 bytes left, with loads that overlap
+    if (r >= 4) {
+      memcpy(&a, p, 4);
+      memcpy(&b, p + r - 4, 4);
+      w = a | ((uint64_t)b << ((r - 4) * 8));
+    } else if (r != 0) {
+      w = p[0] | ((uint64_t)p[r / 2] << (r / 2 * 8)) |
+          ((uint64_t)p[r - 1] << ((r - 1) * 8));
+    }
+    memcpy(m, &w, 8);
+#endif
+}
+
+// len is at most MARU2_MAX_STR
+static void maru2_hash(const void *data, size_t len, uint64_t iv, void *out) {
     union { uint64_t q[2]; uint32_t w[4]; uint8_t b[16]; } c, h;
     union { uint64_t q[4]; uint32_t w[8]; uint8_t b[32]; } m;
-    int     len, idx, i, end;
+    const uint8_t *p = (const uint8_t*)data;
+    size_t        r;
 
     // initialize H with iv
     h.q[0] = MARU2_INIT_B ^ iv;
     h.q[1] = MARU2_INIT_D ^ iv;
-    
-    for (idx=0, len=0, end=0; !end; ) {
-      // end of string or max len?
-      if (key[len]==0 || len==MARU2_MAX_STR) {
-        // zero remainder of M
-        for(i=idx;i<MARU2_BLK_LEN;i++) m.b[i]=0;
-        // add end bit
-        m.b[idx] = 0x80;
-        // have we space in M for len?
-        if (idx >= MARU2_BLK_LEN-4) {
-          // no, encrypt H
-          MARU2_CRYPT(&h, &m, &c);
-          // update H
-          h.q[0] ^= c.q[0];
-          h.q[1] ^= c.q[1];          
-          // zero M
-          for(i=0;i<MARU2_BLK_LEN;i++) m.b[i]=0;
+
+    // encrypt H with full blocks straight from input
+    for (r=len; r>=MARU2_BLK_LEN; r-=MARU2_BLK_LEN, p+=MARU2_BLK_LEN) {
+      MARU2_CRYPT(&h, p, &c);
+      h.q[0] ^= c.q[0];
+      h.q[1] ^= c.q[1];
+    }
+    // add last bytes and end bit
+    maru2_load(m.b, p, r);
+    m.b[r] = 0x80;
+    // have we space in M for len?
+    if (r >= MARU2_BLK_LEN-4) {
+      // no, encrypt H
+      MARU2_CRYPT(&h, &m, &c);
+      // update H
+      h.q[0] ^= c.q[0];
+      h.q[1] ^= c.q[1];
+      // zero M
+      memset(m.b, 0, MARU2_BLK_LEN);
+    }
+    // add total len in bits
+    m.w[(MARU2_BLK_LEN/4)-1] = (uint32_t)(len * 8);
+    MARU2_CRYPT(&h, &m, &c);
+    h.q[0] ^= c.q[0];
+    h.q[1] ^= c.q[1];
+
+    memcpy(out, h.b, MARU2_HASH_LEN);
+}
+
+void maru2_n(const void *data, size_t len, uint64_t iv, void *out) {
+    MARU_STAT_BEGIN(t0);
+
+    if (len > MARU2_MAX_STR) len = MARU2_MAX_STR;
+    maru2_hash(data, len, iv, out);
+    MARU_STAT_KEY(MARU2_FN_N, len, 1, MARU2_BLK_LEN);
+    MARU_STAT_END(MARU2_FN_N, "scalar", 1, t0);
+}
+
+void maru2(const char *key, uint64_t iv, void *out) {
+    maru2_n(key, maru2_strnlen(key, MARU2_MAX_STR), iv, out);
+}
+
+// copy up to MARU2_MAX_STR characters of p to key, stopping at a null.
+// wide takes the low byte of each UTF-16LE unit and stops at a zero unit,
+// fold makes A-Z lower case.
+// len is in characters. returns the number copied.
+static size_t maru2_narrow(uint8_t *key, const uint8_t *p, size_t len, int wide, int fold) {
+    size_t  i;
+    uint8_t c;
+#ifdef __SSE2__
+    __m128i x, y, u, lo, a, z, e;
+    int     r;
+
+    // 16 characters at a time if reading them all stays in the page
+    if (((uintptr_t)p & 4095) <= 4096 - (size_t)MARU2_MAX_STR * (wide + 1)) {
+      lo = _mm_set1_epi16(0xFF);
+      a  = _mm_set1_epi8('A' - 1);
+      z  = _mm_set1_epi8('Z' + 1);
+
+      for (i=0; i<MARU2_MAX_STR && i<len; i+=16) {
+        if (wide) {
+          x = _mm_loadu_si128((const __m128i*)(p + 2*i));
+          y = _mm_loadu_si128((const __m128i*)(p + 2*i + 16));
+          // a unit like 0x0100 has a zero low byte but doesn't end the string
+          e = _mm_packs_epi16(_mm_cmpeq_epi16(x, _mm_setzero_si128()),
+                              _mm_cmpeq_epi16(y, _mm_setzero_si128()));
+          x = _mm_packus_epi16(_mm_and_si128(x, lo), _mm_and_si128(y, lo));
+        } else {
+          x = _mm_loadu_si128((const __m128i*)(p + i));
+          e = _mm_cmpeq_epi8(x, _mm_setzero_si128());
+        }
+        if (fold) {
+          // bytes from 0x80 are negative, so not upper case
+          u = _mm_and_si128(_mm_cmpgt_epi8(x, a), _mm_cmplt_epi8(x, z));
+          x = _mm_or_si128(x, _mm_and_si128(u, _mm_set1_epi8(0x20)));
+        }
+        _mm_storeu_si128((__m128i*)(key + i), x);
+
+        r = _mm_movemask_epi8(e);
+        if (r != 0) {
+          i += __builtin_ctz(r);
+          break;
+        }
+      }
+      if (i > len) i = len;
+      return i < MARU2_MAX_STR ? i : MARU2_MAX_STR;
+    }
+#endif
+    for (i=0; i<MARU2_MAX_STR && i<len; i++) {
+      c = wide ? p[2*i] : p[i];
+      if (c == 0 && (!wide || p[2*i+1] == 0)) break;
+      if (fold && (uint8_t)(c - 'A') < 26) c |= 0x20;
+      key[i] = c;
+    }
+    return i;
+}
+
+// UTF-16LE string of at most len units, or up to a null.
+// same hash as maru2 of the string with each unit cut to its low byte.
+void maru2_w(const void *str, size_t len, uint64_t iv, void *out) {
+    uint8_t key[MARU2_MAX_STR];
+
+    maru2_n(key, maru2_narrow(key, (const uint8_t*)str, len, 1, 0), iv, out);
+}
+
+// same hash as maru2 of the string with A-Z in lower case
+void maru2_ci(const char *str, uint64_t iv, void *out) {
+    uint8_t key[MARU2_MAX_STR];
+
+    maru2_n(key, maru2_narrow(key, (const uint8_t*)str, MARU2_MAX_STR, 0, 1), iv, out);
+}
+
+// both of the above
+void maru2_wci(const void *str, size_t len, uint64_t iv, void *out) {
+    uint8_t key[MARU2_MAX_STR];
+
+    maru2_n(key, maru2_narrow(key, (const uint8_t*)str, len, 1, 1), iv, out);
+}
+
+typedef union {
+  uint64_t q[MARU2_BLK_LEN/8];
+  uint32_t w[MARU2_BLK_LEN/4];
+  uint8_t  b[MARU2_BLK_LEN];
+} maru2_blk;
+
+// split key into padded blocks, return number of blocks
+static int maru2_pad(const char *key, maru2_blk *m) {
+    int len, idx, nb;
+
+    memset(m, 0, sizeof(maru2_blk) * MARU2_MAX_BLK);
+
+    len = (int)maru2_strnlen(key, MARU2_MAX_STR);
+    nb  = len / MARU2_BLK_LEN;
+    idx = len % MARU2_BLK_LEN;
+
+    // add full blocks, then last bytes and end bit
+    memcpy(m, key, nb * MARU2_BLK_LEN);
+    maru2_load(m[nb].b, (const uint8_t*)key + nb * MARU2_BLK_LEN, idx);
+    m[nb].b[idx] = 0x80;
+    // have we space in M for len? if not, use another block
+    if (idx >= MARU2_BLK_LEN-4) nb++;
+    // add total len in bits
+    m[nb].w[(MARU2_BLK_LEN/4)-1] = (len * 8);
+    return nb + 1;
+}
+
+// kernels keep H and M transposed in words of the cipher
+#ifndef CHASKEY
+typedef uint64_t maru2_lw;
+#define MARU2_HW 2
+#else
+typedef uint32_t maru2_lw;
+#define MARU2_HW 4
+#endif
+
+typedef void (*maru2_xN)(maru2_lw[MARU2_HW][MARU2_LANES], maru2_lw[4][MARU2_LANES], uint32_t);
+typedef void (*maru2_prng_xN)(const uint64_t*, uint64_t, uint8_t*);
+typedef void (*maru2_multi_xN)(const uint64_t(*)[34], int, uint64_t[2][MARU2_LANES]);
+
+// a kernel hashes lanes keys at a time, scalar has no crypt
+typedef struct _maru2_kern {
+  const char     *name;
+  int            lanes;
+  maru2_xN       crypt;
+  maru2_prng_xN  prng;
+  maru2_multi_xN multi;
+} maru2_kern;
+
+#if MARU2_LANES > 1
+
+#ifdef MARU2_DISPATCH
+#define MARU2_TARGET(x) __attribute__((target(x)))
+#else
+#define MARU2_TARGET(x)
+#endif
+
+#ifndef CHASKEY
+
+#if defined(MARU2_DISPATCH) || MARU2_LANES == 8
+
+// SPECK-128/256 in 8 lanes, H ^= E(M, H) for each active lane
+MARU2_TARGET("avx512f")
+static void speck_x8(uint64_t h[2][MARU2_LANES], uint64_t m[4][MARU2_LANES], uint32_t act) {
+    __m512i  r0, r1, x0, x1, k0, k1, k2, k3, t;
+    uint64_t i;
+
+    // load 128-bit plaintext and 256-bit key of each lane
+    x0 = r0 = _mm512_loadu_si512(h[0]);
+    x1 = r1 = _mm512_loadu_si512(h[1]);
+    k0 = _mm512_loadu_si512(m[0]); k1 = _mm512_loadu_si512(m[1]);
+    k2 = _mm512_loadu_si512(m[2]); k3 = _mm512_loadu_si512(m[3]);
+
+    for(i=0;i<34;i++) {
+      // encrypt plaintext
+      r1 = _mm512_xor_si512(_mm512_add_epi64(_mm512_ror_epi64(r1, 8), r0), k0);
+      r0 = _mm512_xor_si512(_mm512_ror_epi64(r0, 61), r1); t = k3;
+
+      // create next subkey
+      k3 = _mm512_xor_si512(_mm512_add_epi64(_mm512_ror_epi64(k1, 8), k0),
+             _mm512_set1_epi64(i));
+      k0 = _mm512_xor_si512(_mm512_ror_epi64(k0, 61), k3);
+      k1 = k2, k2 = t;
+    }
+    // update H of active lanes only
+    _mm512_storeu_si512(h[0], _mm512_mask_xor_epi64(x0, (__mmask8)act, x0, r0));
+    _mm512_storeu_si512(h[1], _mm512_mask_xor_epi64(x1, (__mmask8)act, x1, r1));
+}
+
+// 8 blocks of keystream from counter ctr
+MARU2_TARGET("avx512f")
+static void prng_x8(const uint64_t *rk, uint64_t ctr, uint8_t *out) {
+    __m512i r0, r1, p;
+    int     i;
+
+    p  = r0 = _mm512_add_epi64(_mm512_set1_epi64(ctr), _mm512_setr_epi64(0,1,2,3,4,5,6,7));
+    r1 = _mm512_setzero_si512();
+
+    for(i=0;i<34;i++) {
+      r1 = _mm512_xor_si512(_mm512_add_epi64(_mm512_ror_epi64(r1, 8), r0),
+             _mm512_set1_epi64(rk[i]));
+      r0 = _mm512_xor_si512(_mm512_ror_epi64(r0, 61), r1);
+    }
+    r0 = _mm512_xor_si512(r0, p);
+
+    // interleave words of each block
+    _mm512_storeu_si512(out, _mm512_permutex2var_epi64(r0,
+      _mm512_setr_epi64(0, 8, 1, 9, 2,10, 3,11), r1));
+    _mm512_storeu_si512(out + 64, _mm512_permutex2var_epi64(r0,
+      _mm512_setr_epi64(4,12, 5,13, 6,14, 7,15), r1));
+}
+
+// H ^= E(M, H) for 8 chaining values and nb blocks of round keys
+MARU2_TARGET("avx512f")
+static void multi_x8(const uint64_t (*rk)[34], int nb, uint64_t h[2][MARU2_LANES]) {
+    __m512i r0, r1, x0, x1;
+    int     b, i;
+
+    x0 = _mm512_loadu_si512(h[0]);
+    x1 = _mm512_loadu_si512(h[1]);
+
+    for(b=0;b<nb;b++) {
+      r0 = x0; r1 = x1;
+      for(i=0;i<34;i++) {
+        r1 = _mm512_xor_si512(_mm512_add_epi64(_mm512_ror_epi64(r1, 8), r0),
+               _mm512_set1_epi64(rk[b][i]));
+        r0 = _mm512_xor_si512(_mm512_ror_epi64(r0, 61), r1);
+      }
+      x0 = _mm512_xor_si512(x0, r0);
+      x1 = _mm512_xor_si512(x1, r1);
+    }
+    _mm512_storeu_si512(h[0], x0);
+    _mm512_storeu_si512(h[1], x1);
+}
+
+#endif
+
+#if defined(MARU2_DISPATCH) || MARU2_LANES == 4
+
+#define ROTR64_8(v)  _mm256_shuffle_epi8(v, _mm256_setr_epi8( \
+    1, 2, 3, 4, 5, 6, 7, 0, 9,10,11,12,13,14,15, 8,         \
+    1, 2, 3, 4, 5, 6, 7, 0, 9,10,11,12,13,14,15, 8))
+#define ROTR64_61(v) _mm256_or_si256(_mm256_slli_epi64(v, 3), _mm256_srli_epi64(v, 61))
+
+// SPECK-128/256 in 4 lanes, H ^= E(M, H) for each active lane
+MARU2_TARGET("avx2")
+static void speck_x4(uint64_t h[2][MARU2_LANES], uint64_t m[4][MARU2_LANES], uint32_t act) {
+    __m256i  r0, r1, x0, x1, k0, k1, k2, k3, t, msk;
+    uint64_t i;
+
+    // load 128-bit plaintext and 256-bit key of each lane
+    x0 = r0 = _mm256_loadu_si256((__m256i*)h[0]);
+    x1 = r1 = _mm256_loadu_si256((__m256i*)h[1]);
+    k0 = _mm256_loadu_si256((__m256i*)m[0]); k1 = _mm256_loadu_si256((__m256i*)m[1]);
+    k2 = _mm256_loadu_si256((__m256i*)m[2]); k3 = _mm256_loadu_si256((__m256i*)m[3]);
+
+    for(i=0;i<34;i++) {
+      // encrypt plaintext
+      r1 = _mm256_xor_si256(_mm256_add_epi64(ROTR64_8(r1), r0), k0);
+      r0 = _mm256_xor_si256(ROTR64_61(r0), r1); t = k3;
+
+      // create next subkey
+      k3 = _mm256_xor_si256(_mm256_add_epi64(ROTR64_8(k1), k0),
+             _mm256_set1_epi64x(i));
+      k0 = _mm256_xor_si256(ROTR64_61(k0), k3);
+      k1 = k2, k2 = t;
+    }
+    // update H of active lanes only
+    msk = _mm256_setr_epi64x(-(int64_t)(act & 1), -(int64_t)((act >> 1) & 1),
+                             -(int64_t)((act >> 2) & 1), -(int64_t)((act >> 3) & 1));
+    _mm256_storeu_si256((__m256i*)h[0], _mm256_xor_si256(x0, _mm256_and_si256(r0, msk)));
+    _mm256_storeu_si256((__m256i*)h[1], _mm256_xor_si256(x1, _mm256_and_si256(r1, msk)));
+}
+
+// 4 blocks of keystream from counter ctr
+MARU2_TARGET("avx2")
+static void prng_x4(const uint64_t *rk, uint64_t ctr, uint8_t *out) {
+    __m256i r0, r1, p, lo, hi;
+    int     i;
+
+    p  = r0 = _mm256_add_epi64(_mm256_set1_epi64x(ctr), _mm256_setr_epi64x(0,1,2,3));
+    r1 = _mm256_setzero_si256();
+
+    for(i=0;i<34;i++) {
+      r1 = _mm256_xor_si256(_mm256_add_epi64(ROTR64_8(r1), r0),
+             _mm256_set1_epi64x(rk[i]));
+      r0 = _mm256_xor_si256(ROTR64_61(r0), r1);
+    }
+    r0 = _mm256_xor_si256(r0, p);
+
+    // interleave words of each block
+    lo = _mm256_unpacklo_epi64(r0, r1);
+    hi = _mm256_unpackhi_epi64(r0, r1);
+    _mm256_storeu_si256((__m256i*)out, _mm256_permute2x128_si256(lo, hi, 0x20));
+    _mm256_storeu_si256((__m256i*)(out + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+
+// H ^= E(M, H) for 4 chaining values and nb blocks of round keys
+MARU2_TARGET("avx2")
+static void multi_x4(const uint64_t (*rk)[34], int nb, uint64_t h[2][MARU2_LANES]) {
+    __m256i r0, r1, x0, x1;
+    int     b, i;
+
+    x0 = _mm256_loadu_si256((__m256i*)h[0]);
+    x1 = _mm256_loadu_si256((__m256i*)h[1]);
+
+    for(b=0;b<nb;b++) {
+      r0 = x0; r1 = x1;
+      for(i=0;i<34;i++) {
+        r1 = _mm256_xor_si256(_mm256_add_epi64(ROTR64_8(r1), r0),
+               _mm256_set1_epi64x(rk[b][i]));
+        r0 = _mm256_xor_si256(ROTR64_61(r0), r1);
+      }
+      x0 = _mm256_xor_si256(x0, r0);
+      x1 = _mm256_xor_si256(x1, r1);
+    }
+    _mm256_storeu_si256((__m256i*)h[0], x0);
+    _mm256_storeu_si256((__m256i*)h[1], x1);
+}
+
+#endif
+
+#ifdef MARU2_DISPATCH
+
+#define ROTR64_8_X2(v)  _mm_shuffle_epi8(v, _mm_setr_epi8( \
+    1, 2, 3, 4, 5, 6, 7, 0, 9,10,11,12,13,14,15, 8))
+#define ROTR64_61_X2(v) _mm_or_si128(_mm_slli_epi64(v, 3), _mm_srli_epi64(v, 61))
+
+// SPECK-128/256 in 2 lanes, H ^= E(M, H) for each active lane
+MARU2_TARGET("sse4.1")
+static void speck_x2(uint64_t h[2][MARU2_LANES], uint64_t m[4][MARU2_LANES], uint32_t act) {
+    __m128i  r0, r1, x0, x1, k0, k1, k2, k3, t, msk;
+    uint64_t i;
+
+    // load 128-bit plaintext and 256-bit key of each lane
+    x0 = r0 = _mm_loadu_si128((__m128i*)h[0]);
+    x1 = r1 = _mm_loadu_si128((__m128i*)h[1]);
+    k0 = _mm_loadu_si128((__m128i*)m[0]); k1 = _mm_loadu_si128((__m128i*)m[1]);
+    k2 = _mm_loadu_si128((__m128i*)m[2]); k3 = _mm_loadu_si128((__m128i*)m[3]);
+
+    for(i=0;i<34;i++) {
+      // encrypt plaintext
+      r1 = _mm_xor_si128(_mm_add_epi64(ROTR64_8_X2(r1), r0), k0);
+      r0 = _mm_xor_si128(ROTR64_61_X2(r0), r1); t = k3;
+
+      // create next subkey
+      k3 = _mm_xor_si128(_mm_add_epi64(ROTR64_8_X2(k1), k0), _mm_set1_epi64x(i));
+      k0 = _mm_xor_si128(ROTR64_61_X2(k0), k3);
+      k1 = k2, k2 = t;
+    }
+    // update H of active lanes only
+    msk = _mm_set_epi64x(-(int64_t)((act >> 1) & 1), -(int64_t)(act & 1));
+    _mm_storeu_si128((__m128i*)h[0], _mm_xor_si128(x0, _mm_and_si128(r0, msk)));
+    _mm_storeu_si128((__m128i*)h[1], _mm_xor_si128(x1, _mm_and_si128(r1, msk)));
+}
+
+// 2 blocks of keystream from counter ctr
+MARU2_TARGET("sse4.1")
+static void prng_x2(const uint64_t *rk, uint64_t ctr, uint8_t *out) {
+    __m128i r0, r1, p;
+    int     i;
+
+    p  = r0 = _mm_add_epi64(_mm_set1_epi64x(ctr), _mm_set_epi64x(1, 0));
+    r1 = _mm_setzero_si128();
+
+    for(i=0;i<34;i++) {
+      r1 = _mm_xor_si128(_mm_add_epi64(ROTR64_8_X2(r1), r0), _mm_set1_epi64x(rk[i]));
+      r0 = _mm_xor_si128(ROTR64_61_X2(r0), r1);
+    }
+    r0 = _mm_xor_si128(r0, p);
+
+    // interleave words of each block
+    _mm_storeu_si128((__m128i*)out, _mm_unpacklo_epi64(r0, r1));
+    _mm_storeu_si128((__m128i*)(out + 16), _mm_unpackhi_epi64(r0, r1));
+}
+
+// H ^= E(M, H) for 2 chaining values and nb blocks of round keys
+MARU2_TARGET("sse4.1")
+static void multi_x2(const uint64_t (*rk)[34], int nb, uint64_t h[2][MARU2_LANES]) {
+    __m128i r0, r1, x0, x1;
+    int     b, i;
+
+    x0 = _mm_loadu_si128((__m128i*)h[0]);
+    x1 = _mm_loadu_si128((__m128i*)h[1]);
+
+    for(b=0;b<nb;b++) {
+      r0 = x0; r1 = x1;
+      for(i=0;i<34;i++) {
+        r1 = _mm_xor_si128(_mm_add_epi64(ROTR64_8_X2(r1), r0), _mm_set1_epi64x(rk[b][i]));
+        r0 = _mm_xor_si128(ROTR64_61_X2(r0), r1);
+      }
+      x0 = _mm_xor_si128(x0, r0);
+      x1 = _mm_xor_si128(x1, r1);
+    }
+    _mm_storeu_si128((__m128i*)h[0], x0);
+    _mm_storeu_si128((__m128i*)h[1], x1);
+}
+
+#endif
+
+#else
+
+#if defined(MARU2_DISPATCH) || MARU2_LANES == 16
+
+// Chaskey in 16 lanes, H ^= E(M, H) for each active lane
+MARU2_TARGET("avx512f")
+static void chaskey_x16(uint32_t h[4][MARU2_LANES], uint32_t m[4][MARU2_LANES], uint32_t act) {
+    __m512i x0, x1, x2, x3, k0, k1, k2, k3, h0, h1, h2, h3;
+    int     i;
+
+    // load 128-bit plaintext and 128-bit key of each lane
+    h0 = _mm512_loadu_si512(h[0]); h1 = _mm512_loadu_si512(h[1]);
+    h2 = _mm512_loadu_si512(h[2]); h3 = _mm512_loadu_si512(h[3]);
+    k0 = _mm512_loadu_si512(m[0]); k1 = _mm512_loadu_si512(m[1]);
+    k2 = _mm512_loadu_si512(m[2]); k3 = _mm512_loadu_si512(m[3]);
+
+    x0 = _mm512_xor_si512(h0, k0); x1 = _mm512_xor_si512(h1, k1);
+    x2 = _mm512_xor_si512(h2, k2); x3 = _mm512_xor_si512(h3, k3);
+
+    for(i=0;i<12;i++) {
+      x0 = _mm512_add_epi32(x0, x1);
+      x1 = _mm512_xor_si512(_mm512_ror_epi32(x1, 27), x0);
+      x2 = _mm512_add_epi32(x2, x3);
+      x3 = _mm512_xor_si512(_mm512_ror_epi32(x3, 24), x2);
+      x2 = _mm512_add_epi32(x2, x1);
+      x0 = _mm512_add_epi32(_mm512_ror_epi32(x0, 16), x3);
+      x3 = _mm512_xor_si512(_mm512_ror_epi32(x3, 19), x0);
+      x1 = _mm512_xor_si512(_mm512_ror_epi32(x1, 25), x2);
+      x2 = _mm512_ror_epi32(x2, 16);
+    }
+    // xor ciphertext with key, update H of active lanes only
+    x0 = _mm512_xor_si512(x0, k0); x1 = _mm512_xor_si512(x1, k1);
+    x2 = _mm512_xor_si512(x2, k2); x3 = _mm512_xor_si512(x3, k3);
+
+    _mm512_storeu_si512(h[0], _mm512_mask_xor_epi32(h0, (__mmask16)act, h0, x0));
+    _mm512_storeu_si512(h[1], _mm512_mask_xor_epi32(h1, (__mmask16)act, h1, x1));
+    _mm512_storeu_si512(h[2], _mm512_mask_xor_epi32(h2, (__mmask16)act, h2, x2));
+    _mm512_storeu_si512(h[3], _mm512_mask_xor_epi32(h3, (__mmask16)act, h3, x3));
+}
+
+#endif
+
+#if defined(MARU2_DISPATCH) || MARU2_LANES == 8
+
+#define ROTR32_X8(v,n) _mm256_or_si256(_mm256_srli_epi32(v, n), _mm256_slli_epi32(v, 32-(n)))
+#define ROTR32_16_X8(v) _mm256_shuffle_epi8(v, _mm256_setr_epi8( \
+  2,3,0,1,6,7,4,5,10,11,8,9,14,15,12,13,2,3,0,1,6,7,4,5,10,11,8,9,14,15,12,13))
+#define ROTR32_24_X8(v) _mm256_shuffle_epi8(v, _mm256_setr_epi8( \
+  3,0,1,2,7,4,5,6,11,8,9,10,15,12,13,14,3,0,1,2,7,4,5,6,11,8,9,10,15,12,13,14))
+
+// Chaskey in 8 lanes
+MARU2_TARGET("avx2")
+static void chaskey_x8(uint32_t h[4][MARU2_LANES], uint32_t m[4][MARU2_LANES], uint32_t act) {
+    __m256i x0, x1, x2, x3, k0, k1, k2, k3, h0, h1, h2, h3, bit, msk;
+    int     i;
+
+    h0 = _mm256_loadu_si256((const __m256i*)h[0]);
+    h1 = _mm256_loadu_si256((const __m256i*)h[1]);
+    h2 = _mm256_loadu_si256((const __m256i*)h[2]);
+    h3 = _mm256_loadu_si256((const __m256i*)h[3]);
+    k0 = _mm256_loadu_si256((const __m256i*)m[0]);
+    k1 = _mm256_loadu_si256((const __m256i*)m[1]);
+    k2 = _mm256_loadu_si256((const __m256i*)m[2]);
+    k3 = _mm256_loadu_si256((const __m256i*)m[3]);
+
+    x0 = _mm256_xor_si256(h0, k0); x1 = _mm256_xor_si256(h1, k1);
+    x2 = _mm256_xor_si256(h2, k2); x3 = _mm256_xor_si256(h3, k3);
+
+    for(i=0;i<12;i++) {
+      x0 = _mm256_add_epi32(x0, x1);
+      x1 = _mm256_xor_si256(ROTR32_X8(x1, 27), x0);
+      x2 = _mm256_add_epi32(x2, x3);
+      x3 = _mm256_xor_si256(ROTR32_24_X8(x3), x2);
+      x2 = _mm256_add_epi32(x2, x1);
+      x0 = _mm256_add_epi32(ROTR32_16_X8(x0), x3);
+      x3 = _mm256_xor_si256(ROTR32_X8(x3, 19), x0);
+      x1 = _mm256_xor_si256(ROTR32_X8(x1, 25), x2);
+      x2 = ROTR32_16_X8(x2);
+    }
+    // all ones in active lanes
+    bit = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    msk = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32((int)act), bit), bit);
+
+    x0 = _mm256_and_si256(_mm256_xor_si256(x0, k0), msk);
+    x1 = _mm256_and_si256(_mm256_xor_si256(x1, k1), msk);
+    x2 = _mm256_and_si256(_mm256_xor_si256(x2, k2), msk);
+    x3 = _mm256_and_si256(_mm256_xor_si256(x3, k3), msk);
+
+    _mm256_storeu_si256((__m256i*)h[0], _mm256_xor_si256(h0, x0));
+    _mm256_storeu_si256((__m256i*)h[1], _mm256_xor_si256(h1, x1));
+    _mm256_storeu_si256((__m256i*)h[2], _mm256_xor_si256(h2, x2));
+    _mm256_storeu_si256((__m256i*)h[3], _mm256_xor_si256(h3, x3));
+}
+
+#endif
+
+#ifdef MARU2_DISPATCH
+
+#define ROTR32_X4(v,n) _mm_or_si128(_mm_srli_epi32(v, n), _mm_slli_epi32(v, 32-(n)))
+#define ROTR32_16_X4(v) _mm_shuffle_epi8(v, _mm_setr_epi8( \
+  2,3,0,1,6,7,4,5,10,11,8,9,14,15,12,13))
+#define ROTR32_24_X4(v) _mm_shuffle_epi8(v, _mm_setr_epi8( \
+  3,0,1,2,7,4,5,6,11,8,9,10,15,12,13,14))
+
+// Chaskey in 4 lanes
+MARU2_TARGET("sse4.1")
+static void chaskey_x4(uint32_t h[4][MARU2_LANES], uint32_t m[4][MARU2_LANES], uint32_t act) {
+    __m128i x0, x1, x2, x3, k0, k1, k2, k3, h0, h1, h2, h3, bit, msk;
+    int     i;
+
+    h0 = _mm_loadu_si128((const __m128i*)h[0]);
+    h1 = _mm_loadu_si128((const __m128i*)h[1]);
+    h2 = _mm_loadu_si128((const __m128i*)h[2]);
+    h3 = _mm_loadu_si128((const __m128i*)h[3]);
+    k0 = _mm_loadu_si128((const __m128i*)m[0]);
+    k1 = _mm_loadu_si128((const __m128i*)m[1]);
+    k2 = _mm_loadu_si128((const __m128i*)m[2]);
+    k3 = _mm_loadu_si128((const __m128i*)m[3]);
+
+    x0 = _mm_xor_si128(h0, k0); x1 = _mm_xor_si128(h1, k1);
+    x2 = _mm_xor_si128(h2, k2); x3 = _mm_xor_si128(h3, k3);
+
+    for(i=0;i<12;i++) {
+      x0 = _mm_add_epi32(x0, x1);
+      x1 = _mm_xor_si128(ROTR32_X4(x1, 27), x0);
+      x2 = _mm_add_epi32(x2, x3);
+      x3 = _mm_xor_si128(ROTR32_24_X4(x3), x2);
+      x2 = _mm_add_epi32(x2, x1);
+      x0 = _mm_add_epi32(ROTR32_16_X4(x0), x3);
+      x3 = _mm_xor_si128(ROTR32_X4(x3, 19), x0);
+      x1 = _mm_xor_si128(ROTR32_X4(x1, 25), x2);
+      x2 = ROTR32_16_X4(x2);
+    }
+    bit = _mm_setr_epi32(1, 2, 4, 8);
+    msk = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32((int)act), bit), bit);
+
+    x0 = _mm_and_si128(_mm_xor_si128(x0, k0), msk);
+    x1 = _mm_and_si128(_mm_xor_si128(x1, k1), msk);
+    x2 = _mm_and_si128(_mm_xor_si128(x2, k2), msk);
+    x3 = _mm_and_si128(_mm_xor_si128(x3, k3), msk);
+
+    _mm_storeu_si128((__m128i*)h[0], _mm_xor_si128(h0, x0));
+    _mm_storeu_si128((__m128i*)h[1], _mm_xor_si128(h1, x1));
+    _mm_storeu_si128((__m128i*)h[2], _mm_xor_si128(h2, x2));
+    _mm_storeu_si128((__m128i*)h[3], _mm_xor_si128(h3, x3));
+}
+
+#endif
+
+#endif
+
+static void maru2_batch_xN(const char **keys, size_t n, uint64_t iv,
+  uint8_t (*out)[MARU2_HASH_LEN], int lanes, maru2_xN crypt, int count)
+{
+    maru2_blk m[MARU2_LANES][MARU2_MAX_BLK];
+    maru2_lw  h[MARU2_HW][MARU2_LANES], k[4][MARU2_LANES], h0[MARU2_HW], k0[4];
+    uint64_t  init[2];
+    int       nb[MARU2_LANES], cnt, max, l, j, w;
+    uint32_t  act;
+    size_t    i;
+
+    init[0] = MARU2_INIT_B ^ iv;
+    init[1] = MARU2_INIT_D ^ iv;
+    memcpy(h0, init, sizeof(h0));
+
+    for (i=0; i<n; i+=cnt) {
+      cnt = (n - i) < (size_t)lanes ? (int)(n - i) : lanes;
+
+      // pad key of each lane and initialize H with iv
+      for (l=0, max=0; l<lanes; l++) {
+        nb[l] = (l < cnt) ? maru2_pad(keys[i+l], m[l]) : 0;
+        if (nb[l] > max) max = nb[l];
+        for (w=0; w<MARU2_HW; w++) h[w][l] = h0[w];
+      }
+      for (j=0; j<max; j++) {
+        // transpose block j of each lane, lanes without it are inactive
+        for (l=0, act=0; l<lanes; l++) {
+          if (j < nb[l]) {
+            memcpy(k0, m[l][j].b, sizeof(k0));
+            for (w=0; w<4; w++) k[w][l] = k0[w];
+            act |= 1 << l;
+          } else {
+            for (w=0; w<4; w++) k[w][l] = 0;
+          }
         }
-        // add total len in bits
-        m.w[(MARU2_BLK_LEN/4)-1] = (len * 8);
-        idx = MARU2_BLK_LEN;
-        end++;
-      } else {    
-        // add byte to M
-        m.b[idx] = (uint8_t)key[len];
-        idx++; len++;
+        // encrypt H and update
+        crypt(h, k, act);
       }
-      if (idx == MARU2_BLK_LEN) {
-        // encrypt H
-        MARU2_CRYPT(&h, &m, &c);
-        // update H
-        h.q[0] ^= c.q[0];
-        h.q[1] ^= c.q[1];
-        idx = 0;
+      for (l=0; l<cnt; l++) {
+        for (w=0; w<MARU2_HW; w++)
+          memcpy(&out[i+l][w*sizeof(maru2_lw)], &h[w][l], sizeof(maru2_lw));
+        // length in bits is the last word of the padding
+        if (count) MARU_STAT_KEY(MARU2_FN_BATCH, m[l][nb[l]-1].w[(MARU2_BLK_LEN/4)-1] / 8, 1, MARU2_BLK_LEN);
       }
     }
-    for(i=0;i<MARU2_HASH_LEN;i++) 
-      ((uint8_t*)out)[i] = h.b[i];   
+}
+
+// full chunks of the tree mode, chunk l of p is leaf index+l
+static void maru2_leaves_xN(const uint8_t *p, uint64_t iv, uint64_t index,
+  uint8_t (*cv)[MARU2_HASH_LEN], int lanes, maru2_xN crypt)
+{
+    maru2_blk m;
+    maru2_lw  h[MARU2_HW][MARU2_LANES], k[4][MARU2_LANES], h0[MARU2_HW], k0[4];
+    uint64_t  init[2];
+    int       l, j, w;
+
+    for (l=0; l<lanes; l++) {
+      init[0] = MARU2_INIT_B ^ iv ^ (index + l);
+      init[1] = MARU2_INIT_D ^ iv ^ MARU2_TREE_LEAF;
+      memcpy(h0, init, sizeof(h0));
+      for (w=0; w<MARU2_HW; w++) h[w][l] = h0[w];
+    }
+    for (j=0; j<MARU2_CHUNK_LEN/MARU2_BLK_LEN; j++) {
+      // transpose block j of each chunk
+      for (l=0; l<lanes; l++) {
+        memcpy(k0, p + (size_t)l * MARU2_CHUNK_LEN + j * MARU2_BLK_LEN, sizeof(k0));
+        for (w=0; w<4; w++) k[w][l] = k0[w];
+      }
+      crypt(h, k, (1UL << lanes) - 1);
+    }
+    // chunks are full, so every lane ends with the same block
+    memset(&m, 0, sizeof(m));
+    m.b[0] = 0x80;
+    m.w[(MARU2_BLK_LEN/4)-1] = MARU2_CHUNK_LEN * 8;
+    memcpy(k0, m.b, sizeof(k0));
+
+    for (w=0; w<4; w++) {
+      for (l=0; l<lanes; l++) k[w][l] = k0[w];
+    }
+    crypt(h, k, (1UL << lanes) - 1);
+
+    for (l=0; l<lanes; l++) {
+      for (w=0; w<MARU2_HW; w++)
+        memcpy(&cv[l][w*sizeof(maru2_lw)], &h[w][l], sizeof(maru2_lw));
+    }
+}
+
+#ifdef CHASKEY
+// Chaskey has no key schedule, so one key under many seeds
+// is a batch with the same blocks in every lane
+static void maru2_multi_ck(maru2_xN crypt, int lanes, const maru2_blk *m,
+  int nb, uint64_t h[2][MARU2_LANES])
+{
+    uint32_t x[4][MARU2_LANES], k[4][MARU2_LANES];
+    int      b, l, w;
+
+    for (l=0; l<lanes; l++) {
+      for (w=0; w<4; w++) x[w][l] = (uint32_t)(h[w/2][l] >> (w%2 * 32));
+    }
+    for (b=0; b<nb; b++) {
+      for (w=0; w<4; w++) {
+        for (l=0; l<lanes; l++) k[w][l] = m[b].w[w];
+      }
+      crypt(x, k, (1UL << lanes) - 1);
+    }
+    for (l=0; l<lanes; l++) {
+      h[0][l] = x[0][l] | (uint64_t)x[1][l] << 32;
+      h[1][l] = x[2][l] | (uint64_t)x[3][l] << 32;
+    }
+}
+#endif
+
+#endif
+
+// slowest first, the last one the cpu supports is the default
+static const maru2_kern maru2_kern_tbl[] = {
+  { "scalar", 1, NULL,     NULL,    NULL     },
+#if MARU2_LANES > 1 && !defined(CHASKEY)
+#ifdef MARU2_DISPATCH
+  { "sse4",   2, speck_x2, prng_x2, multi_x2 },
+  { "avx2",   4, speck_x4, prng_x4, multi_x4 },
+  { "avx512", 8, speck_x8, prng_x8, multi_x8 },
+#elif MARU2_LANES == 8
+  { "avx512", 8, speck_x8, prng_x8, multi_x8 },
+#elif MARU2_LANES == 4
+  { "avx2",   4, speck_x4, prng_x4, multi_x4 },
+#endif
+#elif MARU2_LANES > 1
+  // Chaskey has 32-bit words, twice the lanes of Speck
+#ifdef MARU2_DISPATCH
+  { "sse4",    4, chaskey_x4,  NULL, NULL },
+  { "avx2",    8, chaskey_x8,  NULL, NULL },
+  { "avx512", 16, chaskey_x16, NULL, NULL },
+#elif MARU2_LANES == 16
+  { "avx512", 16, chaskey_x16, NULL, NULL },
+#elif MARU2_LANES == 8
+  { "avx2",    8, chaskey_x8,  NULL, NULL },
+#endif
+#endif
+};
+
+#define MARU2_NKERN (sizeof(maru2_kern_tbl) / sizeof(maru2_kern))
+
+static const maru2_kern *maru2_kern_cur;
+
+// kernels built without MARU2_DISPATCH are enabled by compiler flags
+static int maru2_kern_ok(const maru2_kern *k) {
+#ifdef MARU2_DISPATCH
+    __builtin_cpu_init();
+    if (strcmp(k->name, "avx512") == 0) return __builtin_cpu_supports("avx512f");
+    if (strcmp(k->name, "avx2") == 0)   return __builtin_cpu_supports("avx2");
+    if (strcmp(k->name, "sse4") == 0)   return __builtin_cpu_supports("sse4.1");
+#endif
+    (void)k;
+    return 1;
+}
+
+// count is 0 for the self-test, which must not show in the statistics
+static void maru2_kern_run(const maru2_kern *k, const char **keys, size_t n,
+  uint64_t iv, uint8_t (*out)[MARU2_HASH_LEN], int count)
+{
+    size_t i, len;
+
+#if MARU2_LANES > 1
+    if (k->crypt != NULL) {
+      maru2_batch_xN(keys, n, iv, out, k->lanes, k->crypt, count);
+      return;
+    }
+#endif
+    for (i=0; i<n; i++) {
+      len = maru2_strnlen(keys[i], MARU2_MAX_STR);
+      if (count) MARU_STAT_KEY(MARU2_FN_BATCH, len, 1, MARU2_BLK_LEN);
+      maru2_hash(keys[i], len, iv, out[i]);
+    }
+}
+
+static void maru2_multi_run(const maru2_kern *k, const char *key,
+  const uint64_t *ivs, size_t n, uint8_t (*out)[MARU2_HASH_LEN], int count)
+{
+    maru2_blk m[MARU2_MAX_BLK];
+    uint64_t  h[2][MARU2_LANES], x[2];
+    int       nb, b, l, cnt;
+    size_t    i;
+#ifndef CHASKEY
+    uint64_t  rk[MARU2_MAX_BLK][34];
+#else
+    uint64_t  c[2];
+#endif
+
+    nb = maru2_pad(key, m);
+    if (count) MARU_STAT_KEY(MARU2_FN_MULTI, m[nb-1].w[(MARU2_BLK_LEN/4)-1] / 8, n, MARU2_BLK_LEN);
+    memset(h, 0, sizeof(h));
+#ifndef CHASKEY
+    // the key schedule only depends on the key, do it once
+    for (b=0; b<nb; b++) maru2_expand(m[b].q, rk[b]);
+#endif
+    for (i=0; i<n; i+=cnt) {
+      cnt = (n - i) < (size_t)k->lanes ? (int)(n - i) : k->lanes;
+
+      // unused lanes repeat the first iv
+      for (l=0; l<k->lanes; l++) {
+        h[0][l] = MARU2_INIT_B ^ ivs[i + (l < cnt ? l : 0)];
+        h[1][l] = MARU2_INIT_D ^ ivs[i + (l < cnt ? l : 0)];
+      }
+#if MARU2_LANES > 1 && !defined(CHASKEY)
+      if (k->multi != NULL) {
+        k->multi((const uint64_t(*)[34])rk, nb, h);
+      } else
+#elif MARU2_LANES > 1
+      if (k->crypt != NULL) {
+        maru2_multi_ck(k->crypt, k->lanes, m, nb, h);
+      } else
+#endif
+      {
+        for (b=0; b<nb; b++) {
+          for (l=0; l<cnt; l++) {
+            x[0] = h[0][l]; x[1] = h[1][l];
+#ifndef CHASKEY
+            maru2_speck_rk(rk[b], x);
+#else
+            MARU2_CRYPT(x, m[b].q, c);
+            x[0] ^= c[0]; x[1] ^= c[1];
+#endif
+            h[0][l] = x[0]; h[1][l] = x[1];
+          }
+        }
+      }
+      for (l=0; l<cnt; l++) {
+        memcpy(&out[i+l][0], &h[0][l], 8);
+        memcpy(&out[i+l][8], &h[1][l], 8);
+      }
+    }
+}
+
+#ifndef NDEBUG
+static void maru2_prng_block(maru2_prng *p, uint64_t ctr, uint8_t *out);
+
+// compare each kernel with the reference cipher on every length up
+// to MARU2_MAX_STR, and on a few blocks of keystream
+static void maru2_kern_test(const maru2_kern *k) {
+    char       key[MARU2_MAX_STR+2][MARU2_MAX_STR+2];
+    const char *keys[MARU2_MAX_STR+2];
+    uint8_t    out[MARU2_MAX_STR+2][MARU2_HASH_LEN], ref[MARU2_HASH_LEN];
+    uint8_t    ks[8*MARU2_HASH_LEN];
+    uint64_t   iv[MARU2_MAX_STR+2];
+    maru2_prng p;
+    int        i, j, ok = 1;
+
+    for (i=0; i<MARU2_MAX_STR+2; i++) {
+      for (j=0; j<i; j++) key[i][j] = (char)('a' + (i * 7 + j) % 26);
+      key[i][i] = 0;
+      keys[i] = key[i];
+    }
+    // the uncounted cores, so the test isn't in the statistics
+    maru2_kern_run(k, keys, MARU2_MAX_STR+2, 0x0123456789ABCDEFULL, out, 0);
+
+    for (i=0; i<MARU2_MAX_STR+2; i++) {
+      maru2_hash(key[i], i < MARU2_MAX_STR ? i : MARU2_MAX_STR, 0x0123456789ABCDEFULL, ref);
+      ok &= memcmp(out[i], ref, MARU2_HASH_LEN) == 0;
+    }
+    for (i=0; i<MARU2_MAX_STR+2; i++) iv[i] = 0x0123456789ABCDEFULL * (i + 1);
+    maru2_multi_run(k, key[MARU2_MAX_STR], iv, MARU2_MAX_STR+2, out, 0);
+
+    for (i=0; i<MARU2_MAX_STR+2; i++) {
+      maru2_hash(key[MARU2_MAX_STR], MARU2_MAX_STR, iv[i], ref);
+      ok &= memcmp(out[i], ref, MARU2_HASH_LEN) == 0;
+    }
+    if (k->prng != NULL) {
+      maru2_prng_seed(&p, 0x0123456789ABCDEFULL, 1);
+      k->prng(p.rk, ~0ULL - 2, ks);
+      for (i=0; i<k->lanes; i++) {
+        maru2_prng_block(&p, ~0ULL - 2 + i, ref);
+        ok &= memcmp(&ks[i*MARU2_HASH_LEN], ref, MARU2_HASH_LEN) == 0;
+      }
+    }
+    if (!ok) {
+      fprintf(stderr, "maru2: %s kernel fails self-test\n", k->name);
+      abort();
+    }
+}
+#endif
+
+// pick the fastest kernel once, MARU_KERNEL in the environment
+// can force another for testing. racing threads store the same one.
+static const maru2_kern *maru2_kern_get(void) {
+    const maru2_kern *k, *sel = NULL, *best = NULL;
+    const char       *env;
+    size_t           i;
+
+#ifdef __GNUC__
+    k = __atomic_load_n(&maru2_kern_cur, __ATOMIC_ACQUIRE);
+#else
+    k = maru2_kern_cur;
+#endif
+    if (k != NULL) return k;
+
+    env = getenv("MARU_KERNEL");
+
+    for (i=0; i<MARU2_NKERN; i++) {
+      k = &maru2_kern_tbl[i];
+      if (!maru2_kern_ok(k)) continue;
+#ifndef NDEBUG
+      maru2_kern_test(k);
+#endif
+      best = k;
+      if (env != NULL && strcmp(env, k->name) == 0) sel = k;
+    }
+    // unknown or unsupported names get the default
+    if (sel == NULL) sel = best;
+#ifdef __GNUC__
+    __atomic_store_n(&maru2_kern_cur, sel, __ATOMIC_RELEASE);
+#else
+    maru2_kern_cur = sel;
+#endif
+    return sel;
+}
+
+const char *maru2_kernel(int *lanes) {
+    const maru2_kern *k = maru2_kern_get();
+
+    if (lanes != NULL) *lanes = k->lanes;
+    return k->name;
+}
+
+void maru2_batch(const char **keys, size_t n, uint64_t iv, uint8_t (*out)[MARU2_HASH_LEN]) {
+    const maru2_kern *k = maru2_kern_get();
+    MARU_STAT_BEGIN(t0);
+
+    maru2_kern_run(k, keys, n, iv, out, 1);
+    MARU_STAT_END(MARU2_FN_BATCH, k->name, n, t0);
+}
+
+// hash key under k seeds, the message is padded and its Speck key
+// schedule expanded once for all of them
+void maru2_multi_seed(const char *key, const uint64_t *ivs, size_t k,
+  uint8_t (*out)[MARU2_HASH_LEN])
+{
+    const maru2_kern *kern = maru2_kern_get();
+    MARU_STAT_BEGIN(t0);
+
+    maru2_multi_run(kern, key, ivs, k, out, 1);
+    MARU_STAT_END(MARU2_FN_MULTI, kern->name, k, t0);
+}
+
+// H ^= E(M, H), M may be unaligned input
+static void maru2_compress(maru2_ctx *ctx, const void *m) {
+    union { uint64_t q[2]; uint32_t w[4]; uint8_t b[16]; } c;
+
+    MARU2_CRYPT(&ctx->h, m, &c);
+    ctx->h.q[0] ^= c.q[0];
+    ctx->h.q[1] ^= c.q[1];
+}
+
+void maru2_init(maru2_ctx *ctx, uint64_t iv) {
+    // initialize H with iv
+    ctx->h.q[0] = MARU2_INIT_B ^ iv;
+    ctx->h.q[1] = MARU2_INIT_D ^ iv;
+    ctx->len    = 0;
+    ctx->idx    = 0;
+    ctx->max    = 0;
+}
+
+// same output as maru2() for any input: bytes past MARU2_MAX_STR are ignored
+void maru2_init_compat(maru2_ctx *ctx, uint64_t iv) {
+    maru2_init(ctx, iv);
+    ctx->max = MARU2_MAX_STR;
+}
+
+void maru2_update(maru2_ctx *ctx, const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t*)data;
+    size_t        r;
+
+    // truncate input in compatible mode
+    if (ctx->max != 0) {
+      r = (ctx->len < ctx->max) ? (size_t)(ctx->max - ctx->len) : 0;
+      if (len > r) len = r;
+    }
+    ctx->len += len;
+
+    // fill M if it holds a partial block
+    if (ctx->idx != 0) {
+      r = MARU2_BLK_LEN - ctx->idx;
+      if (r > len) r = len;
+      memcpy(&ctx->m.b[ctx->idx], p, r);
+      ctx->idx += (uint32_t)r; p += r; len -= r;
+
+      if (ctx->idx < MARU2_BLK_LEN) return;
+      maru2_compress(ctx, &ctx->m);
+      ctx->idx = 0;
+    }
+    // encrypt H with full blocks straight from input
+    for (; len >= MARU2_BLK_LEN; p += MARU2_BLK_LEN, len -= MARU2_BLK_LEN)
+      maru2_compress(ctx, p);
+
+    // keep the rest for later
+    memcpy(ctx->m.b, p, len);
+    ctx->idx = (uint32_t)len;
+}
+
+void maru2_final(maru2_ctx *ctx, void *out) {
+    // zero remainder of M and add end bit
+    memset(&ctx->m.b[ctx->idx], 0, MARU2_BLK_LEN - ctx->idx);
+    ctx->m.b[ctx->idx] = 0x80;
+    // have we space in M for len?
+    if (ctx->idx >= MARU2_BLK_LEN-4) {
+      // no, update H and zero M
+      maru2_compress(ctx, &ctx->m);
+      memset(ctx->m.b, 0, MARU2_BLK_LEN);
+    }
+    // add total len in bits
+    ctx->m.w[(MARU2_BLK_LEN/4)-1] = (uint32_t)(ctx->len * 8);
+    maru2_compress(ctx, &ctx->m);
+    // streams are counted, not timed
+    MARU_STAT_KEY(MARU2_FN_STREAM, ctx->len, 1, MARU2_BLK_LEN);
+    MARU_STAT_END(MARU2_FN_STREAM, "scalar", 1, 0);
+
+    memcpy(out, ctx->h.b, MARU2_HASH_LEN);
+}
+
+// leaves of the tree mode, chunk i of data is leaf index+i.
+// flags is MARU2_TREE_ROOT when the input has one chunk.
+void maru2_tree_leaves(const void *data, size_t len, uint64_t iv,
+  uint64_t index, int flags, uint8_t (*cv)[MARU2_HASH_LEN])
+{
+    const uint8_t *p = (const uint8_t*)data;
+    maru2_ctx     ctx;
+    size_t        r;
+#if MARU2_LANES > 1
+    const maru2_kern *k = maru2_kern_get();
+
+    if (k->crypt != NULL) {
+      for (; len >= (size_t)k->lanes * MARU2_CHUNK_LEN; len -= (size_t)k->lanes * MARU2_CHUNK_LEN) {
+        maru2_leaves_xN(p, iv, index, cv, k->lanes, k->crypt);
+        p     += (size_t)k->lanes * MARU2_CHUNK_LEN;
+        index += k->lanes;
+        cv    += k->lanes;
+      }
+      if (len == 0 && p != data) return;
+    }
+#endif
+    // empty input is one empty chunk
+    do {
+      r = (len < MARU2_CHUNK_LEN) ? len : MARU2_CHUNK_LEN;
+
+      maru2_init(&ctx, iv);
+      ctx.h.q[0] ^= index++;
+      ctx.h.q[1] ^= MARU2_TREE_LEAF | flags;
+      maru2_update(&ctx, p, r);
+      maru2_final(&ctx, cv++);
+
+      p += r; len -= r;
+    } while (len != 0);
+}
+
+// parent node of the tree mode, cv is the left child then the right one.
+// pos is the level of the node in the top byte and its index below that.
+void maru2_tree_parent(const void *cv, uint64_t iv, uint64_t pos, int flags, void *out) {
+    maru2_ctx ctx;
+    int       i;
+
+    maru2_init(&ctx, iv);
+    ctx.h.q[0] ^= pos;
+    ctx.h.q[1] ^= MARU2_TREE_PARENT | flags;
+    // always two chaining values, so no padding
+    for (i=0; i<2*MARU2_HASH_LEN; i+=MARU2_BLK_LEN)
+      maru2_compress(&ctx, (const uint8_t*)cv + i);
+
+    memcpy(out, ctx.h.b, MARU2_HASH_LEN);
+}
+
+void maru2_prng_seed(maru2_prng *p, uint64_t seed, uint64_t stream) {
+    p->k[0] = MARU2_INIT_B ^ seed;
+    p->k[1] = MARU2_INIT_D ^ stream;
+    p->k[2] = 0;
+    p->k[3] = 0;
+
+#ifndef CHASKEY
+    // expand Speck key once
+    maru2_expand(p->k, p->rk);
+#endif
+    p->ctr = 0;
+    p->pos = MARU2_HASH_LEN;
+}
+
+// one block of keystream
+static void maru2_prng_block(maru2_prng *p, uint64_t ctr, uint8_t *out) {
+    uint64_t x[2];
+#ifdef CHASKEY
+    uint64_t c[2];
+#endif
+
+    x[0] = ctr;
+    x[1] = 0;
+#ifndef CHASKEY
+    maru2_speck_rk(p->rk, x);
+#else
+    MARU2_CRYPT(x, p->k, c);
+    x[0] ^= c[0];
+    x[1] ^= c[1];
+#endif
+    memcpy(out, x, MARU2_HASH_LEN);
+}
+
+// move to byte offset off of the stream
+void maru2_prng_seek(maru2_prng *p, uint64_t off) {
+    p->ctr = off / MARU2_HASH_LEN;
+    p->pos = MARU2_HASH_LEN;
+
+    if (off % MARU2_HASH_LEN) {
+      maru2_prng_block(p, p->ctr++, p->buf);
+      p->pos = off % MARU2_HASH_LEN;
+    }
+}
+
+void maru2_prng_fill(maru2_prng *p, void *buf, size_t n) {
+    const maru2_kern *k = maru2_kern_get();
+    uint8_t          *out = (uint8_t*)buf;
+
+    // rest of last block
+    for (; n != 0 && p->pos < MARU2_HASH_LEN; n--)
+      *out++ = p->buf[p->pos++];
+
+    if (k->prng != NULL) {
+      for (; n >= k->lanes*MARU2_HASH_LEN; n -= k->lanes*MARU2_HASH_LEN) {
+        k->prng(p->rk, p->ctr, out);
+        p->ctr += k->lanes;
+        out    += k->lanes*MARU2_HASH_LEN;
+      }
+    }
+    for (; n >= MARU2_HASH_LEN; n -= MARU2_HASH_LEN) {
+      maru2_prng_block(p, p->ctr++, out);
+      out += MARU2_HASH_LEN;
+    }
+    if (n != 0) {
+      maru2_prng_block(p, p->ctr++, p->buf);
+      memcpy(out, p->buf, n);
+      p->pos = (uint32_t)n;
+    }
 }
 
 #ifdef TEST
@@ -272,18 +1454,268 @@ void inc_buf(void *buf, int mlen) {
 void diehard(uint64_t iv) {
     uint8_t  key[MARU2_MAX_STR+1];
     int      i;
-    uint8_t  h[MARU2_HASH_LEN];
+    uint8_t  h[4096][MARU2_HASH_LEN];
     
     memset(key, 1, sizeof(key));
 
-    for (i=0; ; i++) {
-      // increment string buffer
-      inc_buf(key, MARU2_MAX_STR);
-      // generate hash
-      maru2((const char*)key, iv, h);
+    for (;;) {
+      for (i=0; i<4096; i++) {
+        // increment string buffer
+        inc_buf(key, MARU2_MAX_STR);
+        // generate hash
+        maru2((const char*)key, iv, h[i]);
+      }
       // write to stdout
-      fwrite(&h, sizeof(h), 1, stdout);
+      fwrite(h, sizeof(h), 1, stdout);
+    }
+}
+
+#define GEN_CHUNK (1024*1024)
+
+#ifdef __linux__
+
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+// chunk c of the stream is made by thread c % threads into slot c % nslot,
+// and written in order, so output is the same for any number of threads.
+typedef struct _gen_slot {
+  uint8_t  *buf;
+  uint64_t seq;    // chunk this slot holds next
+  int      ready;
+} gen_slot;
+
+typedef struct _gen {
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+  gen_slot        *slot;
+  int             nslot, nthr;
+  uint64_t        iv;
+} gen;
+
+typedef struct _gen_arg {
+  gen *g;
+  int id;
+} gen_arg;
+
+void *gen_worker(void *arg) {
+    gen_arg    *a = (gen_arg*)arg;
+    gen        *g = a->g;
+    gen_slot   *s;
+    maru2_prng p;
+    uint64_t   c;
+
+    maru2_prng_seed(&p, g->iv, 0);
+
+    for (c=a->id; ; c+=g->nthr) {
+      s = &g->slot[c % g->nslot];
+
+      pthread_mutex_lock(&g->lock);
+      while (s->seq != c || s->ready) pthread_cond_wait(&g->cond, &g->lock);
+      pthread_mutex_unlock(&g->lock);
+
+      maru2_prng_seek(&p, c * GEN_CHUNK);
+      maru2_prng_fill(&p, s->buf, GEN_CHUNK);
+
+      pthread_mutex_lock(&g->lock);
+      s->ready = 1;
+      pthread_cond_broadcast(&g->cond);
+      pthread_mutex_unlock(&g->lock);
+    }
+    return NULL;
+}
+
+// write len bytes, moving pages into the pipe when spliced
+int gen_write(int spliced, uint8_t *buf, size_t len) {
+    struct iovec iov;
+    ssize_t      r;
+
+    while (len != 0) {
+      if (spliced) {
+        iov.iov_base = buf;
+        iov.iov_len  = len;
+        r = vmsplice(1, &iov, 1, 0);
+      } else {
+        r = write(1, buf, len);
+      }
+      if (r <= 0) return 0;
+      buf += r; len -= r;
+    }
+    return 1;
+}
+
+// ./maru2 -g <128-bit iv> [threads] | dieharder -a -g 200
+void keystream(uint64_t iv, int threads) {
+    gen         g;
+    gen_arg     *a;
+    gen_slot    *s;
+    pthread_t   id;
+    struct stat st;
+    uint64_t    c, prev;
+    int         i, spliced;
+
+    if (threads < 1) threads = 1;
+
+    pthread_mutex_init(&g.lock, NULL);
+    pthread_cond_init(&g.cond, NULL);
+    g.nthr  = threads;
+    g.nslot = 2 * threads + 1;
+    g.iv    = iv;
+    g.slot  = calloc(g.nslot, sizeof(gen_slot));
+    a       = calloc(threads, sizeof(gen_arg));
+
+    for (i=0; i<g.nslot; i++) {
+      g.slot[i].buf = aligned_alloc(4096, GEN_CHUNK);
+      g.slot[i].seq = i;
+    }
+    // a pipe holding exactly one chunk has read all of a chunk
+    // once the next one is spliced in, so its slot can be reused
+    spliced = fstat(1, &st) == 0 && S_ISFIFO(st.st_mode) &&
+              fcntl(1, F_SETPIPE_SZ, GEN_CHUNK) == GEN_CHUNK;
+
+    for (i=0; i<threads; i++) {
+      a[i].g  = &g;
+      a[i].id = i;
+      pthread_create(&id, NULL, gen_worker, &a[i]);
+    }
+    for (c=0; ; c++) {
+      s = &g.slot[c % g.nslot];
+
+      pthread_mutex_lock(&g.lock);
+      while (s->seq != c || !s->ready) pthread_cond_wait(&g.cond, &g.lock);
+      pthread_mutex_unlock(&g.lock);
+
+      if (!gen_write(spliced, s->buf, GEN_CHUNK)) break;
+
+      // free this slot, or the one before if the pipe still maps it
+      if (spliced && c == 0) continue;
+      prev = spliced ? c - 1 : c;
+      s = &g.slot[prev % g.nslot];
+
+      pthread_mutex_lock(&g.lock);
+      s->ready = 0;
+      s->seq   = prev + g.nslot;
+      pthread_cond_broadcast(&g.cond);
+      pthread_mutex_unlock(&g.lock);
+    }
+}
+
+#else
+
+// ./maru2 -g <128-bit iv> | dieharder -a -g 200
+void keystream(uint64_t iv, int threads) {
+    maru2_prng p;
+    uint8_t    *buf = malloc(GEN_CHUNK);
+
+    maru2_prng_seed(&p, iv, 0);
+
+    for (;;) {
+      maru2_prng_fill(&p, buf, GEN_CHUNK);
+      if (fwrite(buf, GEN_CHUNK, 1, stdout) != 1) break;
+    }
+}
+
+#endif
+
+// keystream against blocks made with the cipher
+int prng_test(uint64_t iv) {
+    maru2_prng p, q;
+    uint64_t   x[2], c[2];
+    uint8_t    a[1000], b[1000];
+    int        i, n, equ = 1;
+
+    maru2_prng_seed(&p, iv, 1);
+    maru2_prng_fill(&p, a, sizeof(a));
+
+    for (i=0; i<sizeof(a)/MARU2_HASH_LEN; i++) {
+      x[0] = i; x[1] = 0;
+      MARU2_CRYPT(x, p.k, c);
+      c[0] ^= x[0]; c[1] ^= x[1];
+      equ &= memcmp(c, &a[i*MARU2_HASH_LEN], MARU2_HASH_LEN)==0;
+    }
+    // fill in odd sized pieces
+    maru2_prng_seed(&q, iv, 1);
+    for (i=0; i<sizeof(b); i+=n) {
+      n = (i * 7 + 3) % 150;
+      if (n > sizeof(b) - i) n = sizeof(b) - i;
+      maru2_prng_fill(&q, &b[i], n);
+    }
+    equ &= memcmp(a, b, sizeof(a))==0;
+
+    // jump ahead
+    for (i=0; i<sizeof(a); i+=37) {
+      maru2_prng_seek(&q, i);
+      maru2_prng_fill(&q, b, sizeof(a) - i);
+      equ &= memcmp(&a[i], b, sizeof(a) - i)==0;
+    }
+    // other streams differ
+    maru2_prng_seed(&q, iv, 2);
+    maru2_prng_fill(&q, b, sizeof(b));
+    equ &= memcmp(a, b, sizeof(a))!=0;
+    return equ;
+}
+
+// upper case, UTF-16 with junk in the high bytes, and at the end of
+// a page so the scalar path is used
+int wide_test(uint64_t iv) {
+    static uint8_t buf[3*4096];
+    uint8_t  *page, a[MARU2_HASH_LEN], b[MARU2_HASH_LEN];
+    uint16_t *w, kern[6] = { 'K', 'e', 0x0100, 'r', 'n', 0 };
+    char     lower[MARU2_MAX_STR*2], upper[MARU2_MAX_STR*2];
+    size_t   i, j, k, n, len;
+    int      equ = 1;
+
+    // aligned_alloc isn't in msvc, so align a static buffer
+    page = (uint8_t*)(((uintptr_t)buf + 4095) & ~(uintptr_t)4095);
+    for (i=0; i<sizeof(api_tbl)/sizeof(char*); i++) {
+      len = strlen(api_tbl[i]);
+      for (j=0; j<=len; j++) {
+        lower[j] = (char)tolower(api_tbl[i][j]);
+        upper[j] = (char)toupper(api_tbl[i][j]);
+      }
+      maru2(lower, iv, a);
+      maru2_ci(upper, iv, b);
+      equ &= memcmp(a, b, MARU2_HASH_LEN) == 0;
+
+      for (k=0; k<2; k++) {
+        w = (uint16_t*)(page + (k ? 4096 - 2*(len + 1) : 64));
+        for (j=0; j<len; j++) w[j] = (uint8_t)upper[j] | 0x0100;
+        w[len] = 0;
+
+        maru2_wci(w, (size_t)-1, iv, b);
+        equ &= memcmp(a, b, MARU2_HASH_LEN) == 0;
+
+        for (j=0; j<len; j++) w[j] = (uint8_t)api_tbl[i][j] | 0x0400;
+        maru2(api_tbl[i], iv, a);
+        maru2_w(w, (size_t)-1, iv, b);
+        equ &= memcmp(a, b, MARU2_HASH_LEN) == 0;
+
+        // counted, as from a UNICODE_STRING
+        for (n=0; n<=len; n++) {
+          maru2_n(api_tbl[i], n < MARU2_MAX_STR ? n : MARU2_MAX_STR, iv, a);
+          maru2_w(w, n, iv, b);
+          equ &= memcmp(a, b, MARU2_HASH_LEN) == 0;
+        }
+        maru2(lower, iv, a);
+      }
+    }
+    // only a zero unit ends the string, not a zero low byte
+    for (k=0; k<2; k++) {
+      w = (uint16_t*)(page + (k ? 4096 - sizeof(kern) : 64));
+      memcpy(w, kern, sizeof(kern));
+      maru2_w(w, (size_t)-1, iv, a);
+      maru2_n("Ke\0rn", 5, iv, b);
+      equ &= memcmp(a, b, MARU2_HASH_LEN) == 0;
+      maru2_n("Ke", 2, iv, b);
+      equ &= memcmp(a, b, MARU2_HASH_LEN) != 0;
+      maru2_wci(w, (size_t)-1, iv, a);
+      maru2_n("ke\0rn", 5, iv, b);
+      equ &= memcmp(a, b, MARU2_HASH_LEN) == 0;
     }
+    return equ;
 }
 
 uint64_t get_iv(const char *s) {
@@ -318,10 +1750,15 @@ char* getparam (int argc, char *argv[], int *i)
 
 int main(int argc, char *argv[])
 {
-    int        i, j, equ;
+    int        i, j, equ, lanes;
+    const char *name;
     const char **p=api_hash;
-    char       key[MARU2_MAX_STR+1];
+    char       key[MARU2_MAX_STR+1], big[MARU2_MAX_STR*4];
     uint8_t    res[MARU2_HASH_LEN], bin[MARU2_HASH_LEN];
+    uint8_t    batch[sizeof(api_tbl)/sizeof(char*)][MARU2_HASH_LEN];
+    maru2_ctx  ctx;
+    uint64_t   ivs[37];
+    uint8_t    multi[37][MARU2_HASH_LEN];
     char       opt;
     uint64_t   iv;
     char       *s;
@@ -337,9 +1774,16 @@ int main(int argc, char *argv[])
             iv=get_iv(s);
             // test using iv
             diehard(iv);
+          // generator writes keystream to stdout
+          case 'g':
+            s=getparam(argc, argv, &i);
+            iv=get_iv(s);
+            keystream(iv, (i+1 < argc) ? atoi(argv[i+1]) : 1);
+            return 0;
           default:
             printf ("usage: %s <key> <iv>\n", argv[0]);
             printf ("       %s -t <128-bit iv> | dieharder -a -g 200\n", argv[0]);
+            printf ("       %s -g <128-bit iv> [threads] | dieharder -a -g 200\n", argv[0]);
             return 0;
         }
       }
@@ -374,6 +1818,78 @@ int main(int argc, char *argv[])
             equ ? "OK" : "FAIL");
         }
       }
+      // hash each table of strings with one call
+      p=api_hash;
+      putchar('\n');
+      for (i=0; i<sizeof(iv_tbl)/sizeof(uint64_t); i++) {
+        maru2_batch(api_tbl, sizeof(api_tbl)/sizeof(char*), iv_tbl[i], batch);
+        for (j=0, equ=1; j<sizeof(api_tbl)/sizeof(char*); j++) {
+          hex2bin((void*)&bin, *p++);
+          equ &= memcmp(bin, batch[j], 16)==0;
+        }
+        name = maru2_kernel(&lanes);
+        printf ("maru2_batch(api_tbl, %016llx) using %s, %d lane(s) : %s\n",
+          (unsigned long long)iv_tbl[i], name, lanes,
+          equ ? "OK" : "FAIL");
+      }
+      // absorb each string one byte at a time
+      p=api_hash;
+      putchar('\n');
+      for (i=0; i<sizeof(iv_tbl)/sizeof(uint64_t); i++) {
+        for (j=0, equ=1; j<sizeof(api_tbl)/sizeof(char*); j++) {
+          hex2bin((void*)&bin, *p++);
+          maru2_init(&ctx, iv_tbl[i]);
+          for (s=(char*)api_tbl[j]; *s!=0; s++)
+            maru2_update(&ctx, s, 1);
+          maru2_final(&ctx, res);
+          equ &= memcmp(bin, res, 16)==0;
+        }
+        printf ("maru2_update(api_tbl, %016llx) : %s\n",
+          (unsigned long long)iv_tbl[i], equ ? "OK" : "FAIL");
+      }
+      // compatible mode ignores bytes past MARU2_MAX_STR
+      memset(big, 'A', sizeof(big)-1);
+      big[sizeof(big)-1] = 0;
+      maru2(big, iv_tbl[0], bin);
+      maru2_init_compat(&ctx, iv_tbl[0]);
+      maru2_update(&ctx, big, 3);
+      maru2_update(&ctx, big+3, sizeof(big)-4);
+      maru2_final(&ctx, res);
+      printf ("maru2_init_compat(%d+ bytes) : %s\n", MARU2_MAX_STR,
+        memcmp(bin, res, 16)==0 ? "OK" : "FAIL");
+
+      // each string under many seeds at once
+      for (i=0; i<37; i++) ivs[i] = iv_tbl[i % 3] ^ ((uint64_t)i << 56);
+      for (j=0, equ=1; j<sizeof(api_tbl)/sizeof(char*); j++) {
+        maru2_multi_seed(api_tbl[j], ivs, 37, multi);
+        for (i=0; i<37; i++) {
+          maru2(api_tbl[j], ivs[i], res);
+          equ &= memcmp(multi[i], res, 16)==0;
+        }
+      }
+      printf ("maru2_multi_seed(api_tbl, 37 seeds) : %s\n", equ ? "OK" : "FAIL");
+
+      // every length and alignment against the byte at a time path
+      for (i=0, equ=1; i<MARU2_MAX_STR+8; i++) {
+        for (j=0; j<8; j++) {
+          memset(big, 0, sizeof(big));
+          for (iv=0; iv<(uint64_t)i; iv++) big[j+iv] = (char)('a' + (iv*7 + i) % 26);
+          maru2_init_compat(&ctx, iv_tbl[1]);
+          maru2_update(&ctx, big+j, i);
+          maru2_final(&ctx, bin);
+          maru2_n(big+j, i, iv_tbl[1], res);
+          equ &= memcmp(bin, res, 16)==0;
+          maru2(big+j, iv_tbl[1], res);
+          equ &= memcmp(bin, res, 16)==0;
+        }
+      }
+      printf ("maru2_n(0 to %d bytes, 8 alignments) : %s\n", MARU2_MAX_STR+7,
+        equ ? "OK" : "FAIL");
+
+      printf ("maru2_w, maru2_ci, maru2_wci : %s\n", wide_test(iv_tbl[1]) ? "OK" : "FAIL");
+
+      printf ("\nmaru2_prng(%016llx) : %s\n", (unsigned long long)iv_tbl[0],
+        prng_test(iv_tbl[0]) ? "OK" : "FAIL");
     }
     return 0;
 }
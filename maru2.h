@@ -64,11 +64,78 @@
 
 #define MARU2_INIT_H  MARU2_INIT_D
 
+// maximum number of blocks for a key, including padding
+#define MARU2_MAX_BLK  ((MARU2_MAX_STR/MARU2_BLK_LEN)+2)
+
+// tree mode: bytes per leaf, and node flags xored into H
+#define MARU2_CHUNK_LEN    4096
+#define MARU2_TREE_LEAF    1
+#define MARU2_TREE_PARENT  2
+#define MARU2_TREE_ROOT    4
+
+// maru2_batch picks a kernel at run time on x86 with gcc or clang.
+// other compilers use the one enabled by compiler flags.
+#if !defined(MARU_NO_DISPATCH) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define MARU2_DISPATCH
+#endif
+
+// most keys hashed in parallel by maru2_batch
+#if !defined(CHASKEY) && (defined(MARU2_DISPATCH) || defined(__AVX512F__))
+#define MARU2_LANES    8
+#elif !defined(CHASKEY) && defined(__AVX2__)
+#define MARU2_LANES    4
+#elif defined(MARU2_DISPATCH) || defined(__AVX512F__)
+#define MARU2_LANES    16
+#elif defined(__AVX2__)
+#define MARU2_LANES    8
+#else
+#define MARU2_LANES    1
+#endif
+
+// streaming context
+typedef struct _maru2_ctx {
+  union { uint64_t q[2]; uint32_t w[4]; uint8_t b[16]; } h;
+  union { uint64_t q[4]; uint32_t w[8]; uint8_t b[32]; } m;
+  uint64_t len;  // total bytes absorbed
+  uint32_t idx;  // bytes in M
+  uint32_t max;  // 0 for no limit, else MARU2_MAX_STR
+} maru2_ctx;
+
+// counter mode generator, block i is P ^ E(K, P) with P = (i, 0)
+// and K built from seed and stream
+typedef struct _maru2_prng {
+  uint64_t k[4];    // 256-bit key, or 128-bit for Chaskey
+  uint64_t rk[34];  // Speck round keys
+  uint64_t ctr;     // next block
+  uint8_t  buf[MARU2_HASH_LEN];
+  uint32_t pos;     // bytes of buf used
+} maru2_prng;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
   void maru2 (const char*, uint64_t, void*);
+  void maru2_n (const void*, size_t, uint64_t, void*);
+  void maru2_w (const void*, size_t, uint64_t, void*);
+  void maru2_ci (const char*, uint64_t, void*);
+  void maru2_wci (const void*, size_t, uint64_t, void*);
+  void maru2_batch (const char**, size_t, uint64_t, uint8_t(*)[MARU2_HASH_LEN]);
+  void maru2_multi_seed (const char*, const uint64_t*, size_t, uint8_t(*)[MARU2_HASH_LEN]);
+  const char *maru2_kernel (int*);
+
+  void maru2_init (maru2_ctx*, uint64_t);
+  void maru2_init_compat (maru2_ctx*, uint64_t);
+  void maru2_update (maru2_ctx*, const void*, size_t);
+  void maru2_final (maru2_ctx*, void*);
+
+  void maru2_tree_leaves (const void*, size_t, uint64_t, uint64_t, int, uint8_t(*)[MARU2_HASH_LEN]);
+  void maru2_tree_parent (const void*, uint64_t, uint64_t, int, void*);
+
+  void maru2_prng_seed (maru2_prng*, uint64_t, uint64_t);
+  void maru2_prng_seek (maru2_prng*, uint64_t);
+  void maru2_prng_fill (maru2_prng*, void*, size_t);
 
 #ifdef __cplusplus
 }
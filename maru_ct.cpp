@@ -0,0 +1,256 @@
+/**
+  Copyright © 2017 Odzhan. All Rights Reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  3. The name of the author may not be used to endorse or promote products
+  derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY AUTHORS "AS IS" AND ANY EXPRESS OR
+  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+  STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE. */
+
+#include "maru.hpp"
+
+#ifdef TEST
+
+#include <stdlib.h>
+
+constexpr const char *api_tbl[]=
+{ "CreateProcessA",
+  "LoadLibraryA",
+  "GetProcAddress",
+  "WSASocketA",
+  "GetOverlappedResult",
+  "WaitForSingleObject",
+  "TerminateProcess",
+  "CloseHandle"  };
+
+constexpr uint32_t iv_tbl[]=
+{ 0xB467369E,    // hex(trunc(frac(sqrt(137))*(2^32)))
+  0xCA320B75,    // hex(trunc(frac(sqrt(139))*(2^32)))
+  0x34E0D42E  };
+
+constexpr uint64_t api_hash[]=
+{ 0xdfa1de9f2ba8bb90ULL,
+  0xca373df6574bb594ULL,
+  0xdc6be1f8f896bf39ULL,
+  0x6a5e1a9191abf9f9ULL,
+  0xf4f085f3b39948efULL,
+  0x69049dac4d5f0611ULL,
+  0x30e1b9c4fd652a0fULL,
+  0x3c70ee014de21690ULL,
+
+  0x1321263095680c87ULL,
+  0x6ea346f388a28bebULL,
+  0xdf623104f7900c12ULL,
+  0x1966b0ac553e7432ULL,
+  0xd46e329d6e9e0bc6ULL,
+  0xeeea2f3292ea27c7ULL,
+  0xe17428c9c3fb37f6ULL,
+  0x4674a23abf321378ULL,
+
+  0x2b775ce7bb962b8aULL,
+  0xdec1c645b6efb8d4ULL,
+  0x62d3ec77dd71caefULL,
+  0x2537e3bdd94a6542ULL,
+  0xaeb84fbc1c43b36cULL,
+  0x40722f8ef4c72300ULL,
+  0x075637c9e4bb3222ULL,
+  0x06402c602f4ad7a0ULL };
+
+constexpr const char *api2_tbl[]=
+{ "CreateProcessA",
+  "LoadLibrayA",
+  "GetProcAddress",
+  "WSASocketA",
+  "GetOverlappedResult",
+  "WaitForSingleObject",
+  "TerminateProcess",
+  "CloseHandle"  };
+
+constexpr uint64_t iv2_tbl[]=
+{ 0x15DF1E4BE5E7970F,    // hex(trunc(frac(sqrt(1/137))*(2^64))) 
+  0x15B6B0E361669B16,    // hex(trunc(frac(sqrt(1/139))*(2^64)))
+  0x14F8EB16A5984A4E  };
+
+#ifndef CHASKEY
+constexpr const char *api2_hash[]=
+{ "9858248f2f001b733d34a3101e3a909e",
+  "ca12cb61de448562e572e37aa55dfb7f",
+  "498c243e939acb8a9d59c44c6c9f4380",
+  "01c839fbf214db9524a68a100b1cd754",
+  "b7f38ae915ecc7335638e89f0cffb583",
+  "ed0e39aaaa2b3e399d8455cc7505ef93",
+  "04f7639f7ee9236994b0d28c0fb4b055",
+  "854cfb2c97c8c18ffcbf95f9c746950c",
+
+  "c6228cee2be2b88aacb01f850615eeb3",
+  "5d2755646a6e085c1d7dc8fa7591682e",
+  "4fc018eb44a4490bd65954d2df3e398c",
+  "9a42b9ae9f6a9345b71ae3e353ba3260",
+  "5f13944a73a86069a7738833222aa7f8",
+  "cedf16f7531fde6df6d3a37e72fee107",
+  "c332ea0b843d33e3d59cacbaa45f15c1",
+  "b4cf1b2866c819f8897ab862399873f4",
+
+  "10842cca0875ef4b146a4e41751d91e8",
+  "1b956c02d01403fc80de0aa8c0fa597a",
+  "c17bc5a83feec3ececb9a734aab0f287",
+  "3f2b56fba6cd4dbf5f4f5f1f7b94d273",
+  "7af936877831f3e7fec329bcd1ff103e",
+  "268bc439753e41c4b9c48ad9dee43878",
+  "1a5d81d790bb66d4eda824a87273173b",
+  "c8d3a074596bff3ec63aabb9402b33b7" };
+#else
+constexpr const char *api2_hash[]=
+{ "54be451bb469019342f8e59d72c73977",
+  "2ec18e184293e002e7ca996342192e05",
+  "568f103d5af848a93b008c7b616efd31",
+  "b4c7871c02689facfc9d33a52087fc8f",
+  "1083cdc471478a88fb4ac75d2db480c9",
+  "503ab74f73f6f6c2fbf3065d190c2f19",
+  "71b977be78e66fca24afe24fdc8bc198",
+  "1841c661b87fb7e6879621f4f09ca636",
+
+  "b0e3d9c84ab287bbc6160f33d08ff692",
+  "c70033a3855b3cf45fb8c76269bb7083",
+  "6072eff84649be594bbd091cc93b8951",
+  "2ba8e61d11fdda163bb07df614dc5d84",
+  "8ade5c23caf20853c7237f3d4fcdcaf6",
+  "6da2b4b3ea6feb384f6acabe369e865b",
+  "1862340516faa957f430f88bdf9ccb06",
+  "c50ae50471bffe33dbe894fbd025eba4",
+
+  "761a74e4141beb06eefeb484278695d4",
+  "1fdb8c8aa1a5c7a7fcd139462254ae10",
+  "bf8b48c0b0418701894d72e31259b764",
+  "7a292cf938788c4655bed14857aa8e38",
+  "ca64dd43b61615a1007f6f6690d2ef98",
+  "c00792b2feb4dbad15b0f1aefe1c6b7f",
+  "75e08a5ddf2559ee0957a6e394abf940",
+  "be73af81cce67c57a933b934ce8e309f" };
+#endif
+
+constexpr int hexval(char c) {
+    return c <= '9' ? c - '0' : c - 'a' + 10;
+}
+
+constexpr bool maru_vectors() {
+    for (int i=0; i<3; i++)
+      for (int j=0; j<8; j++)
+        if (maru_ct(api_tbl[j], iv_tbl[i]) != api_hash[i*8 + j]) return false;
+    return true;
+}
+
+constexpr bool maru2_vectors() {
+    for (int i=0; i<3; i++) {
+      for (int j=0; j<8; j++) {
+        maru2_hash h = maru2_ct(api2_tbl[j], iv2_tbl[i]);
+        const char *x = api2_hash[i*8 + j];
+        for (int k=0; k<MARU2_HASH_LEN; k++)
+          if (h.b(k) != hexval(x[k*2]) * 16 + hexval(x[k*2+1])) return false;
+      }
+    }
+    return true;
+}
+
+static_assert(maru_vectors(), "maru_ct does not match maru test vectors");
+static_assert(maru2_vectors(), "maru2_ct does not match maru2 test vectors");
+static_assert("CreateProcessA"_maru == maru_ct("CreateProcessA", MARU_CT_IV), "_maru");
+static_assert("CreateProcessA"_maru2 == maru2_ct("CreateProcessA", MARU_CT_IV), "_maru2");
+
+constexpr const char *dispatch_tbl[]=
+{ "LoadLibraryA",   "GetProcAddress",  "VirtualAlloc",   "VirtualFree",
+  "VirtualProtect", "CreateThread",    "ExitThread",     "Sleep",
+  "CreateFileA",    "ReadFile",        "WriteFile",      "CloseHandle",
+  "CreateProcessA", "WaitForSingleObject", "GetLastError", "ExitProcess",
+  "WSAStartup",     "WSASocketA",      "connect",        "recv",
+  "send",           "closesocket",     "GetModuleHandleA", "FreeLibrary" };
+
+constexpr auto tbl  = maru_switch_ct(dispatch_tbl, iv_tbl[0]);
+constexpr auto tbl2 = maru2_switch_ct(dispatch_tbl, iv2_tbl[0]);
+
+static_assert(tbl["Sleep"] == 7, "maru_switch");
+static_assert(tbl2["FreeLibrary"] == 23, "maru2_switch");
+
+// runtime hash to position in dispatch_tbl, through a jump table
+static int dispatch(uint64_t h) {
+    switch (tbl.find(h)) {
+      case tbl["LoadLibraryA"]:   return 0;
+      case tbl["GetProcAddress"]: return 1;
+      case tbl["VirtualAlloc"]:   return 2;
+      case tbl["VirtualFree"]:    return 3;
+      case tbl["VirtualProtect"]: return 4;
+      case tbl["CreateThread"]:   return 5;
+      case tbl["ExitThread"]:     return 6;
+      case tbl["Sleep"]:          return 7;
+      case tbl["CreateFileA"]:    return 8;
+      case tbl["ReadFile"]:       return 9;
+      case tbl["WriteFile"]:      return 10;
+      case tbl["CloseHandle"]:    return 11;
+      case tbl["CreateProcessA"]: return 12;
+      case tbl["WaitForSingleObject"]: return 13;
+      case tbl["GetLastError"]:   return 14;
+      case tbl["ExitProcess"]:    return 15;
+      case tbl["WSAStartup"]:     return 16;
+      case tbl["WSASocketA"]:     return 17;
+      case tbl["connect"]:        return 18;
+      case tbl["recv"]:           return 19;
+      case tbl["send"]:           return 20;
+      case tbl["closesocket"]:    return 21;
+      case tbl["GetModuleHandleA"]: return 22;
+      case tbl["FreeLibrary"]:    return 23;
+      default:                    return -1;
+    }
+}
+
+int main(void)
+{
+    char     key[MARU_MAX_STR+16];
+    uint8_t  res[MARU2_HASH_LEN];
+    size_t   i, j;
+    int      equ;
+
+    // runtime constexpr calls against the C functions
+    srand(1);
+    for (i=0, equ=1; i<sizeof(key); i++) {
+      for (j=0; j<i; j++) key[j] = (char)(1 + rand() % 255);
+      equ &= maru_ct(std::string_view(key, i), iv_tbl[1]) ==
+             maru_n(key, i, iv_tbl[1]);
+      maru2_n(key, i, iv2_tbl[1], res);
+      maru2_hash h = maru2_ct(std::string_view(key, i), iv2_tbl[1]);
+      for (j=0; j<MARU2_HASH_LEN; j++) equ &= h.b(j) == res[j];
+    }
+    printf ("maru_ct/maru2_ct(0 to %d bytes) : %s\n",
+      (int)sizeof(key) - 1, equ ? "OK" : "FAIL");
+
+    for (i=0, equ=1; i<sizeof(dispatch_tbl)/sizeof(char*); i++) {
+      equ &= dispatch(maru(dispatch_tbl[i], iv_tbl[0])) == (int)i;
+      maru2(dispatch_tbl[i], iv2_tbl[0], res);
+      memcpy(&j, res, sizeof(j));
+      equ &= tbl2.find(j) == i;
+    }
+    equ &= dispatch(maru("NtCreateSection", iv_tbl[0])) == -1;
+    printf ("maru_switch(%d names) : %s\n",
+      (int)tbl.size(), equ ? "OK" : "FAIL");
+    return 0;
+}
+#endif
@@ -0,0 +1,283 @@
+/**
+  Copyright © 2017 Odzhan. All Rights Reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  3. The name of the author may not be used to endorse or promote products
+  derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY AUTHORS "AS IS" AND ANY EXPRESS OR
+  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+  STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE. */
+
+#include <stdlib.h>
+
+#include "midstate.h"
+
+// maru2 is a Davies-Meyer chain, so H after each full block depends only
+// on the iv and the blocks before it. Each entry holds H for one block and
+// points to the entry for the block before it, forming a trie of prefixes.
+// Entries are referenced by serial number so a child of an evicted entry
+// can never match a new one stored in the same slot.
+
+#define MARU2_NIL 0xFFFFFFFF
+
+typedef struct _maru2_node {
+  uint64_t id;          // serial number of this entry
+  uint64_t parent;      // serial number of previous block, 0 for first
+  uint64_t iv;
+  uint64_t h[2];        // H after this block
+  uint32_t next;        // next entry in bucket
+  uint32_t newer, older;
+  uint8_t  blk[MARU2_BLK_LEN];
+} maru2_node;
+
+struct _maru2_cache {
+  maru2_node        *node;
+  uint32_t          *bucket;
+  uint32_t          cap, mask, used;
+  uint32_t          newest, oldest;
+  uint64_t          serial;
+  maru2_cache_stats st;
+};
+
+static uint32_t maru2_cache_slot(maru2_cache *c, uint64_t parent, uint64_t iv, const uint8_t *blk) {
+    uint64_t x, w;
+    int      i;
+
+    x = (parent * 0x9E3779B97F4A7C15ULL) ^ iv;
+    for (i=0; i<MARU2_BLK_LEN; i+=8) {
+      memcpy(&w, &blk[i], 8);
+      x = (x ^ w) * 0xFF51AFD7ED558CCDULL;
+      x ^= x >> 32;
+    }
+    return (uint32_t)x & c->mask;
+}
+
+maru2_cache *maru2_cache_new(size_t max) {
+    maru2_cache *c;
+    size_t      cap;
+    uint32_t    nbk, i;
+
+    // each entry costs a node and at most two buckets
+    cap = max / (sizeof(maru2_node) + 2*sizeof(uint32_t));
+    if (cap == 0 || cap >= MARU2_NIL/2) return NULL;
+
+    for (nbk=1; nbk<cap; nbk<<=1);
+
+    c = calloc(1, sizeof(maru2_cache));
+    if (c == NULL) return NULL;
+
+    c->node   = malloc(cap * sizeof(maru2_node));
+    c->bucket = malloc(nbk * sizeof(uint32_t));
+
+    if (c->node == NULL || c->bucket == NULL) {
+      maru2_cache_free(c);
+      return NULL;
+    }
+    for (i=0; i<nbk; i++) c->bucket[i] = MARU2_NIL;
+
+    c->cap    = (uint32_t)cap;
+    c->mask   = nbk - 1;
+    c->newest = c->oldest = MARU2_NIL;
+    return c;
+}
+
+void maru2_cache_free(maru2_cache *c) {
+    if (c == NULL) return;
+    free(c->node);
+    free(c->bucket);
+    free(c);
+}
+
+static void maru2_lru_unlink(maru2_cache *c, uint32_t i) {
+    maru2_node *n = &c->node[i];
+
+    if (n->newer != MARU2_NIL) c->node[n->newer].older = n->older;
+    else c->newest = n->older;
+    if (n->older != MARU2_NIL) c->node[n->older].newer = n->newer;
+    else c->oldest = n->newer;
+}
+
+static void maru2_lru_push(maru2_cache *c, uint32_t i) {
+    maru2_node *n = &c->node[i];
+
+    n->newer = MARU2_NIL;
+    n->older = c->newest;
+    if (c->newest != MARU2_NIL) c->node[c->newest].newer = i;
+    c->newest = i;
+    if (c->oldest == MARU2_NIL) c->oldest = i;
+}
+
+static uint32_t maru2_cache_find(maru2_cache *c, uint32_t b, uint64_t parent, uint64_t iv, const uint8_t *blk) {
+    uint32_t   i;
+    maru2_node *n;
+
+    for (i=c->bucket[b]; i!=MARU2_NIL; i=n->next) {
+      n = &c->node[i];
+      if (n->parent == parent && n->iv == iv &&
+          memcmp(n->blk, blk, MARU2_BLK_LEN) == 0) break;
+    }
+    return i;
+}
+
+// take a free entry or evict the least recently used one
+static uint32_t maru2_cache_alloc(maru2_cache *c) {
+    uint32_t   i, *p;
+    maru2_node *n;
+
+    if (c->used < c->cap) return c->used++;
+
+    i = c->oldest;
+    n = &c->node[i];
+    maru2_lru_unlink(c, i);
+
+    p = &c->bucket[maru2_cache_slot(c, n->parent, n->iv, n->blk)];
+    while (*p != i) p = &c->node[*p].next;
+    *p = n->next;
+
+    c->st.evictions++;
+    return i;
+}
+
+void maru2_cached(maru2_cache *c, const void *key, size_t len, uint64_t iv, void *out) {
+    const uint8_t *p = (const uint8_t*)key;
+    maru2_ctx     ctx;
+    maru2_node    *n;
+    uint64_t      parent = 0;
+    uint32_t      b, i;
+    size_t        blk, nblk;
+    int           found = 1;
+
+    c->st.calls++;
+    maru2_init(&ctx, iv);
+
+    // every full block is absorbed before the padding
+    nblk = len / MARU2_BLK_LEN;
+
+    for (blk=0; blk<nblk; blk++, p+=MARU2_BLK_LEN) {
+      b = maru2_cache_slot(c, parent, iv, p);
+
+      // once a block is missing, so are the ones after it
+      if (found) {
+        c->st.lookups++;
+        i = maru2_cache_find(c, b, parent, iv, p);
+        if (i != MARU2_NIL) {
+          // resume from cached H
+          n = &c->node[i];
+          ctx.h.q[0] = n->h[0];
+          ctx.h.q[1] = n->h[1];
+          maru2_lru_unlink(c, i);
+          maru2_lru_push(c, i);
+          parent = n->id;
+          c->st.hits++;
+          continue;
+        }
+        found = 0;
+      }
+      c->st.misses++;
+
+      // encrypt H with this block and save result
+      ctx.len = blk * MARU2_BLK_LEN;
+      maru2_update(&ctx, p, MARU2_BLK_LEN);
+
+      i = maru2_cache_alloc(c);
+      n = &c->node[i];
+      n->id     = ++c->serial;
+      n->parent = parent;
+      n->iv     = iv;
+      n->h[0]   = ctx.h.q[0];
+      n->h[1]   = ctx.h.q[1];
+      memcpy(n->blk, p, MARU2_BLK_LEN);
+
+      // link after eviction, which may have changed the bucket
+      n->next = c->bucket[b];
+      c->bucket[b] = i;
+      maru2_lru_push(c, i);
+      parent = n->id;
+    }
+    // absorb remainder and pad
+    ctx.len = nblk * MARU2_BLK_LEN;
+    maru2_update(&ctx, p, len - ctx.len);
+    maru2_final(&ctx, out);
+}
+
+void maru2_cache_stats_get(maru2_cache *c, maru2_cache_stats *st) {
+    *st = c->st;
+    st->entries = c->used;
+}
+
+#ifdef TEST
+
+#include <stdio.h>
+
+const char *api_tbl[]=
+{ "GetProcAddress",
+  "GetOverlappedResult",
+  "_ZNSt7__cxx1112basic_stringIcSt11char_traitsIcESaIcEE6appendEPKc",
+  "_ZNSt7__cxx1112basic_stringIcSt11char_traitsIcESaIcEE6assignEPKc",
+  "_ZNSt7__cxx1112basic_stringIcSt11char_traitsIcESaIcEE7reserveEm",
+  "_ZNSt7__cxx1112basic_stringIcSt11char_traitsIcESaIcEE9_M_appendEPKcm",
+  "_ZNSt7__cxx1112basic_stringIcSt11char_traitsIcESaIcEE10_M_disposeEv",
+  "_ZNSt7__cxx1112basic_stringIcSt11char_traitsIcESaIcEE12_M_constructEmc" };
+
+const uint64_t iv_tbl[]=
+{ 0x15DF1E4BE5E7970F,
+  0x15B6B0E361669B16 };
+
+int main(void) {
+    maru2_cache       *c;
+    maru2_cache_stats st;
+    maru2_ctx         ctx;
+    uint8_t           h[MARU2_HASH_LEN], r[MARU2_HASH_LEN];
+    size_t            max;
+    int               i, j, k, equ;
+
+    // a large cache, then one that holds two entries
+    for (k=0; k<2; k++) {
+      max = k ? 2*(MARU2_BLK_LEN+80) : 1024*1024;
+      c = maru2_cache_new(max);
+      if (c == NULL) {
+        printf ("maru2_cache_new(%zu) failed\n", max);
+        return 1;
+      }
+      for (equ=1, i=0; i<3; i++) {
+        for (j=0; j<sizeof(api_tbl)/sizeof(char*); j++) {
+          maru2_cached(c, api_tbl[j], strlen(api_tbl[j]), iv_tbl[i&1], h);
+
+          maru2_init(&ctx, iv_tbl[i&1]);
+          maru2_update(&ctx, api_tbl[j], strlen(api_tbl[j]));
+          maru2_final(&ctx, r);
+          equ &= memcmp(h, r, MARU2_HASH_LEN)==0;
+        }
+      }
+      maru2_cache_stats_get(c, &st);
+      printf ("maru2_cached(%zu bytes) : %s\n", max, equ ? "OK" : "FAIL");
+      printf ("  calls %llu, lookups %llu, hits %llu (%.1f%%), misses %llu, evictions %llu, entries %llu\n",
+        (unsigned long long)st.calls, (unsigned long long)st.lookups,
+        (unsigned long long)st.hits,
+        st.lookups ? 100.0*st.hits/st.lookups : 0.0,
+        (unsigned long long)st.misses, (unsigned long long)st.evictions,
+        (unsigned long long)st.entries);
+      maru2_cache_free(c);
+    }
+    return 0;
+}
+#endif
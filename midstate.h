@@ -0,0 +1,59 @@
+/**
+  Copyright © 2017 Odzhan. All Rights Reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  3. The name of the author may not be used to endorse or promote products
+  derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY AUTHORS "AS IS" AND ANY EXPRESS OR
+  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+  STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE. */
+
+#ifndef MIDSTATE_H
+#define MIDSTATE_H
+
+#include "maru2.h"
+
+typedef struct _maru2_cache_stats {
+  uint64_t calls;      // calls to maru2_cached
+  uint64_t lookups;    // prefix blocks looked up
+  uint64_t hits;       // prefix blocks found in cache
+  uint64_t misses;     // prefix blocks encrypted and inserted
+  uint64_t evictions;  // entries dropped to stay within budget
+  uint64_t entries;    // entries in cache now
+} maru2_cache_stats;
+
+typedef struct _maru2_cache maru2_cache;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  maru2_cache *maru2_cache_new (size_t);
+  void maru2_cache_free (maru2_cache*);
+  void maru2_cached (maru2_cache*, const void*, size_t, uint64_t, void*);
+  void maru2_cache_stats_get (maru2_cache*, maru2_cache_stats*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
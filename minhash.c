@@ -0,0 +1,368 @@
+/**
+  Copyright © 2017 Odzhan. All Rights Reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  3. The name of the author may not be used to endorse or promote products
+  derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY AUTHORS "AS IS" AND ANY EXPRESS OR
+  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+  STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE. */
+
+// MinHash sketches of sets of strings. Value i of a sketch is the least
+// maru2 hash of the tokens under seed i, and the fraction of values two
+// sketches share estimates the Jaccard similarity of the sets. All seeds
+// of a token are done by maru2_multi_seed, which pads the token and
+// expands its key schedule once, then runs the seeds across SIMD lanes.
+//
+// b-bit sketches keep the low b bits of each value, and the LSH index
+// puts a sketch in one bucket per band of rows, so sets that share any
+// band are candidates.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "minhash.h"
+
+// k seeds from one, each a different permutation
+void maru2_minhash_seeds(uint64_t seed, int k, uint64_t *ivs) {
+    int i;
+
+    for (i=0; i<k; i++) ivs[i] = seed ^ ((uint64_t)(i + 1) * 0x9E3779B97F4A7C15ULL);
+}
+
+// sig is k values, all ones for an empty set
+void maru2_minhash(const char **tokens, size_t n, const uint64_t *ivs, int k, uint64_t *sig) {
+    uint8_t  h[MARU2_MINHASH_MAX][MARU2_HASH_LEN];
+    uint64_t v;
+    size_t   i;
+    int      c, m, j;
+
+    for (j=0; j<k; j++) sig[j] = ~0ULL;
+
+    // h holds MARU2_MINHASH_MAX seeds, so larger k is done in pieces
+    for (c=0; c<k; c+=m) {
+      m = k - c < MARU2_MINHASH_MAX ? k - c : MARU2_MINHASH_MAX;
+      for (i=0; i<n; i++) {
+        maru2_multi_seed(tokens[i], ivs + c, m, h);
+        for (j=0; j<m; j++) {
+          memcpy(&v, h[j], 8);
+          if (v < sig[c + j]) sig[c + j] = v;
+        }
+      }
+    }
+}
+
+// keep the low b bits of each value, packed from bit 0 of out[0].
+// out is (k * b + 7) / 8 bytes.
+void maru2_minhash_bbit(const uint64_t *sig, int k, int b, uint8_t *out) {
+    size_t pos;
+    int    i, j;
+
+    memset(out, 0, ((size_t)k * b + 7) / 8);
+
+    for (i=0, pos=0; i<k; i++) {
+      for (j=0; j<b; j++, pos++) {
+        if ((sig[i] >> j) & 1) out[pos / 8] |= (uint8_t)(1 << (pos % 8));
+      }
+    }
+}
+
+double maru2_minhash_jaccard(const uint64_t *a, const uint64_t *b, int k) {
+    int i, n;
+
+    for (i=0, n=0; i<k; i++) n += a[i] == b[i];
+    return (double)n / k;
+}
+
+// values that differ still match in b bits with chance 2^-b,
+// take that out of the estimate
+double maru2_minhash_jaccard_bbit(const uint8_t *a, const uint8_t *b, int k, int bits) {
+    double c = 1.0 / (double)(1ULL << (bits < 63 ? bits : 63)), p;
+    size_t pos;
+    int    i, j, n, eq;
+
+    for (i=0, n=0, pos=0; i<k; i++) {
+      for (j=0, eq=1; j<bits; j++, pos++)
+        eq &= ((a[pos / 8] ^ b[pos / 8]) >> (pos % 8) & 1) == 0;
+      n += eq;
+    }
+    p = (double)n / k;
+    p = (p - c) / (1 - c);
+    return p < 0 ? 0 : p;
+}
+
+// The index is one chained hash table for all bands. An entry is the
+// hash of a band of the sketch and the id of the set. Buckets double
+// when there are as many entries as buckets.
+typedef struct _maru2_lsh_ent {
+  uint64_t key;
+  uint32_t id;
+  uint32_t next;  // index + 1 of the next entry, 0 ends the chain
+} maru2_lsh_ent;
+
+struct _maru2_lsh {
+  int           bands, rows;
+  uint32_t      *head;
+  size_t        mask;
+  maru2_lsh_ent *ent;
+  size_t        n, cap;
+};
+
+// rows of band b, mixed with b so bands don't share buckets
+static uint64_t maru2_lsh_key(const maru2_lsh *l, const uint64_t *sig, int b) {
+    uint64_t h = (uint64_t)b * 0xD6E8FEB86659FD93ULL;
+    int      i;
+
+    for (i=0; i<l->rows; i++) {
+      h = (h ^ sig[b * l->rows + i]) * 0x9E3779B97F4A7C15ULL;
+      h ^= h >> 32;
+    }
+    return h;
+}
+
+// sketches of bands * rows values
+maru2_lsh *maru2_lsh_new(int bands, int rows) {
+    maru2_lsh *l;
+
+    if (bands < 1 || rows < 1 || bands * rows > MARU2_MINHASH_MAX) return NULL;
+
+    l = (maru2_lsh*)calloc(1, sizeof(maru2_lsh));
+    if (l == NULL) return NULL;
+
+    l->bands = bands;
+    l->rows  = rows;
+    l->mask  = 1023;
+    l->head  = (uint32_t*)calloc(l->mask + 1, sizeof(uint32_t));
+    if (l->head == NULL) {
+      free(l);
+      return NULL;
+    }
+    return l;
+}
+
+void maru2_lsh_free(maru2_lsh *l) {
+    free(l->head);
+    free(l->ent);
+    free(l);
+}
+
+static int maru2_lsh_grow(maru2_lsh *l) {
+    maru2_lsh_ent *e;
+    uint32_t      *head;
+    size_t        i, mask = l->mask * 2 + 1;
+
+    head = (uint32_t*)calloc(mask + 1, sizeof(uint32_t));
+    if (head == NULL) return -1;
+
+    for (i=0; i<l->n; i++) {
+      e = &l->ent[i];
+      e->next = head[e->key & mask];
+      head[e->key & mask] = (uint32_t)(i + 1);
+    }
+    free(l->head);
+    l->head = head;
+    l->mask = mask;
+    return 0;
+}
+
+int maru2_lsh_add(maru2_lsh *l, uint32_t id, const uint64_t *sig) {
+    maru2_lsh_ent *e;
+    size_t        cap;
+    int           b;
+
+    if (l->n + l->bands > l->cap) {
+      cap = l->cap ? l->cap * 2 : 1024;
+      if (cap < l->n + l->bands) cap = l->n + l->bands;
+      e = (maru2_lsh_ent*)realloc(l->ent, cap * sizeof(maru2_lsh_ent));
+      if (e == NULL) return -1;
+      l->ent = e;
+      l->cap = cap;
+    }
+    for (b=0; b<l->bands; b++) {
+      e = &l->ent[l->n];
+      e->key  = maru2_lsh_key(l, sig, b);
+      e->id   = id;
+      e->next = l->head[e->key & l->mask];
+      l->head[e->key & l->mask] = (uint32_t)++l->n;
+    }
+    if (l->n > l->mask) return maru2_lsh_grow(l);
+    return 0;
+}
+
+static int maru2_lsh_cmp(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+
+    return (x > y) - (x < y);
+}
+
+// ids of sets that share a band with sig, each once and in order.
+// returns how many there are, ids has room for max of them.
+size_t maru2_lsh_query(const maru2_lsh *l, const uint64_t *sig, uint32_t *ids, size_t max) {
+    uint32_t *t = NULL, *p, i;
+    size_t   n = 0, cap = 0, j, u;
+    uint64_t key;
+    int      b;
+
+    for (b=0; b<l->bands; b++) {
+      key = maru2_lsh_key(l, sig, b);
+      for (i=l->head[key & l->mask]; i != 0; i=l->ent[i - 1].next) {
+        if (l->ent[i - 1].key != key) continue;
+        if (n == cap) {
+          cap = cap ? cap * 2 : 64;
+          p = (uint32_t*)realloc(t, cap * sizeof(uint32_t));
+          if (p == NULL) break;
+          t = p;
+        }
+        t[n++] = l->ent[i - 1].id;
+      }
+    }
+    if (n == 0) {
+      free(t);
+      return 0;
+    }
+    qsort(t, n, sizeof(uint32_t), maru2_lsh_cmp);
+
+    for (j=0, u=0; j<n; j++) {
+      if (j != 0 && t[j] == t[j - 1]) continue;
+      if (u < max) ids[u] = t[j];
+      u++;
+    }
+    free(t);
+    return u;
+}
+
+#ifdef TEST
+
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+#define K       128
+#define NTOKENS 10000
+#define NSETS   200
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// K calls of maru2 for each token
+static void minhash_naive(const char **tokens, size_t n, const uint64_t *ivs, int k, uint64_t *sig) {
+    uint8_t  h[MARU2_HASH_LEN];
+    uint64_t v;
+    size_t   i;
+    int      j;
+
+    for (j=0; j<k; j++) sig[j] = ~0ULL;
+    for (i=0; i<n; i++) {
+      for (j=0; j<k; j++) {
+        maru2(tokens[i], ivs[j], h);
+        memcpy(&v, h, 8);
+        if (v < sig[j]) sig[j] = v;
+      }
+    }
+}
+
+// set s holds tokens [s * 50, s * 50 + 100), so neighbours share half
+static void set_of(const char **all, int s, const char **set) {
+    int i;
+
+    for (i=0; i<100; i++) set[i] = all[s * 50 + i];
+}
+
+int main(void) {
+    static char   buf[NTOKENS][24];
+    const char    *tok[NTOKENS], *set[100];
+    uint64_t      ivs[K], a[K], b[K], (*sig)[K], *bigv;
+    uint8_t       pa[K], pb[K];
+    uint32_t      ids[16];
+    maru2_lsh     *l;
+    double        t0, t1, t2, j, jb, exact;
+    size_t        n;
+    int           i, ok;
+
+    for (i=0; i<NTOKENS; i++) {
+      snprintf(buf[i], sizeof(buf[i]), "api_%d_%x", i, i * 2654435761u);
+      tok[i] = buf[i];
+    }
+    maru2_minhash_seeds(0x15DF1E4BE5E7970FULL, K, ivs);
+
+    // same sketch as K calls of maru2, and how long each takes
+    t0 = now();
+    minhash_naive(tok, NTOKENS, ivs, K, a);
+    t1 = now();
+    maru2_minhash(tok, NTOKENS, ivs, K, b);
+    t2 = now();
+    ok = memcmp(a, b, sizeof(a)) == 0;
+    printf("maru2_minhash     : %s\n", ok ? "OK" : "FAIL");
+    printf("%d tokens, K=%d : naive %.1f ms, multi seed %.1f ms, %.1fx\n",
+      NTOKENS, K, (t1 - t0) * 1e3, (t2 - t1) * 1e3, (t1 - t0) / (t2 - t1));
+
+    // more seeds than fit in one maru2_multi_seed call
+    n = MARU2_MINHASH_MAX + 100;
+    bigv = malloc(n * 3 * sizeof(uint64_t));
+    maru2_minhash_seeds(0x15DF1E4BE5E7970FULL, (int)n, bigv);
+    minhash_naive(tok, 20, bigv, (int)n, bigv + n);
+    maru2_minhash(tok, 20, bigv, (int)n, bigv + 2 * n);
+    printf("maru2_minhash(k=%d) : %s\n", (int)n,
+      memcmp(bigv + n, bigv + 2 * n, n * sizeof(uint64_t)) == 0 ? "OK" : "FAIL");
+    free(bigv);
+
+    // tokens [0, 6000) and [4000, 10000) share 2000 of 10000
+    exact = 2000.0 / 10000.0;
+    maru2_minhash(tok, 6000, ivs, K, a);
+    maru2_minhash(tok + 4000, 6000, ivs, K, b);
+    j = maru2_minhash_jaccard(a, b, K);
+    maru2_minhash_bbit(a, K, 8, pa);
+    maru2_minhash_bbit(b, K, 8, pb);
+    jb = maru2_minhash_jaccard_bbit(pa, pb, K, 8);
+    // 4 standard deviations of the estimate
+    ok = fabs(j - exact) < 4 * sqrt(exact * (1 - exact) / K);
+    ok &= fabs(jb - exact) < 4 * sqrt(exact * (1 - exact) / K) + 1.0 / 256;
+    printf("jaccard %.3f     : %.3f, 8-bit %.3f %s\n", exact, j, jb, ok ? "OK" : "FAIL");
+
+    // neighbours have jaccard 1/3, 64 bands of 2 rows find them
+    // with chance 1 - (1 - 1/9)^64, sets that share nothing never
+    sig = malloc(sizeof(*sig) * NSETS);
+    l = maru2_lsh_new(64, 2);
+    for (i=0; i<NSETS - 1; i++) {
+      set_of(tok, i, set);
+      maru2_minhash(set, 100, ivs, K, sig[i]);
+      maru2_lsh_add(l, i, sig[i]);
+    }
+    for (i=1, ok=0, n=0; i<NSETS - 2; i++) {
+      size_t m = maru2_lsh_query(l, sig[i], ids, 16), x;
+      int    hit = 0;
+
+      for (x=0; x<m && x<16; x++) hit += ids[x] == (uint32_t)(i - 1) || ids[x] == (uint32_t)(i + 1);
+      ok += hit;
+      n  += m;
+    }
+    printf("lsh               : %d of %d neighbours, %.1f candidates per query %s\n",
+      ok, 2 * (NSETS - 3), (double)n / (NSETS - 3), ok > 2 * (NSETS - 3) * 9 / 10 ? "OK" : "FAIL");
+    maru2_lsh_free(l);
+    free(sig);
+    return 0;
+}
+#endif
@@ -0,0 +1,58 @@
+/**
+  Copyright © 2017 Odzhan. All Rights Reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  3. The name of the author may not be used to endorse or promote products
+  derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY AUTHORS "AS IS" AND ANY EXPRESS OR
+  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+  STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE. */
+
+#ifndef MINHASH_H
+#define MINHASH_H
+
+#include "maru2.h"
+
+#define MARU2_MINHASH_MAX 1024 // seeds hashed at once, most in an LSH index
+
+typedef struct _maru2_lsh maru2_lsh;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  void maru2_minhash_seeds (uint64_t, int, uint64_t*);
+  void maru2_minhash (const char**, size_t, const uint64_t*, int, uint64_t*);
+  void maru2_minhash_bbit (const uint64_t*, int, int, uint8_t*);
+  double maru2_minhash_jaccard (const uint64_t*, const uint64_t*, int);
+  double maru2_minhash_jaccard_bbit (const uint8_t*, const uint8_t*, int, int);
+
+  maru2_lsh *maru2_lsh_new (int, int);
+  void maru2_lsh_free (maru2_lsh*);
+  int maru2_lsh_add (maru2_lsh*, uint32_t, const uint64_t*);
+  size_t maru2_lsh_query (const maru2_lsh*, const uint64_t*, uint32_t*, size_t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,284 @@
+/**
+  Copyright © 2017 Odzhan. All Rights Reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  3. The name of the author may not be used to endorse or promote products
+  derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY AUTHORS "AS IS" AND ANY EXPRESS OR
+  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+  STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE. */
+
+// Consistent placement of keys on nodes. When a node is added or
+// removed, only the keys that must move do, instead of almost all of
+// them as with a hash modulo the number of nodes.
+//
+// Jump hash numbers the nodes 0 to n-1, takes no memory and moves 1/n
+// of the keys when the n-th node is added. Only the last node can be
+// removed. Rendezvous hashing (HRW) scores a key on each node and picks
+// the highest, so any node can be added or removed, for O(n) work per
+// key. The scores of a key are maru2 under the iv of each node, done by
+// maru2_multi_seed across SIMD lanes.
+
+#include <math.h>
+#include <string.h>
+
+#include "place.h"
+
+// Lamping and Veach, "A Fast, Minimal Memory, Consistent Hash Algorithm"
+uint32_t maru2_jump_hash(uint64_t key, uint32_t n) {
+    int64_t b = -1, j = 0;
+
+    while (j < (int64_t)n) {
+      b   = j;
+      key = key * 2862933555777941757ULL + 1;
+      j   = (int64_t)((b + 1) * ((double)(1LL << 31) / (double)((key >> 33) + 1)));
+    }
+    return (uint32_t)b;
+}
+
+// the first 64 bits of the hash start the generator
+static uint32_t maru2_jump_of(const uint8_t *h, uint32_t n) {
+    uint64_t key;
+
+    memcpy(&key, h, 8);
+    return maru2_jump_hash(key, n);
+}
+
+uint32_t maru2_jump(const char *key, uint64_t iv, uint32_t n) {
+    uint8_t h[MARU2_HASH_LEN];
+
+    maru2(key, iv, h);
+    return maru2_jump_of(h, n);
+}
+
+// many keys, hashed with maru2_batch
+void maru2_jump_batch(const char **keys, size_t n, uint64_t iv, uint32_t nodes, uint32_t *out) {
+    uint8_t h[256][MARU2_HASH_LEN];
+    size_t  i, j, cnt;
+
+    for (i=0; i<n; i+=cnt) {
+      cnt = (n - i) < 256 ? n - i : 256;
+      maru2_batch(&keys[i], cnt, iv, h);
+      for (j=0; j<cnt; j++) out[i+j] = maru2_jump_of(h[j], nodes);
+    }
+}
+
+// iv of each node from its name, so it doesn't depend on the order
+void maru2_hrw_nodes(const char **names, int n, uint64_t seed, uint64_t *ivs) {
+    uint8_t h[MARU2_HASH_LEN];
+    int     i;
+
+    for (i=0; i<n; i++) {
+      maru2(names[i], seed, h);
+      memcpy(&ivs[i], h, 8);
+    }
+}
+
+// index of the node with the highest score for key
+int maru2_hrw(const char *key, const uint64_t *nodes, int n) {
+    uint8_t  h[MARU2_HRW_CHUNK][MARU2_HASH_LEN];
+    uint64_t s, best = 0;
+    int      i, j, cnt, sel = -1;
+
+    for (i=0; i<n; i+=cnt) {
+      cnt = (n - i) < MARU2_HRW_CHUNK ? n - i : MARU2_HRW_CHUNK;
+      maru2_multi_seed(key, &nodes[i], cnt, h);
+      for (j=0; j<cnt; j++) {
+        memcpy(&s, h[j], 8);
+        if (sel < 0 || s > best) {
+          best = s;
+          sel  = i + j;
+        }
+      }
+    }
+    return sel;
+}
+
+// Schindelhauer and Schomaker: score w / -ln(u) for u uniform in (0,1)
+// takes a share of the keys in proportion to w
+int maru2_hrw_weighted(const char *key, const uint64_t *nodes, const double *w, int n) {
+    uint8_t  h[MARU2_HRW_CHUNK][MARU2_HASH_LEN];
+    uint64_t s;
+    double   u, score, best = 0;
+    int      i, j, cnt, sel = -1;
+
+    for (i=0; i<n; i+=cnt) {
+      cnt = (n - i) < MARU2_HRW_CHUNK ? n - i : MARU2_HRW_CHUNK;
+      maru2_multi_seed(key, &nodes[i], cnt, h);
+      for (j=0; j<cnt; j++) {
+        if (w[i+j] <= 0) continue;
+        memcpy(&s, h[j], 8);
+        u = ((s >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+        score = w[i+j] / -log(u);
+        if (sel < 0 || score > best) {
+          best = score;
+          sel  = i + j;
+        }
+      }
+    }
+    return sel;
+}
+
+#ifdef TEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// moved keys within 5 standard deviations of n * p
+static int place_moved_ok(size_t moved, size_t n, double p) {
+    return fabs(moved - n * p) < 5 * sqrt(n * p * (1 - p)) + 1;
+}
+
+// most keys on one node, over the mean
+static double place_skew(const uint32_t *p, size_t n, int nodes) {
+    size_t *cnt = calloc(nodes, sizeof(size_t)), i, max = 0;
+
+    for (i=0; i<n; i++) cnt[p[i]]++;
+    for (i=0; i<(size_t)nodes; i++) if (cnt[i] > max) max = cnt[i];
+    free(cnt);
+    return (double)max * nodes / n;
+}
+
+// jump from n to n+1 nodes: keys move only to node n
+static int jump_bench(const char **keys, size_t n, int nodes) {
+    uint32_t *a = malloc(n * sizeof(uint32_t)), *b = malloc(n * sizeof(uint32_t));
+    size_t   i, moved = 0;
+    double   t0, t1;
+    int      ok = 1;
+
+    t0 = now();
+    maru2_jump_batch(keys, n, 0, nodes, a);
+    t1 = now();
+    maru2_jump_batch(keys, n, 0, nodes + 1, b);
+
+    for (i=0; i<n; i++) {
+      if (a[i] == b[i]) continue;
+      ok &= b[i] == (uint32_t)nodes;
+      moved++;
+    }
+    ok &= place_moved_ok(moved, n, 1.0 / (nodes + 1));
+    printf("jump %4d nodes   : %5.1f ns/key, max load %.2f, add moves %.4f (ideal %.4f) %s\n",
+      nodes, (t1 - t0) * 1e9 / n, place_skew(a, n, nodes),
+      (double)moved / n, 1.0 / (nodes + 1), ok ? "OK" : "FAIL");
+    free(a);
+    free(b);
+    return ok;
+}
+
+// hrw with a node added at the end, and with node n/2 removed
+static int hrw_bench(const char **keys, size_t n, int nodes) {
+    uint32_t *a = malloc(n * sizeof(uint32_t)), *b = malloc(n * sizeof(uint32_t));
+    uint64_t *ivs = malloc((nodes + 1) * sizeof(uint64_t)), *less;
+    char     (*name)[16] = malloc((nodes + 1) * sizeof(name[0]));
+    const char **names = malloc((nodes + 1) * sizeof(char*));
+    size_t   i, add = 0, rem = 0;
+    double   t0, t1;
+    int      j, ok = 1, gone = nodes / 2;
+
+    for (j=0; j<=nodes; j++) {
+      snprintf(name[j], sizeof(name[j]), "node%d", j);
+      names[j] = name[j];
+    }
+    maru2_hrw_nodes(names, nodes + 1, 0, ivs);
+
+    t0 = now();
+    for (i=0; i<n; i++) a[i] = maru2_hrw(keys[i], ivs, nodes);
+    t1 = now();
+    for (i=0; i<n; i++) b[i] = maru2_hrw(keys[i], ivs, nodes + 1);
+    for (i=0; i<n; i++) {
+      if (a[i] == b[i]) continue;
+      ok &= b[i] == (uint32_t)nodes;
+      add++;
+    }
+    // without node gone, only its keys move
+    less = malloc(nodes * sizeof(uint64_t));
+    memcpy(less, ivs, gone * sizeof(uint64_t));
+    memcpy(less + gone, ivs + gone + 1, (nodes - gone - 1) * sizeof(uint64_t));
+    for (i=0; i<n; i++) {
+      if (less[maru2_hrw(keys[i], less, nodes - 1)] == ivs[a[i]]) continue;
+      ok &= a[i] == (uint32_t)gone;
+      rem++;
+    }
+    ok &= place_moved_ok(add, n, 1.0 / (nodes + 1));
+    ok &= place_moved_ok(rem, n, 1.0 / nodes);
+    printf("hrw  %4d nodes   : %5.1f ns/key, max load %.2f, add moves %.4f, remove moves %.4f (ideal %.4f) %s\n",
+      nodes, (t1 - t0) * 1e9 / n, place_skew(a, n, nodes),
+      (double)add / n, (double)rem / n, 1.0 / nodes, ok ? "OK" : "FAIL");
+    free(a); free(b); free(ivs); free(less); free(name); free(names);
+    return ok;
+}
+
+// node 0 has twice the weight of the others
+static int weighted_test(const char **keys, size_t n) {
+    uint64_t ivs[8];
+    double   w[8] = { 2, 1, 1, 1, 1, 1, 1, 1 };
+    size_t   cnt[8] = { 0 }, i;
+    int      ok;
+
+    for (i=0; i<8; i++) ivs[i] = i + 1;
+    // 2/9 of the keys on node 0, 1/9 on each other
+    for (i=0; i<n; i++) cnt[maru2_hrw_weighted(keys[i], ivs, w, 8)]++;
+
+    ok = place_moved_ok(cnt[0], n, 2.0 / 9);
+    for (i=1; i<8; i++) ok &= place_moved_ok(cnt[i], n, 1.0 / 9);
+    printf("hrw weighted      : node 0 has %.3f of keys (ideal %.3f) %s\n",
+      (double)cnt[0] / n, 2.0 / 9, ok ? "OK" : "FAIL");
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    static const int nodes[] = { 16, 64, 256, 1024 };
+    const char **keys;
+    char       (*buf)[32];
+    size_t     n = 1000000, i, hn;
+    int        j, ok = 1;
+
+    if (argc > 1) n = strtoul(argv[1], NULL, 0);
+
+    buf  = malloc(n * sizeof(buf[0]));
+    keys = malloc(n * sizeof(char*));
+    for (i=0; i<n; i++) {
+      snprintf(buf[i], sizeof(buf[i]), "sym_%zu_%x", i, (unsigned)(i * 2654435761u));
+      keys[i] = buf[i];
+    }
+    for (j=0; j<4; j++) ok &= jump_bench(keys, n, nodes[j]);
+
+    // hrw is O(nodes) per key, so fewer keys for more nodes
+    for (j=0; j<4; j++) {
+      hn = (size_t)(1 << 24) / nodes[j];
+      ok &= hrw_bench(keys, hn < n ? hn : n, nodes[j]);
+    }
+    ok &= weighted_test(keys, n < 200000 ? n : 200000);
+
+    free(buf);
+    free(keys);
+    return !ok;
+}
+#endif
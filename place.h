@@ -0,0 +1,53 @@
+/**
+  Copyright © 2017 Odzhan. All Rights Reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  3. The name of the author may not be used to endorse or promote products
+  derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY AUTHORS "AS IS" AND ANY EXPRESS OR
+  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+  STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE. */
+
+#ifndef PLACE_H
+#define PLACE_H
+
+#include "maru2.h"
+
+#define MARU2_HRW_CHUNK 256 // nodes scored by one maru2_multi_seed call
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  uint32_t maru2_jump_hash (uint64_t, uint32_t);
+  uint32_t maru2_jump (const char*, uint64_t, uint32_t);
+  void maru2_jump_batch (const char**, size_t, uint64_t, uint32_t, uint32_t*);
+
+  void maru2_hrw_nodes (const char**, int, uint64_t, uint64_t*);
+  int maru2_hrw (const char*, const uint64_t*, int);
+  int maru2_hrw_weighted (const char*, const uint64_t*, const double*, int);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
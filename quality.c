@@ -0,0 +1,510 @@
+/**
+  Copyright © 2017 Odzhan. All Rights Reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  3. The name of the author may not be used to endorse or promote products
+  derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY AUTHORS "AS IS" AND ANY EXPRESS OR
+  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+  STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE. */
+
+// Quality tests for maru and maru2.
+//
+// Runs in process what used to need dieharder: avalanche and bit
+// independence of input and seed bits, chi-square of 16-bit windows
+// and collisions of 32-bit truncations over sparse, cyclic, prefix
+// and seed keysets. Keys are made from their index, so the work is
+// split over all cores. Build with -DCHASKEY to test the Chaskey
+// version of maru2. Exits with 1 if any test fails.
+//
+// ./quality [-q] [-t threads]
+//
+//   -q  quick run with a tenth of the samples
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#ifndef CHASKEY
+#include "maru.h"
+#endif
+#include "maru2.h"
+
+#ifndef CHASKEY
+#define QA_CIPHER "speck"
+#else
+#define QA_CIPHER "chaskey"
+#endif
+
+#define QA_Z      6.0        // largest deviation passed, in standard deviations
+#define QA_KEYS   (1 << 22)  // keys in the larger keysets
+#define QA_MAX    MARU2_MAX_STR
+
+typedef struct _qa_fn {
+  const char *name;
+  int        bits;    // output bits
+  void       (*hash)(const void *key, size_t len, uint64_t seed, uint64_t *out);
+} qa_fn;
+
+#ifndef CHASKEY
+static void qa_maru(const void *key, size_t len, uint64_t seed, uint64_t *out) {
+    out[0] = maru_n(key, len, seed);
+    out[1] = 0;
+}
+#endif
+
+static void qa_maru2(const void *key, size_t len, uint64_t seed, uint64_t *out) {
+    maru2_n(key, len, seed, out);
+}
+
+static const qa_fn qa_tbl[] = {
+#ifndef CHASKEY
+  { "maru",  64,  qa_maru  },
+#endif
+  { "maru2", 128, qa_maru2 },
+};
+
+static int qa_threads, qa_quick, qa_tests, qa_failed;
+
+static uint64_t qa_mix(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+// fill len bytes from stream x
+static void qa_fill(uint8_t *p, size_t len, uint64_t x) {
+    uint64_t r;
+    size_t   i;
+
+    for (i=0; i<len; i+=8) {
+      r = qa_mix(x + i);
+      memcpy(p + i, &r, (len - i < 8) ? len - i : 8);
+    }
+}
+
+static double qa_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void qa_result(const qa_fn *f, const char *test, int ok, const char *fmt, double a, double b) {
+    printf("%-6s %-28s : ", f->name, test);
+    printf(fmt, a, b);
+    printf(" : %s\n", ok ? "OK" : "FAIL");
+    fflush(stdout);
+    qa_tests++;
+    qa_failed += !ok;
+}
+
+// work on [lo, hi) as thread t
+typedef void (*qa_work)(void *arg, int t, uint64_t lo, uint64_t hi);
+
+typedef struct _qa_thread {
+  pthread_t id;
+  qa_work   fn;
+  void      *arg;
+  int       t;
+  uint64_t  lo, hi;
+} qa_thread;
+
+static void *qa_thread_main(void *arg) {
+    qa_thread *q = (qa_thread*)arg;
+
+    q->fn(q->arg, q->t, q->lo, q->hi);
+    return NULL;
+}
+
+// split n items over all threads, this one takes the last range
+static void qa_parallel(qa_work fn, void *arg, uint64_t n) {
+    qa_thread q[256];
+    int       i, nt = qa_threads;
+
+    for (i=0; i<nt; i++) {
+      q[i].fn  = fn;
+      q[i].arg = arg;
+      q[i].t   = i;
+      q[i].lo  = n * i / nt;
+      q[i].hi  = n * (i + 1) / nt;
+      if (i != nt - 1 && pthread_create(&q[i].id, NULL, qa_thread_main, &q[i]) != 0) {
+        // run it here instead
+        q[i].id = pthread_self();
+        qa_thread_main(&q[i]);
+      }
+    }
+    qa_thread_main(&q[nt - 1]);
+    for (i=0; i<nt-1; i++) {
+      if (!pthread_equal(q[i].id, pthread_self())) pthread_join(q[i].id, NULL);
+    }
+}
+
+// avalanche: flip each input bit of random keys, count flips of each
+// output bit. bic also counts pairs of output bits flipping together.
+typedef struct _qa_aval {
+  const qa_fn *f;
+  size_t      len;     // key bytes
+  int         seed;    // flip seed bits instead of key bits
+  int         bic;
+  int         in, out; // bits
+  uint32_t    *cnt;    // per thread
+  size_t      ncnt;
+} qa_aval;
+
+static void qa_aval_work(void *arg, int t, uint64_t lo, uint64_t hi) {
+    qa_aval  *a = (qa_aval*)arg;
+    uint32_t *c = a->cnt + a->ncnt * t, *r;
+    uint8_t  key[QA_MAX];
+    uint64_t h[2], g[2], d, e, s, seed;
+    int      i, j, k, w;
+
+    for (s=lo; s<hi; s++) {
+      qa_fill(key, a->len, s * 0x100000001ULL + a->len);
+      seed = qa_mix(~s);
+      a->f->hash(key, a->len, seed, h);
+
+      for (i=0; i<a->in; i++) {
+        if (a->seed) {
+          a->f->hash(key, a->len, seed ^ (1ULL << i), g);
+        } else {
+          key[i/8] ^= 1 << (i%8);
+          a->f->hash(key, a->len, seed, g);
+          key[i/8] ^= 1 << (i%8);
+        }
+        if (!a->bic) {
+          r = c + (size_t)i * a->out;
+          for (w=0; w<a->out/64; w++) {
+            for (d = h[w] ^ g[w]; d != 0; d &= d - 1)
+              r[w*64 + __builtin_ctzll(d)]++;
+          }
+          continue;
+        }
+        // pairs of the first 64 output bits
+        r = c + (size_t)i * 64 * 64;
+        for (d = h[0] ^ g[0]; d != 0; d &= d - 1) {
+          j = __builtin_ctzll(d);
+          for (e = d & (d - 1); e != 0; e &= e - 1) {
+            k = __builtin_ctzll(e);
+            r[j*64 + k]++;
+          }
+        }
+      }
+    }
+}
+
+static void qa_avalanche(const qa_fn *f, size_t len, int seed, int bic, uint64_t n) {
+    qa_aval  a;
+    uint32_t *c;
+    double   z, worst = 0, bias = 0, m, sd;
+    size_t   i;
+    int      t, j, k;
+    char     name[64];
+
+    a.f    = f;
+    a.len  = len;
+    a.seed = seed;
+    a.bic  = bic;
+    a.in   = seed ? 64 : (int)len * 8;
+    a.out  = f->bits;
+    a.ncnt = bic ? (size_t)a.in * 64 * 64 : (size_t)a.in * a.out;
+    a.cnt  = calloc(a.ncnt * qa_threads, sizeof(uint32_t));
+    if (a.cnt == NULL) {
+      printf("out of memory\n");
+      exit(1);
+    }
+    qa_parallel(qa_aval_work, &a, n);
+
+    // sum threads into the first
+    for (t=1, c=a.cnt; t<qa_threads; t++) {
+      for (i=0; i<a.ncnt; i++) c[i] += a.cnt[a.ncnt * t + i];
+    }
+    if (!bic) {
+      m  = n / 2.0;
+      sd = sqrt(n) / 2;
+      for (i=0; i<a.ncnt; i++) {
+        z = fabs(c[i] - m) / sd;
+        if (z > worst) worst = z, bias = fabs(c[i] - m) / n * 2;
+      }
+      snprintf(name, sizeof(name), "%s %zu byte%s", seed ? "seed avalanche," : "avalanche",
+        len, len == 1 ? "" : "s");
+      qa_result(f, name, worst < QA_Z, "worst bias %5.3f%%, z %4.2f", bias * 100, worst);
+    } else {
+      // both bits flip a quarter of the time
+      m  = n / 4.0;
+      sd = sqrt(n * 3.0 / 16);
+      for (i=0; i<(size_t)a.in; i++) {
+        for (j=0; j<64; j++) {
+          for (k=j+1; k<64; k++) {
+            z = fabs(c[(i*64 + j)*64 + k] - m) / sd;
+            if (z > worst) worst = z, bias = fabs(c[(i*64 + j)*64 + k] - m) / n * 4;
+          }
+        }
+      }
+      snprintf(name, sizeof(name), "bit independence %zu bytes", len);
+      qa_result(f, name, worst < QA_Z, "worst bias %5.3f%%, z %4.2f", bias * 100, worst);
+    }
+    free(a.cnt);
+}
+
+// keysets, each key is made from its index
+enum { QA_TEXT, QA_SPARSE, QA_CYCLIC, QA_PREFIX, QA_SEEDS };
+
+typedef struct _qa_set {
+  const qa_fn *f;
+  int         set;
+  uint64_t    n;
+  uint64_t    (*h)[2];
+} qa_set;
+
+static uint64_t qa_choose(int n, int k) {
+    uint64_t c = 1;
+    int      i;
+
+    if (k > n) return 0;
+    for (i=0; i<k; i++) c = c * (n - i) / (i + 1);
+    return c;
+}
+
+// i-th set of k bit positions, in colex order
+static void qa_unrank(uint64_t i, int k, int *pos) {
+    int j, x;
+
+    for (j=k; j>0; j--) {
+      // largest x with C(x, j) <= i
+      for (x=j-1; qa_choose(x + 1, j) <= i; x++);
+      pos[j-1] = x;
+      i -= qa_choose(x, j);
+    }
+}
+
+static uint64_t qa_sparse_n(void) {
+    // 16-byte keys with up to 3 bits set
+    return 1 + 128 + 128*127/2 + 128ULL*127*126/6;
+}
+
+static size_t qa_key(int set, uint64_t i, uint8_t *key, uint64_t *seed) {
+    uint32_t c;
+    uint64_t x;
+    int      pos[3], k, j;
+
+    *seed = 0x15DF1E4BE5E7970FULL;
+
+    switch (set) {
+      case QA_TEXT:
+        return (size_t)snprintf((char*)key, QA_MAX, "sym_%llu", (unsigned long long)i);
+      case QA_SPARSE:
+        memset(key, 0, 16);
+        if (i == 0) return 16;
+        i--;
+        for (k=1; k<3; k++) {
+          x = (k == 1) ? 128 : 128*127/2;
+          if (i < x) break;
+          i -= x;
+        }
+        qa_unrank(i, k, pos);
+        for (j=0; j<k; j++) key[pos[j]/8] |= 1 << (pos[j]%8);
+        return 16;
+      case QA_CYCLIC:
+        // odd multiplier, so cycles are all different
+        c = (uint32_t)i * 0x9E3779B1u;
+        for (j=0; j<32; j+=4) memcpy(key + j, &c, 4);
+        return 32;
+      case QA_PREFIX:
+        qa_fill(key, 56, 0x5EED);
+        memcpy(key + 56, &i, 8);
+        return 64;
+      default:
+        memcpy(key, "maru", 4);
+        *seed = i;
+        return 4;
+    }
+}
+
+static void qa_set_work(void *arg, int t, uint64_t lo, uint64_t hi) {
+    qa_set   *s = (qa_set*)arg;
+    uint8_t  key[QA_MAX];
+    uint64_t i, seed;
+    size_t   len;
+
+    (void)t;
+    for (i=lo; i<hi; i++) {
+      len = qa_key(s->set, i, key, &seed);
+      s->f->hash(key, len, seed, s->h[i]);
+    }
+}
+
+// LSD radix sort on the low 16*passes bits
+static void qa_sort(uint64_t *a, uint64_t *tmp, size_t n, int passes) {
+    static size_t c[1 << 16];
+    uint64_t      *t;
+    size_t        i, sum, x;
+    int           p;
+
+    for (p=0; p<passes; p++) {
+      memset(c, 0, sizeof(c));
+      for (i=0; i<n; i++) c[(a[i] >> (p*16)) & 0xFFFF]++;
+      for (i=0, sum=0; i<(1 << 16); i++) x = c[i], c[i] = sum, sum += x;
+      for (i=0; i<n; i++) tmp[c[(a[i] >> (p*16)) & 0xFFFF]++] = a[i];
+      t = a, a = tmp, tmp = t;
+    }
+    // an odd number of passes leaves the result in tmp
+    if (passes & 1) memcpy(tmp, a, n * sizeof(uint64_t));
+}
+
+static uint64_t qa_dups(const uint64_t *a, size_t n) {
+    uint64_t d = 0;
+    size_t   i;
+
+    for (i=1; i<n; i++) d += a[i] == a[i-1];
+    return d;
+}
+
+static void qa_keyset(const qa_fn *f, int set, const char *name, uint64_t n) {
+    qa_set   s;
+    uint64_t *a, *tmp, d32[2], d64, w, lo, hi;
+    uint32_t *cnt;
+    double   e, chi, z, worst = 0;
+    size_t   i;
+    int      ok, k;
+    char     test[64];
+
+    s.f   = f;
+    s.set = set;
+    s.n   = n;
+    s.h   = malloc(n * sizeof(s.h[0]));
+    a     = malloc(n * sizeof(uint64_t));
+    tmp   = malloc(n * sizeof(uint64_t));
+    cnt   = malloc((1 << 16) * sizeof(uint32_t));
+    if (s.h == NULL || a == NULL || tmp == NULL || cnt == NULL) {
+      printf("out of memory\n");
+      exit(1);
+    }
+    qa_parallel(qa_set_work, &s, n);
+
+    // chi-square of each 16-bit window
+    e = n / 65536.0;
+    for (w=0; w<(uint64_t)f->bits; w+=16) {
+      memset(cnt, 0, (1 << 16) * sizeof(uint32_t));
+      for (i=0; i<n; i++) cnt[(s.h[i][w/64] >> (w%64)) & 0xFFFF]++;
+      for (i=0, chi=0; i<(1 << 16); i++) chi += (cnt[i] - e) * (cnt[i] - e) / e;
+      z = fabs(chi - 65535) / sqrt(2 * 65535.0);
+      if (z > worst) worst = z;
+    }
+    snprintf(test, sizeof(test), "%s, chi-square", name);
+    qa_result(f, test, worst < QA_Z, "%.0f keys, worst z %4.2f", (double)n, worst);
+
+    // lowest and highest 32 bits, then the first 64
+    for (k=0; k<2; k++) {
+      for (i=0; i<n; i++) {
+        lo = s.h[i][0];
+        hi = s.h[i][f->bits/64 - 1];
+        a[i] = (k == 0) ? (uint32_t)lo : hi >> 32;
+      }
+      qa_sort(a, tmp, n, 2);
+      d32[k] = qa_dups(a, n);
+    }
+    for (i=0; i<n; i++) a[i] = s.h[i][0];
+    qa_sort(a, tmp, n, 4);
+    d64 = qa_dups(a, n);
+
+    e  = (double)n * (n - 1) / 2 / 4294967296.0;
+    ok = d64 == 0;
+    for (k=0; k<2; k++) ok &= d32[k] <= e + QA_Z * sqrt(e) + 1;
+
+    snprintf(test, sizeof(test), "%s, collisions", name);
+    qa_result(f, test, ok, "32-bit %.0f, expected %.0f", (double)(d32[0] > d32[1] ? d32[0] : d32[1]), e);
+
+    free(cnt);
+    free(tmp);
+    free(a);
+    free(s.h);
+}
+
+static void qa_speed(const qa_fn *f) {
+    uint8_t  key[16];
+    uint64_t h[2], x = 0;
+    double   t0, t1;
+    int      i, n = qa_quick ? 100000 : 1000000;
+
+    qa_fill(key, sizeof(key), 1);
+    t0 = qa_now();
+    for (i=0; i<n; i++) {
+      key[0] = (uint8_t)i;
+      f->hash(key, sizeof(key), 0, h);
+      x ^= h[0];
+    }
+    t1 = qa_now();
+    printf("%-6s %-28s : %.1f ns per hash (%llx)\n", f->name, "speed, 16 bytes",
+      (t1 - t0) * 1e9 / n, (unsigned long long)(x & 0xFF));
+}
+
+int main(int argc, char *argv[]) {
+    static const size_t len_tbl[] = { 1, 2, 4, 8, 16, 32, 64 };
+    const qa_fn *f;
+    uint64_t    n, div;
+    size_t      i, j;
+    double      t0;
+
+    qa_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    for (i=1; i<(size_t)argc; i++) {
+      if (strcmp(argv[i], "-q") == 0) qa_quick = 1;
+      else if (strcmp(argv[i], "-t") == 0 && i + 1 < (size_t)argc) qa_threads = atoi(argv[++i]);
+      else {
+        printf("usage: %s [-q] [-t threads]\n", argv[0]);
+        return 1;
+      }
+    }
+    if (qa_threads < 1) qa_threads = 1;
+    if (qa_threads > 256) qa_threads = 256;
+    div = qa_quick ? 10 : 1;
+
+    printf("maru quality, %s, %d thread(s)%s\n", QA_CIPHER, qa_threads, qa_quick ? ", quick" : "");
+    t0 = qa_now();
+
+    for (i=0; i<sizeof(qa_tbl)/sizeof(qa_tbl[0]); i++) {
+      f = &qa_tbl[i];
+
+      // fewer samples for longer keys, they have more bits to flip
+      for (j=0; j<sizeof(len_tbl)/sizeof(len_tbl[0]); j++) {
+        n = len_tbl[j] <= 16 ? 200000 : 2000000 / len_tbl[j];
+        qa_avalanche(f, len_tbl[j], 0, 0, n / div);
+      }
+      qa_avalanche(f, 16, 1, 0, 200000 / div);
+      qa_avalanche(f, 8, 0, 1, 20000 / div);
+
+      qa_keyset(f, QA_TEXT,   "text keys",        QA_KEYS / div);
+      qa_keyset(f, QA_SPARSE, "sparse 16 bytes",  qa_sparse_n());
+      qa_keyset(f, QA_CYCLIC, "cyclic 4 of 32",   QA_KEYS / div);
+      qa_keyset(f, QA_PREFIX, "prefix 56 of 64",  QA_KEYS / div);
+      qa_keyset(f, QA_SEEDS,  "one key, seeds",   QA_KEYS / div);
+      qa_speed(f);
+    }
+    printf("%d tests, %d failed, %.1f seconds\n", qa_tests, qa_failed, qa_now() - t0);
+    return qa_failed != 0;
+}
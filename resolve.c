@@ -0,0 +1,571 @@
+/**
+  Copyright © 2017 Odzhan. All Rights Reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  3. The name of the author may not be used to endorse or promote products
+  derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY AUTHORS "AS IS" AND ANY EXPRESS OR
+  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+  STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE. */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/auxv.h>
+
+#include "resolve.h"
+
+// names hashed per call to the batch API
+#define MARU_RESOLVE_BATCH 256
+
+#if __ELF_NATIVE_CLASS == 64
+#define MARU_ELFCLASS ELFCLASS64
+#define MARU_ST_BIND  ELF64_ST_BIND
+#define MARU_ST_TYPE  ELF64_ST_TYPE
+#else
+#define MARU_ELFCLASS ELFCLASS32
+#define MARU_ST_BIND  ELF32_ST_BIND
+#define MARU_ST_TYPE  ELF32_ST_TYPE
+#endif
+
+// glibc passes hwcap to IFUNC resolvers, x86 ones ignore it
+typedef ElfW(Addr) (*maru_ifunc)(unsigned long);
+
+typedef struct _maru_dyn {
+  const ElfW(Sym)  *sym;     // DT_SYMTAB
+  const char       *str;     // DT_STRTAB
+  size_t           strsz;    // DT_STRSZ
+  const uint32_t   *gnuhash; // DT_GNU_HASH
+  const uint32_t   *hash;    // DT_HASH
+  const ElfW(Half) *versym;  // DT_VERSYM
+  size_t           nsym;
+  const uint8_t    *end;     // end of a mapped file, NULL in memory
+} maru_dyn;
+
+typedef struct _maru_ent {
+  uint64_t h;
+  uint32_t i;
+} maru_ent;
+
+// are len bytes at p inside the file, always true in memory
+static int maru_dyn_in(const maru_dyn *d, const void *p, uint64_t len) {
+    const uint8_t *b = p;
+
+    if (d->end == NULL) return 1;
+    return b != NULL && b <= d->end && len <= (uint64_t)(d->end - b);
+}
+
+// number of symbols covered by DT_GNU_HASH: last index in any chain, plus one
+static size_t gnu_hash_count(const maru_dyn *d) {
+    const uint32_t *gh = d->gnuhash, *bucket, *chain;
+    uint32_t       nbucket, symoff, max, i;
+    uint64_t       words;
+
+    if (!maru_dyn_in(d, gh, 16)) return 0;
+
+    nbucket = gh[0];
+    symoff  = gh[1];
+    words   = 4 + (uint64_t)gh[2] * (sizeof(ElfW(Addr)) / 4);
+    if (!maru_dyn_in(d, gh, (words + nbucket) * 4)) return 0;
+
+    bucket  = gh + words;
+    chain   = bucket + nbucket;
+
+    for (max=0, i=0; i<nbucket; i++)
+      if (bucket[i] > max) max = bucket[i];
+
+    if (max < symoff) return symoff;
+
+    // walk the chain to the entry with the end bit set
+    for (;;) {
+      if (!maru_dyn_in(d, chain, ((uint64_t)(max - symoff) + 1) * 4)) return 0;
+      if (chain[max - symoff] & 1) break;
+      max++;
+    }
+    return (size_t)max + 1;
+}
+
+// read the dynamic section, conv turns an address into a pointer
+// and end limits reads to a mapped file
+static int maru_dyn_parse(maru_dyn *d, const ElfW(Dyn) *dyn,
+  const void *(*conv)(void*, ElfW(Addr)), void *arg, const void *end)
+{
+    memset(d, 0, sizeof(maru_dyn));
+    d->end = end;
+
+    for (; maru_dyn_in(d, dyn, sizeof(ElfW(Dyn))) && dyn->d_tag != DT_NULL; dyn++) {
+      switch (dyn->d_tag) {
+        case DT_SYMTAB:
+          d->sym = conv(arg, dyn->d_un.d_ptr);
+          break;
+        case DT_STRTAB:
+          d->str = conv(arg, dyn->d_un.d_ptr);
+          break;
+        case DT_STRSZ:
+          d->strsz = dyn->d_un.d_val;
+          break;
+        case DT_GNU_HASH:
+          d->gnuhash = conv(arg, dyn->d_un.d_ptr);
+          break;
+        case DT_HASH:
+          d->hash = conv(arg, dyn->d_un.d_ptr);
+          break;
+        case DT_VERSYM:
+          d->versym = conv(arg, dyn->d_un.d_ptr);
+          break;
+      }
+    }
+    if (d->sym == NULL || d->str == NULL) return 0;
+
+    // prefer DT_GNU_HASH, DT_HASH holds the count in nchain
+    if (d->gnuhash != NULL) {
+      d->nsym = gnu_hash_count(d);
+    } else if (d->hash != NULL && maru_dyn_in(d, d->hash, 8)) {
+      d->nsym = d->hash[1];
+    }
+    return 1;
+}
+
+static int maru_ent_cmp(const void *a, const void *b) {
+    const maru_ent *x = a, *y = b;
+
+    if (x->h != y->h) return x->h < y->h ? -1 : 1;
+    return x->i < y->i ? -1 : (x->i > y->i);
+}
+
+// hash exported names of d and sort them
+static int maru_resolver_build(maru_resolver *r, maru_dyn *d) {
+    const char *name[MARU_RESOLVE_BATCH];
+    uint64_t   h[MARU_RESOLVE_BATCH];
+    uint8_t    h2[MARU_RESOLVE_BATCH][MARU2_HASH_LEN];
+    maru_ent   *e;
+    size_t     i, j, n, cnt, len;
+    const ElfW(Sym) *s;
+
+    r->sym = d->sym;
+    r->str = d->str;
+
+    e = malloc((d->nsym + 1) * sizeof(maru_ent));
+    if (e == NULL) return 0;
+
+    for (cnt=0, n=0, i=1; i<=d->nsym; i++) {
+      if (i < d->nsym) {
+        s = &d->sym[i];
+        // skip locals, imports and hidden versions
+        if (s->st_name == 0 || s->st_shndx == SHN_UNDEF) continue;
+        if (MARU_ST_BIND(s->st_info) == STB_LOCAL) continue;
+        if (d->strsz != 0 && s->st_name >= d->strsz) continue;
+        if (d->versym != NULL && (d->versym[i] & 0x8000)) continue;
+
+        name[n] = d->str + s->st_name;
+        e[cnt + n].i = (uint32_t)i;
+        n++;
+      }
+      // hash a full batch, or what is left
+      if (n == MARU_RESOLVE_BATCH || (i == d->nsym && n != 0)) {
+        if (r->alg == MARU_ALG_MARU) {
+          maru_batch(name, n, r->iv, h);
+        } else {
+          maru2_batch(name, n, r->iv, h2);
+          for (j=0; j<n; j++) memcpy(&h[j], h2[j], 8);
+        }
+        for (j=0; j<n; j++) e[cnt + j].h = h[j];
+        cnt += n;
+        n = 0;
+      }
+    }
+    qsort(e, cnt, sizeof(maru_ent), maru_ent_cmp);
+
+    // hashes are searched alone, so keep them apart and cache aligned
+    len = (cnt * sizeof(uint64_t) + 63) & ~(size_t)63;
+    r->hash = aligned_alloc(64, len ? len : 64);
+    r->idx  = malloc((cnt ? cnt : 1) * sizeof(uint32_t));
+
+    // a loaded module has its addresses fixed now
+    if (r->map == NULL) r->addr = malloc((cnt ? cnt : 1) * sizeof(uintptr_t));
+
+    if (r->hash == NULL || r->idx == NULL || (r->map == NULL && r->addr == NULL)) {
+      free(e);
+      return 0;
+    }
+    for (i=0; i<cnt; i++) {
+      r->hash[i] = e[i].h;
+      r->idx[i]  = e[i].i;
+      if (r->addr == NULL) continue;
+
+      // IFUNC symbols point at a resolver that picks the implementation
+      s = &d->sym[e[i].i];
+      r->addr[i] = r->base + s->st_value;
+      if (MARU_ST_TYPE(s->st_info) == STT_GNU_IFUNC)
+        r->addr[i] = ((maru_ifunc)r->addr[i])(getauxval(AT_HWCAP));
+    }
+    r->cnt = cnt;
+    free(e);
+    return 1;
+}
+
+// file offset for a virtual address in a mapped file
+static const void *maru_file_ptr(void *arg, ElfW(Addr) va) {
+    maru_resolver    *r = arg;
+    const ElfW(Ehdr) *eh = r->map;
+    const ElfW(Phdr) *ph = (const ElfW(Phdr)*)((uint8_t*)r->map + eh->e_phoff);
+    int              i;
+
+    for (i=0; i<eh->e_phnum; i++) {
+      if (ph[i].p_type != PT_LOAD) continue;
+      if (va >= ph[i].p_vaddr && va - ph[i].p_vaddr < ph[i].p_filesz &&
+          ph[i].p_offset < r->maplen &&
+          va - ph[i].p_vaddr < r->maplen - ph[i].p_offset)
+        return (uint8_t*)r->map + ph[i].p_offset + (va - ph[i].p_vaddr);
+    }
+    return NULL;
+}
+
+// some loaders relocate the dynamic section in memory, others don't
+static const void *maru_mem_ptr(void *arg, ElfW(Addr) va) {
+    maru_resolver *r = arg;
+
+    return (const void*)(va < r->base ? r->base + va : va);
+}
+
+int maru_resolver_open(maru_resolver *r, const char *path, int alg, uint64_t iv) {
+    const ElfW(Ehdr) *eh;
+    const ElfW(Phdr) *ph;
+    const ElfW(Shdr) *sh;
+    const ElfW(Dyn)  *dyn = NULL;
+    maru_dyn         d;
+    struct stat      st;
+    int              fd, i;
+
+    memset(r, 0, sizeof(maru_resolver));
+    r->alg = alg;
+    r->iv  = iv;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ElfW(Ehdr))) {
+      close(fd);
+      return 0;
+    }
+    r->maplen = st.st_size;
+    r->map = mmap(NULL, r->maplen, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (r->map == MAP_FAILED) {
+      r->map = NULL;
+      return 0;
+    }
+    eh = r->map;
+
+    // only native ELF files
+    if (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 ||
+        eh->e_ident[EI_CLASS] != MARU_ELFCLASS ||
+        eh->e_phoff > r->maplen ||
+        (size_t)eh->e_phnum * sizeof(ElfW(Phdr)) > r->maplen - eh->e_phoff) goto fail;
+
+    ph = (const ElfW(Phdr)*)((uint8_t*)r->map + eh->e_phoff);
+    for (i=0; i<eh->e_phnum; i++) {
+      if (ph[i].p_type == PT_DYNAMIC && ph[i].p_offset < r->maplen) {
+        dyn = (const ElfW(Dyn)*)((uint8_t*)r->map + ph[i].p_offset);
+        break;
+      }
+    }
+    if (dyn == NULL ||
+        !maru_dyn_parse(&d, dyn, maru_file_ptr, r, (uint8_t*)r->map + r->maplen)) goto fail;
+
+    // without hash tables, take the count from the .dynsym section
+    if (d.nsym == 0 && eh->e_shoff != 0 && eh->e_shoff <= r->maplen &&
+        (size_t)eh->e_shnum * sizeof(ElfW(Shdr)) <= r->maplen - eh->e_shoff) {
+      sh = (const ElfW(Shdr)*)((uint8_t*)r->map + eh->e_shoff);
+      for (i=0; i<eh->e_shnum; i++) {
+        if (sh[i].sh_type == SHT_DYNSYM && sh[i].sh_entsize != 0) {
+          d.nsym = sh[i].sh_size / sh[i].sh_entsize;
+          break;
+        }
+      }
+    }
+    // symbols, versions and strings must be inside the file
+    if (!maru_dyn_in(&d, d.sym, (uint64_t)d.nsym * sizeof(ElfW(Sym))) ||
+        (d.versym != NULL &&
+         !maru_dyn_in(&d, d.versym, (uint64_t)d.nsym * sizeof(ElfW(Half)))) ||
+        d.strsz == 0 || !maru_dyn_in(&d, d.str, d.strsz) ||
+        d.str[d.strsz - 1] != 0) goto fail;
+
+    if (maru_resolver_build(r, &d)) return 1;
+fail:
+    maru_resolver_close(r);
+    return 0;
+}
+
+typedef struct _maru_find {
+  const char      *name;
+  uintptr_t       base;
+  const ElfW(Dyn) *dyn;
+} maru_find;
+
+// the file name of path is name, or name then ".so" or a version,
+// so "libc" and "libc.so" match libc.so.6 but not libcrypt.so.1
+static int maru_module_match(const char *path, const char *name) {
+    const char *b = strrchr(path, '/');
+    size_t     n = strlen(name);
+
+    b = (b != NULL) ? b + 1 : path;
+    if (strncmp(b, name, n) != 0) return 0;
+    b += n;
+    if (*b == 0 || strncmp(b, ".so", 3) == 0) return 1;
+    return *b == '.' && n >= 3 && strcmp(name + n - 3, ".so") == 0;
+}
+
+static int maru_phdr_cb(struct dl_phdr_info *info, size_t size, void *arg) {
+    maru_find *f = arg;
+    int       i;
+
+    (void)size;
+    // NULL or "" is the main program, which is always first
+    if (f->name != NULL && f->name[0] != 0) {
+      if (info->dlpi_name == NULL || !maru_module_match(info->dlpi_name, f->name))
+        return 0;
+    }
+    for (i=0; i<info->dlpi_phnum; i++) {
+      if (info->dlpi_phdr[i].p_type == PT_DYNAMIC) {
+        f->base = info->dlpi_addr;
+        f->dyn  = (const ElfW(Dyn)*)(info->dlpi_addr + info->dlpi_phdr[i].p_vaddr);
+        return 1;
+      }
+    }
+    return 0;
+}
+
+int maru_resolver_loaded(maru_resolver *r, const char *name, int alg, uint64_t iv) {
+    maru_find f;
+    maru_dyn  d;
+
+    memset(r, 0, sizeof(maru_resolver));
+    r->alg = alg;
+    r->iv  = iv;
+
+    f.name = name;
+    f.dyn  = NULL;
+    dl_iterate_phdr(maru_phdr_cb, &f);
+    if (f.dyn == NULL) return 0;
+
+    r->base = f.base;
+    if (maru_dyn_parse(&d, f.dyn, maru_mem_ptr, r, NULL) && d.nsym != 0 &&
+        maru_resolver_build(r, &d)) return 1;
+
+    maru_resolver_close(r);
+    return 0;
+}
+
+void maru_resolver_close(maru_resolver *r) {
+    free(r->hash);
+    free(r->idx);
+    free(r->addr);
+    if (r->map != NULL) munmap(r->map, r->maplen);
+    memset(r, 0, sizeof(maru_resolver));
+}
+
+uint64_t maru_resolver_hash(maru_resolver *r, const char *name) {
+    uint64_t h[2];
+
+    if (r->alg == MARU_ALG_MARU) return maru(name, r->iv);
+
+    maru2(name, r->iv, h);
+    return h[0];
+}
+
+// branchless lower bound on the hash array, cnt if h is missing
+static size_t maru_resolver_pos(maru_resolver *r, uint64_t h) {
+    const uint64_t *b = r->hash;
+    size_t         n = r->cnt, half;
+
+    if (n == 0) return 0;
+
+    while (n > 1) {
+      half = n / 2;
+      __builtin_prefetch(&b[half / 2]);
+      __builtin_prefetch(&b[half + half / 2]);
+      b += (b[half - 1] < h) ? half : 0;
+      n -= half;
+    }
+    return *b == h ? (size_t)(b - r->hash) : r->cnt;
+}
+
+const ElfW(Sym) *maru_resolver_find(maru_resolver *r, uint64_t h) {
+    size_t i = maru_resolver_pos(r, h);
+
+    return i == r->cnt ? NULL : &r->sym[r->idx[i]];
+}
+
+// address of symbol, relative to load address for a mapped file.
+// IFUNC symbols of a mapped file have no address until loaded: NULL
+void *maru_resolver_addr(maru_resolver *r, uint64_t h) {
+    const ElfW(Sym) *s;
+    size_t          i = maru_resolver_pos(r, h);
+
+    if (i == r->cnt) return NULL;
+    if (r->addr != NULL) return (void*)r->addr[i];
+
+    s = &r->sym[r->idx[i]];
+    if (MARU_ST_TYPE(s->st_info) == STT_GNU_IFUNC) return NULL;
+    return (void*)(r->base + s->st_value);
+}
+
+#ifdef TEST
+
+#include <stdio.h>
+#include <dlfcn.h>
+
+const char *api_tbl[]=
+{ "printf",
+  "fopen",
+  "qsort",
+  "getenv",
+  "dl_iterate_phdr",
+  "mmap",
+  "strlen",
+  "memcpy" };
+
+typedef struct _libc_info {
+  const char *path;
+  uintptr_t  base;
+} libc_info;
+
+static int libc_cb(struct dl_phdr_info *info, size_t size, void *arg) {
+    libc_info *libc = arg;
+
+    (void)size;
+    if (info->dlpi_name != NULL && maru_module_match(info->dlpi_name, "libc")) {
+      libc->path = info->dlpi_name;
+      libc->base = info->dlpi_addr;
+      return 1;
+    }
+    return 0;
+}
+
+// every prefix cut at a table boundary must open cleanly or fail
+static int truncate_test(const char *path) {
+    maru_resolver r;
+    struct stat   st;
+    char          tmp[] = "/tmp/maru_resolveXXXXXX";
+    uint8_t       *p;
+    size_t        len, cut[16];
+    int           fd, i, n = 0, ok = 1;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0) return 0;
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return 0;
+
+    // cuts inside the headers and around the dynamic tables
+    if (!maru_resolver_open(&r, path, MARU_ALG_MARU, 0)) return 0;
+    cut[n++] = sizeof(ElfW(Ehdr)) + 8;
+    cut[n++] = (const uint8_t*)r.sym - p + 16;
+    cut[n++] = (const uint8_t*)r.str - p + 16;
+    cut[n++] = (const uint8_t*)r.str - p + 4096;
+    for (i=1; i<8; i++) cut[n++] = (size_t)st.st_size * i / 8;
+    maru_resolver_close(&r);
+
+    fd = mkstemp(tmp);
+    if (fd < 0) return 0;
+    for (i=0; i<n; i++) {
+      len = cut[i] < (size_t)st.st_size ? cut[i] : (size_t)st.st_size;
+      if (ftruncate(fd, 0) != 0 || pwrite(fd, p, len, 0) != (ssize_t)len) {
+        ok = 0;
+        break;
+      }
+      if (maru_resolver_open(&r, tmp, MARU_ALG_MARU, 0)) {
+        ok &= r.cnt != 0;
+        maru_resolver_close(&r);
+      }
+    }
+    close(fd);
+    unlink(tmp);
+    munmap(p, st.st_size);
+    return ok;
+}
+
+int main(void) {
+    maru_resolver r, f;
+    libc_info     libc = { NULL, 0 };
+    const ElfW(Sym) *s;
+    uint64_t      h;
+    void          *a, *b, *x;
+    int           alg, j;
+
+    dl_iterate_phdr(libc_cb, &libc);
+    if (libc.path == NULL) {
+      printf ("libc not found\n");
+      return 1;
+    }
+    for (alg=MARU_ALG_MARU; alg<=MARU_ALG_MARU2; alg++) {
+      if (!maru_resolver_loaded(&r, "libc.so", alg, 0x15DF1E4BE5E7970F) ||
+          !maru_resolver_open(&f, libc.path, alg, 0x15DF1E4BE5E7970F)) {
+        printf ("unable to read %s\n", libc.path);
+        return 1;
+      }
+      printf ("\n%s : %zu exports loaded, %zu in file\n", libc.path, r.cnt, f.cnt);
+
+      for (j=0; j<(int)(sizeof(api_tbl)/sizeof(char*)); j++) {
+        h = maru_resolver_hash(&r, api_tbl[j]);
+        a = maru_resolver_addr(&r, h);
+        b = maru_resolver_addr(&f, h);
+        x = dlsym(RTLD_DEFAULT, api_tbl[j]);
+
+        // the file can't run IFUNC resolvers, only the loaded module does
+        s = maru_resolver_find(&f, h);
+        if (s != NULL && MARU_ST_TYPE(s->st_info) == STT_GNU_IFUNC) {
+          printf ("  %016llx = %s(\"%s\") : %p ifunc : %s\n",
+            (unsigned long long)h, alg == MARU_ALG_MARU ? "maru" : "maru2",
+            api_tbl[j], a, (a == x && b == NULL) ? "OK" : "FAIL");
+          continue;
+        }
+        printf ("  %016llx = %s(\"%s\") : %p %p : %s\n",
+          (unsigned long long)h, alg == MARU_ALG_MARU ? "maru" : "maru2",
+          api_tbl[j], a, (void*)((uintptr_t)b + libc.base),
+          (a == x && (uintptr_t)b + libc.base == (uintptr_t)x) ? "OK" : "FAIL");
+      }
+      maru_resolver_close(&r);
+      maru_resolver_close(&f);
+    }
+    // module names match the file name, not any part of the path
+    j  = maru_module_match("/lib/x86_64-linux-gnu/libc.so.6", "libc");
+    j &= maru_module_match("/lib/x86_64-linux-gnu/libc.so.6", "libc.so");
+    j &= maru_module_match("/lib/x86_64-linux-gnu/libc.so.6", "libc.so.6");
+    j &= !maru_module_match("/lib/x86_64-linux-gnu/libcrypt.so.1", "libc");
+    j &= !maru_module_match("/lib/x86_64-linux-gnu/libcap.so.2", "libc");
+    j &= !maru_module_match("/usr/lib/libc/libm.so.6", "libc");
+    j &= maru_resolver_loaded(&r, "libc", MARU_ALG_MARU, 0) && r.base == libc.base;
+    maru_resolver_close(&r);
+    j &= !maru_resolver_loaded(&r, "lib", MARU_ALG_MARU, 0);
+    printf ("\nmodule names : %s\n", j ? "OK" : "FAIL");
+
+    printf ("\ntruncated copies of %s : %s\n", libc.path,
+      truncate_test(libc.path) ? "OK" : "FAIL");
+    return 0;
+}
+#endif
@@ -0,0 +1,72 @@
+/**
+  Copyright © 2017 Odzhan. All Rights Reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  3. The name of the author may not be used to endorse or promote products
+  derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY AUTHORS "AS IS" AND ANY EXPRESS OR
+  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+  STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE. */
+
+#ifndef RESOLVE_H
+#define RESOLVE_H
+
+#include <link.h>
+
+#include "maru.h"
+#include "maru2.h"
+
+// hash used for symbol names
+#define MARU_ALG_MARU   1 // maru(name, iv)
+#define MARU_ALG_MARU2  2 // first 64 bits of maru2(name, iv)
+
+typedef struct _maru_resolver {
+  uint64_t        *hash;  // sorted hashes of exported names
+  uint32_t        *idx;   // index in sym for each hash
+  uintptr_t       *addr;  // address for each hash, loaded modules only
+  size_t          cnt;
+  const ElfW(Sym) *sym;   // .dynsym
+  const char      *str;   // .dynstr
+  uintptr_t       base;   // load address, 0 for a mapped file
+  void            *map;   // file mapping, NULL for a loaded module
+  size_t          maplen;
+  int             alg;
+  uint64_t        iv;
+} maru_resolver;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  int maru_resolver_open (maru_resolver*, const char*, int, uint64_t);
+  int maru_resolver_loaded (maru_resolver*, const char*, int, uint64_t);
+  void maru_resolver_close (maru_resolver*);
+
+  uint64_t maru_resolver_hash (maru_resolver*, const char*);
+  const ElfW(Sym) *maru_resolver_find (maru_resolver*, uint64_t);
+  void *maru_resolver_addr (maru_resolver*, uint64_t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
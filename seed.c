@@ -0,0 +1,514 @@
+/**
+  Copyright © 2017 Odzhan. All Rights Reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  3. The name of the author may not be used to endorse or promote products
+  derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY AUTHORS "AS IS" AND ANY EXPRESS OR
+  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+  STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE. */
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "seed.h"
+
+// Searches candidate ivs on all cores. Each worker owns a range of
+// candidates and, when it runs out, steals the top half of the largest
+// range left. Once an iv works, candidates above it are dropped, so the
+// result is the lowest working iv no matter how many threads run.
+
+// keys per pilot bucket
+#define MARU_MPH_LAMBDA  3
+// largest pilot bucket tried, bigger ones mean a bad iv
+#define MARU_MPH_MAX_BKT 64
+
+typedef struct _maru_search maru_search;
+
+typedef struct _maru_worker {
+  pthread_mutex_t lock;
+  uint64_t        lo, hi;  // candidates left, as offsets from first iv
+  pthread_t       id;
+  maru_search     *s;
+  uint64_t        (*h)[2]; // hash of each key under current iv
+  uint32_t        *tmp;    // bucket lists for pilot tables
+  uint8_t         *bits;   // slots taken
+  uint32_t        *pilot;
+} maru_worker;
+
+struct _maru_search {
+  const char  **keys;
+  size_t      n;
+  int         type;
+  uint32_t    nslots, nbuckets;
+  uint64_t    iv;          // first candidate
+  uint64_t    best;        // lowest working offset, or ~0
+  int         nw;
+  maru_worker *w;
+};
+
+static uint64_t maru_mix(uint64_t x) {
+    x ^= x >> 30; x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27; x *= 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+static uint32_t maru_slot(maru_search *s, uint64_t h) {
+    return s->nslots ? (uint32_t)h % s->nslots : (uint32_t)h;
+}
+
+static int maru_u32_cmp(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+// is every key in a slot of its own?
+static int maru_try_direct(maru_search *s, maru_worker *w) {
+    size_t   i, j;
+    uint32_t x;
+
+    // too many slots for a bitmap, sort them instead
+    if (w->bits == NULL) {
+      for (i=0; i<s->n; i++) w->tmp[i] = maru_slot(s, w->h[i][0]);
+      qsort(w->tmp, s->n, sizeof(uint32_t), maru_u32_cmp);
+      for (i=1; i<s->n; i++)
+        if (w->tmp[i] == w->tmp[i-1]) return 0;
+      return 1;
+    }
+    for (i=0; i<s->n; i++) {
+      x = maru_slot(s, w->h[i][0]);
+      if (w->bits[x >> 3] & (1 << (x & 7))) break;
+      w->bits[x >> 3] |= 1 << (x & 7);
+    }
+    // clear the bits set
+    for (j=0; j<i; j++) {
+      x = maru_slot(s, w->h[j][0]);
+      w->bits[x >> 3] &= ~(1 << (x & 7));
+    }
+    return i == s->n;
+}
+
+// find a pilot for each bucket, largest buckets first
+static int maru_try_pilot(maru_search *s, maru_worker *w) {
+    uint32_t r = s->nbuckets, m = s->nslots;
+    uint32_t *start = w->tmp, *fill = start + r + 1;
+    uint32_t *order = fill + r, *bkt = order + s->n;
+    uint32_t size[MARU_MPH_MAX_BKT + 2], pos[MARU_MPH_MAX_BKT];
+    uint32_t b, i, j, l, k, sz, p;
+    uint64_t x;
+
+    // count keys in each bucket
+    memset(start, 0, (r + 1) * sizeof(uint32_t));
+    for (i=0; i<s->n; i++) start[w->h[i][0] % r + 1]++;
+
+    memset(size, 0, sizeof(size));
+    for (b=0; b<r; b++) {
+      if (start[b+1] > MARU_MPH_MAX_BKT) return 0;
+      size[MARU_MPH_MAX_BKT - start[b+1] + 1]++;
+      start[b+1] += start[b];
+      fill[b] = start[b];
+    }
+    for (i=0; i<s->n; i++) order[fill[w->h[i][0] % r]++] = i;
+
+    // sort buckets by size, largest first
+    for (i=1; i<=MARU_MPH_MAX_BKT+1; i++) size[i] += size[i-1];
+    for (b=0; b<r; b++)
+      bkt[size[MARU_MPH_MAX_BKT - (start[b+1] - start[b])]++] = b;
+
+    memset(w->bits, 0, ((size_t)m + 7) / 8);
+
+    for (l=0; l<r; l++) {
+      b  = bkt[l];
+      sz = start[b+1] - start[b];
+      if (sz == 0) break;
+
+      // keys with the same hash can never be split
+      for (j=1; j<sz; j++)
+        for (k=0; k<j; k++)
+          if (w->h[order[start[b]+j]][1] == w->h[order[start[b]+k]][1]) return 0;
+
+      for (p=0; p<MARU_MPH_MAX_PILOT; p++) {
+        x = maru_mix(p);
+        for (j=0; j<sz; j++) {
+          pos[j] = (uint32_t)((w->h[order[start[b]+j]][1] ^ x) % m);
+          if (w->bits[pos[j] >> 3] & (1 << (pos[j] & 7))) break;
+          for (k=0; k<j && pos[k]!=pos[j]; k++);
+          if (k != j) break;
+        }
+        if (j == sz) break;
+      }
+      if (p == MARU_MPH_MAX_PILOT) return 0;
+
+      for (j=0; j<sz; j++) w->bits[pos[j] >> 3] |= 1 << (pos[j] & 7);
+      w->pilot[b] = p;
+    }
+    return 1;
+}
+
+static int maru_try(maru_search *s, maru_worker *w, uint64_t off) {
+    maru2_batch(s->keys, s->n, s->iv + off, (uint8_t(*)[MARU2_HASH_LEN])w->h);
+
+    return s->type == MARU_MPH_DIRECT ? maru_try_direct(s, w) : maru_try_pilot(s, w);
+}
+
+// next candidate from own range, or stolen from another worker
+static int maru_take(maru_search *s, maru_worker *w, uint64_t *off) {
+    maru_worker *v;
+    uint64_t    best, hi, left, most;
+    int         i;
+
+    best = __atomic_load_n(&s->best, __ATOMIC_ACQUIRE);
+
+    pthread_mutex_lock(&w->lock);
+    if (w->lo < w->hi && w->lo < best) {
+      *off = w->lo++;
+      pthread_mutex_unlock(&w->lock);
+      return 1;
+    }
+    w->lo = w->hi;
+    pthread_mutex_unlock(&w->lock);
+
+    for (;;) {
+      // worker with the most candidates below best
+      for (v=NULL, most=1, i=0; i<s->nw; i++) {
+        pthread_mutex_lock(&s->w[i].lock);
+        hi = s->w[i].hi < best ? s->w[i].hi : best;
+        left = s->w[i].lo < hi ? hi - s->w[i].lo : 0;
+        pthread_mutex_unlock(&s->w[i].lock);
+        if (left > most) { most = left; v = &s->w[i]; }
+      }
+      if (v == NULL) return 0;
+
+      // take top half
+      pthread_mutex_lock(&v->lock);
+      hi = v->hi < best ? v->hi : best;
+      left = v->lo < hi ? hi - v->lo : 0;
+      if (left > 1) {
+        *off  = v->lo + left / 2;
+        v->hi = *off;
+        pthread_mutex_unlock(&v->lock);
+
+        pthread_mutex_lock(&w->lock);
+        w->lo = *off + 1;
+        w->hi = hi;
+        pthread_mutex_unlock(&w->lock);
+        return 1;
+      }
+      pthread_mutex_unlock(&v->lock);
+    }
+}
+
+static void *maru_worker_main(void *arg) {
+    maru_worker *w = arg;
+    maru_search *s = w->s;
+    uint64_t    off, best;
+
+    while (maru_take(s, w, &off)) {
+      if (!maru_try(s, w, off)) continue;
+
+      // keep the lowest
+      best = __atomic_load_n(&s->best, __ATOMIC_ACQUIRE);
+      while (off < best &&
+        !__atomic_compare_exchange_n(&s->best, &best, off, 0,
+          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    }
+    return NULL;
+}
+
+static void maru_search_free(maru_search *s) {
+    int i;
+
+    for (i=0; i<s->nw; i++) {
+      free(s->w[i].h);
+      free(s->w[i].tmp);
+      free(s->w[i].bits);
+      free(s->w[i].pilot);
+      pthread_mutex_destroy(&s->w[i].lock);
+    }
+    free(s->w);
+}
+
+// build table of type for keys, trying count ivs from iv
+maru_mph *maru_mph_build(const char **keys, size_t n, int type,
+  uint32_t nslots, int threads, uint64_t iv, uint64_t count)
+{
+    maru_search s;
+    maru_worker *w;
+    maru_mph    *t = NULL;
+    size_t      ntmp, nbits;
+    uint64_t    per;
+    int         i, ok = 1;
+
+    if (n == 0 || n >= 0xFFFFFFFF || count == 0) return NULL;
+
+    memset(&s, 0, sizeof(s));
+    s.keys = keys;
+    s.n    = n;
+    s.type = type;
+    s.iv   = iv;
+    s.best = ~0ULL;
+
+    if (type == MARU_MPH_PILOT) {
+      s.nslots   = (uint32_t)n;
+      s.nbuckets = (uint32_t)((n + MARU_MPH_LAMBDA - 1) / MARU_MPH_LAMBDA);
+      ntmp       = 2 * (size_t)s.nbuckets + 1 + n + s.nbuckets;
+      nbits      = n;
+    } else if (type == MARU_MPH_DIRECT) {
+      if (nslots != 0 && nslots < n) return NULL;
+      s.nslots   = nslots;
+      ntmp       = n;
+      nbits      = (nslots != 0 && nslots <= (1 << 28)) ? nslots : 0;
+    } else return NULL;
+
+    if (threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0) threads = 1;
+    if ((uint64_t)threads > count) threads = (int)count;
+
+    s.nw = threads;
+    s.w  = w = calloc(threads, sizeof(maru_worker));
+    if (w == NULL) return NULL;
+
+    // split candidates evenly
+    per = count / threads;
+    for (i=0; i<threads; i++) {
+      pthread_mutex_init(&w[i].lock, NULL);
+      w[i].s     = &s;
+      w[i].lo    = per * i;
+      w[i].hi    = (i == threads - 1) ? count : per * (i + 1);
+      w[i].h     = malloc(n * sizeof(w[i].h[0]));
+      w[i].tmp   = malloc(ntmp * sizeof(uint32_t));
+      w[i].bits  = nbits ? calloc((nbits + 7) / 8, 1) : NULL;
+      w[i].pilot = s.nbuckets ? malloc(s.nbuckets * sizeof(uint32_t)) : NULL;
+
+      if (w[i].h == NULL || w[i].tmp == NULL || (nbits && w[i].bits == NULL) ||
+          (s.nbuckets && w[i].pilot == NULL)) ok = 0;
+    }
+    if (ok) {
+      for (i=0; i<threads; i++)
+        pthread_create(&w[i].id, NULL, maru_worker_main, &w[i]);
+      for (i=0; i<threads; i++)
+        pthread_join(w[i].id, NULL);
+    }
+    if (ok && s.best != ~0ULL) {
+      t = malloc(sizeof(maru_mph) + s.nbuckets * sizeof(uint32_t));
+      if (t != NULL) {
+        t->magic    = MARU_MPH_MAGIC;
+        t->type     = type;
+        t->iv       = iv + s.best;
+        t->nkeys    = (uint32_t)n;
+        t->nslots   = s.nslots;
+        t->nbuckets = s.nbuckets;
+        t->size     = (uint32_t)(sizeof(maru_mph) + s.nbuckets * sizeof(uint32_t));
+
+        // pilots of the winning iv are redone, they may be overwritten
+        if (type == MARU_MPH_PILOT) {
+          maru_try(&s, &w[0], s.best);
+          memcpy(t + 1, w[0].pilot, s.nbuckets * sizeof(uint32_t));
+        }
+      }
+    }
+    maru_search_free(&s);
+    return t;
+}
+
+uint32_t maru_mph_lookup(const maru_mph *t, const char *key) {
+    const uint32_t *pilot = (const uint32_t*)(t + 1);
+    uint64_t       h[2];
+
+    maru2(key, t->iv, h);
+
+    if (t->type == MARU_MPH_DIRECT)
+      return t->nslots ? (uint32_t)h[0] % t->nslots : (uint32_t)h[0];
+
+    return (uint32_t)((h[1] ^ maru_mix(pilot[h[0] % t->nbuckets])) % t->nslots);
+}
+
+#ifdef TEST
+
+#include <stdio.h>
+
+const char *api_tbl[]=
+{ "CreateProcessA",
+  "LoadLibraryA",
+  "GetProcAddress",
+  "WSASocketA",
+  "GetOverlappedResult",
+  "WaitForSingleObject",
+  "TerminateProcess",
+  "CloseHandle"  };
+
+/**F*****************************************************************/
+char* getparam (int argc, char *argv[], int *i)
+{
+    int n=*i;
+    if (argv[n][2] != 0) {
+      return &argv[n][2];
+    }
+    if ((n+1) < argc) {
+      *i=n+1;
+      return argv[n+1];
+    }
+    printf ("[ %c%c requires parameter\n", argv[n][0], argv[n][1]);
+    exit (0);
+}
+
+// read newline separated keys
+char **read_keys(const char *path, size_t *n) {
+    FILE   *in;
+    char   *buf, **keys, *p;
+    long   len;
+    size_t i;
+
+    in = fopen(path, "rb");
+    if (in == NULL) return NULL;
+
+    fseek(in, 0, SEEK_END);
+    len = ftell(in);
+    fseek(in, 0, SEEK_SET);
+
+    buf = malloc(len + 1);
+    if (buf == NULL || fread(buf, 1, len, in) != (size_t)len) {
+      fclose(in);
+      return NULL;
+    }
+    fclose(in);
+    buf[len] = 0;
+
+    for (*n=0, p=buf; *p!=0; p++) *n += (*p == '\n');
+    keys = malloc((*n + 1) * sizeof(char*));
+
+    for (i=0, p=strtok(buf, "\r\n"); p!=NULL; p=strtok(NULL, "\r\n"))
+      keys[i++] = p;
+    *n = i;
+    return keys;
+}
+
+// is each key in a slot of its own?
+int verify(maru_mph *t, const char **keys, size_t n) {
+    uint32_t *slot, i;
+    int      ok = 1;
+
+    slot = malloc(n * sizeof(uint32_t));
+    for (i=0; i<n; i++) slot[i] = maru_mph_lookup(t, keys[i]);
+    qsort(slot, n, sizeof(uint32_t), maru_u32_cmp);
+    for (i=1; i<n; i++) ok &= slot[i] != slot[i-1];
+    if (t->type == MARU_MPH_PILOT) ok &= slot[n-1] == n - 1;
+    free(slot);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    maru_mph *t;
+    char     **keys = NULL, *out = NULL, *path = NULL, opt;
+    size_t   n, i;
+    int      a, type = MARU_MPH_DIRECT, threads = 0;
+    uint32_t nslots = 0;
+    uint64_t iv = 0, count = 1ULL << 32;
+    FILE     *f;
+
+    for (a=1; a<argc; a++) {
+      if (argv[a][0]=='-') {
+        opt=argv[a][1];
+        switch(opt) {
+          case 'm':
+            type = MARU_MPH_PILOT;
+            break;
+          case 'n':
+            nslots = strtoul(getparam(argc, argv, &a), NULL, 0);
+            break;
+          case 't':
+            threads = atoi(getparam(argc, argv, &a));
+            break;
+          case 's':
+            iv = strtoull(getparam(argc, argv, &a), NULL, 16);
+            break;
+          case 'c':
+            count = strtoull(getparam(argc, argv, &a), NULL, 0);
+            break;
+          case 'o':
+            out = getparam(argc, argv, &a);
+            break;
+          default:
+            printf ("usage: %s [-m] [-n slots] [-t threads] [-s iv] [-c count] [-o table] <keys>\n", argv[0]);
+            printf ("       -m       minimal perfect table, otherwise one slot per key\n");
+            printf ("       -n slots slots for one slot per key, default all 32-bit values\n");
+            return 0;
+        }
+      } else path = argv[a];
+    }
+    if (path != NULL) {
+      keys = read_keys(path, &n);
+      if (keys == NULL) {
+        printf ("unable to read %s\n", path);
+        return 1;
+      }
+      t = maru_mph_build((const char**)keys, n, type, nslots, threads, iv, count);
+      if (t == NULL) {
+        printf ("no iv found\n");
+        return 1;
+      }
+      printf ("iv = %016llx, %u keys, %u slots, %u buckets : %s\n",
+        (unsigned long long)t->iv, t->nkeys, t->nslots, t->nbuckets,
+        verify(t, (const char**)keys, n) ? "OK" : "FAIL");
+
+      if (out != NULL) {
+        f = fopen(out, "wb");
+        if (f == NULL || fwrite(t, t->size, 1, f) != 1) {
+          printf ("unable to write %s\n", out);
+          return 1;
+        }
+        fclose(f);
+      }
+      return 0;
+    }
+    // api_tbl in 16 slots
+    n = sizeof(api_tbl)/sizeof(char*);
+    t = maru_mph_build(api_tbl, n, MARU_MPH_DIRECT, 16, threads, 0, count);
+    printf ("maru_mph_build(api_tbl, 16 slots) = %016llx : %s\n",
+      t ? (unsigned long long)t->iv : 0ULL,
+      t && verify(t, api_tbl, n) ? "OK" : "FAIL");
+    free(t);
+
+    // same iv on one thread
+    t = maru_mph_build(api_tbl, n, MARU_MPH_DIRECT, 16, 1, 0, count);
+    printf ("maru_mph_build(api_tbl, 16 slots, 1 thread) = %016llx : %s\n",
+      t ? (unsigned long long)t->iv : 0ULL,
+      t && verify(t, api_tbl, n) ? "OK" : "FAIL");
+    free(t);
+
+    // minimal perfect table of generated keys
+    n = 100000;
+    keys = malloc(n * sizeof(char*));
+    for (i=0; i<n; i++) {
+      keys[i] = malloc(16);
+      snprintf(keys[i], 16, "key%zu", i);
+    }
+    t = maru_mph_build((const char**)keys, n, MARU_MPH_PILOT, 0, threads, 0, count);
+    printf ("maru_mph_build(%zu keys, minimal) = %016llx, %u bytes : %s\n",
+      n, t ? (unsigned long long)t->iv : 0ULL, t ? t->size : 0,
+      t && verify(t, (const char**)keys, n) ? "OK" : "FAIL");
+    free(t);
+    return 0;
+}
+#endif
@@ -0,0 +1,67 @@
+/**
+  Copyright © 2017 Odzhan. All Rights Reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  3. The name of the author may not be used to endorse or promote products
+  derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY AUTHORS "AS IS" AND ANY EXPRESS OR
+  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+  STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE. */
+
+#ifndef SEED_H
+#define SEED_H
+
+#include "maru2.h"
+
+#define MARU_MPH_MAGIC   0x3148504D // "MPH1"
+
+// table types
+#define MARU_MPH_DIRECT  1 // slot = maru2 hash mod nslots
+#define MARU_MPH_PILOT   2 // minimal perfect, one pilot per bucket
+
+// give up on an iv after this many pilots for one bucket
+#define MARU_MPH_MAX_PILOT  (1 << 20)
+
+// table header, followed by nbuckets 32-bit pilots.
+// the whole table can be written to disk and mapped back as is.
+typedef struct _maru_mph {
+  uint32_t magic;
+  uint32_t type;
+  uint64_t iv;
+  uint32_t nkeys;
+  uint32_t nslots;    // 0 for all 32-bit values
+  uint32_t nbuckets;  // 0 for direct tables
+  uint32_t size;      // total bytes, including pilots
+} maru_mph;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  maru_mph *maru_mph_build (const char**, size_t, int, uint32_t, int, uint64_t, uint64_t);
+  uint32_t maru_mph_lookup (const maru_mph*, const char*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
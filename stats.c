@@ -0,0 +1,450 @@
+/**
+  Copyright © 2017 Odzhan. All Rights Reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  3. The name of the author may not be used to endorse or promote products
+  derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY AUTHORS "AS IS" AND ANY EXPRESS OR
+  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+  STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE. */
+
+// counters and cycle histograms of the hash functions. maru.c and
+// maru2.c must be built with MARU_STATS too, or nothing is counted.
+#ifndef MARU_STATS
+#define MARU_STATS
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "stats.h"
+
+// Each thread counts in its own block, so there are no locks and no
+// shared cache lines on the hot path. Blocks are on a list that only
+// grows: one of a thread that exits is taken by the next new thread,
+// and its counts stay in the totals. Readers add up the list.
+typedef struct _maru_stats_tls {
+  struct _maru_stats_tls *next;
+  int                    used;
+  maru_stats_ctr         ctr[MARU_STATS_FN];
+  uint64_t               sum[MARU_STATS_FN][MARU_STATS_KERN];
+  uint64_t               bin[MARU_STATS_FN][MARU_STATS_KERN][MARU_STATS_BINS];
+} maru_stats_tls;
+
+static maru_stats_tls           *maru_stats_list;
+static __thread maru_stats_tls  *maru_stats_self;
+static pthread_key_t            maru_stats_exit;
+static pthread_once_t           maru_stats_once = PTHREAD_ONCE_INIT;
+
+static const char *maru_stats_fn[MARU_STATS_FN] = {
+  "maru_n", "maru_batch", "maru_stream",
+  "maru2_n", "maru2_batch", "maru2_multi_seed", "maru2_stream"
+};
+
+static const char *maru_stats_kern[MARU_STATS_KERN] = {
+  "scalar", "sse4", "avx2", "avx512"
+};
+
+// only the owner writes, so a relaxed load and store is enough
+#define STAT_ADD(p, v) __atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + (v), __ATOMIC_RELAXED)
+#define STAT_GET(p)    __atomic_load_n(p, __ATOMIC_RELAXED)
+
+static void maru_stats_release(void *arg) {
+    maru_stats_tls *t = (maru_stats_tls*)arg;
+
+    __atomic_store_n(&t->used, 0, __ATOMIC_RELEASE);
+}
+
+static void maru_stats_init(void) {
+    pthread_key_create(&maru_stats_exit, maru_stats_release);
+}
+
+static maru_stats_tls *maru_stats_get_tls(void) {
+    maru_stats_tls *t = maru_stats_self;
+    int            free_;
+
+    if (t != NULL) return t;
+
+    pthread_once(&maru_stats_once, maru_stats_init);
+    // take the block of a thread that exited
+    for (t = __atomic_load_n(&maru_stats_list, __ATOMIC_ACQUIRE); t != NULL; t = t->next) {
+      free_ = 0;
+      if (__atomic_load_n(&t->used, __ATOMIC_RELAXED) == 0 &&
+          __atomic_compare_exchange_n(&t->used, &free_, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        break;
+    }
+    // or add a new one
+    if (t == NULL) {
+      t = (maru_stats_tls*)calloc(1, sizeof(maru_stats_tls));
+      if (t == NULL) return NULL;
+      t->used = 1;
+      t->next = __atomic_load_n(&maru_stats_list, __ATOMIC_RELAXED);
+      while (!__atomic_compare_exchange_n(&maru_stats_list, &t->next, t, 1,
+        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+    pthread_setspecific(maru_stats_exit, t);
+    maru_stats_self = t;
+    return t;
+}
+
+// cycles where the cpu has a time stamp counter, else nanoseconds
+uint64_t maru_stats_now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+// scalar, sse4, avx2 or avx512
+static int maru_stats_kern_id(const char *name) {
+    if (name[0] == 's') return name[1] == 'c' ? 0 : 1;
+    return name[3] == '2' ? 2 : 3;
+}
+
+void maru_stats_key(int fn, size_t len, size_t n, int blk) {
+    maru_stats_tls *t = maru_stats_get_tls();
+    size_t         pad;
+
+    if (t == NULL) return;
+    // the end bit and length need another block when idx >= blk - 4
+    pad = (len % blk) >= (size_t)(blk - 4);
+    STAT_ADD(&t->ctr[fn].bytes,  len * n);
+    STAT_ADD(&t->ctr[fn].blocks, (len / blk + 1 + pad) * n);
+    STAT_ADD(&t->ctr[fn].pad,    pad * n);
+}
+
+void maru_stats_call(int fn, const char *kern, size_t keys, uint64_t t0) {
+    uint64_t       c = (t0 != 0) ? maru_stats_now() - t0 : 0;
+    maru_stats_tls *t = maru_stats_get_tls();
+    int            k, b;
+
+    if (t == NULL) return;
+    STAT_ADD(&t->ctr[fn].calls, 1);
+    STAT_ADD(&t->ctr[fn].keys, keys);
+    if (t0 == 0) return;
+
+    // bin b has c < 2^b
+    b = (c == 0) ? 0 : 64 - __builtin_clzll(c);
+    if (b >= MARU_STATS_BINS) b = MARU_STATS_BINS - 1;
+    k = maru_stats_kern_id(kern);
+    STAT_ADD(&t->bin[fn][k][b], 1);
+    STAT_ADD(&t->sum[fn][k], c);
+}
+
+void maru_stats_get(int fn, maru_stats_ctr *c) {
+    maru_stats_tls *t;
+
+    memset(c, 0, sizeof(maru_stats_ctr));
+    for (t = __atomic_load_n(&maru_stats_list, __ATOMIC_ACQUIRE); t != NULL; t = t->next) {
+      c->calls  += STAT_GET(&t->ctr[fn].calls);
+      c->keys   += STAT_GET(&t->ctr[fn].keys);
+      c->bytes  += STAT_GET(&t->ctr[fn].bytes);
+      c->blocks += STAT_GET(&t->ctr[fn].blocks);
+      c->pad    += STAT_GET(&t->ctr[fn].pad);
+    }
+}
+
+// the dump is made with write() on a buffer from the stack, so it can
+// be called from a signal handler
+typedef struct _stats_out {
+  int    fd, err;
+  size_t len;
+  char   buf[2048];
+} stats_out;
+
+static void out_flush(stats_out *o) {
+    size_t  i;
+    ssize_t r;
+
+    for (i=0; i<o->len && !o->err; i+=r) {
+      r = write(o->fd, o->buf + i, o->len - i);
+      if (r < 0 && errno == EINTR) r = 0;
+      else if (r <= 0) o->err = 1;
+    }
+    o->len = 0;
+}
+
+static void out_str(stats_out *o, const char *s) {
+    for (; *s != 0; s++) {
+      if (o->len == sizeof(o->buf)) out_flush(o);
+      o->buf[o->len++] = *s;
+    }
+}
+
+static void out_u64(stats_out *o, uint64_t v) {
+    char s[24];
+    int  i = sizeof(s) - 1;
+
+    s[i] = 0;
+    do {
+      s[--i] = (char)('0' + v % 10);
+      v /= 10;
+    } while (v != 0);
+    out_str(o, &s[i]);
+}
+
+static void out_label(stats_out *o, const char *name, int fn, int k) {
+    out_str(o, name);
+    out_str(o, "{fn=\"");
+    out_str(o, maru_stats_fn[fn]);
+    if (k >= 0) {
+      out_str(o, "\",kernel=\"");
+      out_str(o, maru_stats_kern[k]);
+    }
+    out_str(o, "\"");
+}
+
+// Prometheus text format, histograms only for kernels that were used
+int maru_stats_write(int fd) {
+    static const char *names[5] = {
+      "maru_calls_total", "maru_keys_total", "maru_bytes_total",
+      "maru_blocks_total", "maru_pad_blocks_total"
+    };
+    stats_out      o;
+    maru_stats_ctr c;
+    maru_stats_tls *t;
+    uint64_t       bin[MARU_STATS_BINS], sum, n;
+    int            i, fn, k, b;
+
+    o.fd = fd; o.err = 0; o.len = 0;
+
+    for (i=0; i<5; i++) {
+      out_str(&o, "# TYPE ");
+      out_str(&o, names[i]);
+      out_str(&o, " counter\n");
+      for (fn=0; fn<MARU_STATS_FN; fn++) {
+        maru_stats_get(fn, &c);
+        out_label(&o, names[i], fn, -1);
+        out_str(&o, "} ");
+        out_u64(&o, i == 0 ? c.calls : i == 1 ? c.keys : i == 2 ? c.bytes :
+                    i == 3 ? c.blocks : c.pad);
+        out_str(&o, "\n");
+      }
+    }
+    out_str(&o, "# TYPE maru_cycles histogram\n");
+    for (fn=0; fn<MARU_STATS_FN; fn++) {
+      for (k=0; k<MARU_STATS_KERN; k++) {
+        memset(bin, 0, sizeof(bin));
+        sum = 0;
+        for (t = __atomic_load_n(&maru_stats_list, __ATOMIC_ACQUIRE); t != NULL; t = t->next) {
+          for (b=0; b<MARU_STATS_BINS; b++) bin[b] += STAT_GET(&t->bin[fn][k][b]);
+          sum += STAT_GET(&t->sum[fn][k]);
+        }
+        // buckets are cumulative, bin b holds up to 2^b - 1 cycles
+        for (b=0, n=0; b<MARU_STATS_BINS; b++) n += bin[b];
+        if (n == 0) continue;
+
+        for (b=0, n=0; b<MARU_STATS_BINS; b++) {
+          n += bin[b];
+          out_label(&o, "maru_cycles_bucket", fn, k);
+          out_str(&o, ",le=\"");
+          if (b < MARU_STATS_BINS - 1) out_u64(&o, (1ULL << b) - 1);
+          else out_str(&o, "+Inf");
+          out_str(&o, "\"} ");
+          out_u64(&o, n);
+          out_str(&o, "\n");
+        }
+        out_label(&o, "maru_cycles_sum", fn, k);
+        out_str(&o, "} ");
+        out_u64(&o, sum);
+        out_str(&o, "\n");
+        out_label(&o, "maru_cycles_count", fn, k);
+        out_str(&o, "} ");
+        out_u64(&o, n);
+        out_str(&o, "\n");
+      }
+    }
+    out_flush(&o);
+    return o.err ? -1 : 0;
+}
+
+static void maru_stats_handler(int sig) {
+    int e = errno;
+
+    (void)sig;
+    maru_stats_write(2);
+    errno = e;
+}
+
+// dump to stderr on sig, for example SIGUSR1
+int maru_stats_signal(int sig) {
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = maru_stats_handler;
+    sa.sa_flags   = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    return sigaction(sig, &sa, NULL);
+}
+
+#ifdef TEST
+
+#include <stdio.h>
+
+#include "maru.h"
+#include "maru2.h"
+
+#define NTHREADS 4
+#define NCALLS   10000
+
+static void *stats_worker(void *arg) {
+    uint8_t h[MARU2_HASH_LEN];
+    int     i;
+
+    for (i=0; i<NCALLS; i++)
+      maru2_n("thread", 6, (uint64_t)(size_t)arg + i, h);
+    return NULL;
+}
+
+static int stats_threads(void) {
+    pthread_t id[NTHREADS];
+    int       i;
+
+    for (i=0; i<NTHREADS; i++)
+      pthread_create(&id[i], NULL, stats_worker, (void*)(size_t)i);
+    for (i=0; i<NTHREADS; i++)
+      pthread_join(id[i], NULL);
+    return NTHREADS * NCALLS;
+}
+
+// what maru_stats_key should count for n strings
+static void stats_expect(maru_stats_ctr *c, size_t len, size_t n, int blk) {
+    c->bytes  += len * n;
+    c->blocks += (len / blk + 1 + (len % blk >= (size_t)blk - 4)) * n;
+    c->pad    += (len % blk >= (size_t)blk - 4) * n;
+}
+
+// compare counts since a with what was expected
+static int stats_check(int fn, const maru_stats_ctr *a, const maru_stats_ctr *e) {
+    maru_stats_ctr b;
+
+    maru_stats_get(fn, &b);
+    return b.calls - a->calls == e->calls && b.keys - a->keys == e->keys &&
+           b.bytes - a->bytes == e->bytes && b.blocks - a->blocks == e->blocks &&
+           b.pad - a->pad == e->pad;
+}
+
+int main(int argc, char *argv[]) {
+    char           key[MARU2_MAX_STR+3][MARU2_MAX_STR+3], *buf;
+    const char     *keys[MARU2_MAX_STR+3];
+    uint64_t       h64[MARU2_MAX_STR+3], ivs[10];
+    uint8_t        h[MARU2_MAX_STR+3][MARU2_HASH_LEN];
+    maru_stats_ctr a[MARU_STATS_FN], e[MARU_STATS_FN];
+    maru2_ctx      ctx;
+    FILE           *f;
+    long           len;
+    int            i, j, ok, fd, save;
+
+    for (i=0; i<MARU2_MAX_STR+3; i++) {
+      for (j=0; j<i; j++) key[i][j] = (char)('a' + (i * 7 + j) % 26);
+      key[i][i] = 0;
+      keys[i] = key[i];
+    }
+    for (i=0; i<10; i++) ivs[i] = i;
+
+    // counts start from zero, the kernel self-tests of the first
+    // batch calls below must not show up in them
+    memset(a, 0, sizeof(a));
+    memset(e, 0, sizeof(e));
+
+    // 12 bytes leave no space for the length
+    maru_n(key[12], 12, 0);
+    maru_n(key[64], 100, 0);
+    e[MARU_FN_N].calls = e[MARU_FN_N].keys = 2;
+    stats_expect(&e[MARU_FN_N], 12, 1, MARU_BLK_LEN);
+    stats_expect(&e[MARU_FN_N], 64, 1, MARU_BLK_LEN);
+
+    maru_batch(keys, MARU2_MAX_STR+3, 0, h64);
+    maru2_batch(keys, MARU2_MAX_STR+3, 0, h);
+    e[MARU_FN_BATCH].calls = e[MARU2_FN_BATCH].calls = 1;
+    e[MARU_FN_BATCH].keys = e[MARU2_FN_BATCH].keys = MARU2_MAX_STR+3;
+    for (i=0; i<MARU2_MAX_STR+3; i++) {
+      stats_expect(&e[MARU_FN_BATCH], i < MARU_MAX_STR ? i : MARU_MAX_STR, 1, MARU_BLK_LEN);
+      stats_expect(&e[MARU2_FN_BATCH], i < MARU2_MAX_STR ? i : MARU2_MAX_STR, 1, MARU2_BLK_LEN);
+    }
+    maru2_multi_seed(key[40], ivs, 10, h);
+    e[MARU2_FN_MULTI].calls = 1;
+    e[MARU2_FN_MULTI].keys = 10;
+    stats_expect(&e[MARU2_FN_MULTI], 40, 10, MARU2_BLK_LEN);
+
+    maru2_init(&ctx, 0);
+    maru2_update(&ctx, key[50], 50);
+    maru2_update(&ctx, key[50], 50);
+    maru2_final(&ctx, h[0]);
+    e[MARU2_FN_STREAM].calls = e[MARU2_FN_STREAM].keys = 1;
+    stats_expect(&e[MARU2_FN_STREAM], 100, 1, MARU2_BLK_LEN);
+
+    for (ok=1, i=0; i<MARU_STATS_FN; i++) {
+      if (i == MARU2_FN_N) continue;
+      ok &= stats_check(i, &a[i], &e[i]);
+    }
+    printf("counters          : %s\n", ok ? "OK" : "FAIL");
+
+    // threads that exited still count, twice as many threads as blocks
+    e[MARU2_FN_N].calls = e[MARU2_FN_N].keys = stats_threads() + stats_threads();
+    stats_expect(&e[MARU2_FN_N], 6, e[MARU2_FN_N].calls, MARU2_BLK_LEN);
+    ok = stats_check(MARU2_FN_N, &a[MARU2_FN_N], &e[MARU2_FN_N]);
+    printf("threads           : %s\n", ok ? "OK" : "FAIL");
+
+    // dump on a signal, to a file in place of stderr
+    f = tmpfile();
+    fd = fileno(f);
+    save = dup(2);
+    ok = maru_stats_signal(SIGUSR1) == 0;
+    dup2(fd, 2);
+    raise(SIGUSR1);
+    dup2(save, 2);
+    close(save);
+
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    rewind(f);
+    buf = calloc(1, len + 1);
+    ok &= buf != NULL && fread(buf, 1, len, f) == (size_t)len;
+    ok &= buf != NULL && strstr(buf, "maru_calls_total{fn=\"maru2_n\"} ") != NULL;
+    ok &= buf != NULL && strstr(buf, "maru_cycles_count{fn=\"maru2_n\",kernel=\"scalar\"} ") != NULL;
+    ok &= buf != NULL && strstr(buf, "le=\"+Inf\"") != NULL;
+    printf("signal dump       : %s\n", ok ? "OK" : "FAIL");
+    free(buf);
+    fclose(f);
+
+    // -d prints the dump
+    if (argc > 1 && strcmp(argv[1], "-d") == 0) {
+      fflush(stdout);
+      maru_stats_write(1);
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,94 @@
+/**
+  Copyright © 2017 Odzhan. All Rights Reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  3. The name of the author may not be used to endorse or promote products
+  derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY AUTHORS "AS IS" AND ANY EXPRESS OR
+  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+  STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE. */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Counters and latency histograms for the hash functions, compiled in
+// with MARU_STATS. Without it the macros below are empty and maru.c
+// and maru2.c build as before.
+
+// entry points
+#define MARU_FN_N        0 // maru_n, maru
+#define MARU_FN_BATCH    1 // maru_batch
+#define MARU_FN_STREAM   2 // maru_final
+#define MARU2_FN_N       3 // maru2_n, maru2 and its variants
+#define MARU2_FN_BATCH   4 // maru2_batch
+#define MARU2_FN_MULTI   5 // maru2_multi_seed
+#define MARU2_FN_STREAM  6 // maru2_final, and tree leaves without SIMD
+#define MARU_STATS_FN    7
+
+#define MARU_STATS_KERN  4 // scalar, sse4, avx2, avx512
+#define MARU_STATS_BINS 32 // log2 of cycles
+
+typedef struct _maru_stats_ctr {
+  uint64_t calls;   // calls of the entry point
+  uint64_t keys;    // strings hashed
+  uint64_t bytes;   // bytes hashed, after truncation
+  uint64_t blocks;  // compressions
+  uint64_t pad;     // extra blocks for the length
+} maru_stats_ctr;
+
+#ifdef MARU_STATS
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint64_t maru_stats_now(void);
+void maru_stats_key(int fn, size_t len, size_t n, int blk);
+void maru_stats_call(int fn, const char *kern, size_t keys, uint64_t t0);
+
+void maru_stats_get(int fn, maru_stats_ctr *c);
+int maru_stats_write(int fd);
+int maru_stats_signal(int sig);
+
+#ifdef __cplusplus
+}
+#endif
+
+// declare t and read the clock, right after the declarations
+#define MARU_STAT_BEGIN(t)              uint64_t t = maru_stats_now()
+// n strings of len bytes, in blocks of blk bytes
+#define MARU_STAT_KEY(fn, len, n, blk)  maru_stats_key(fn, len, n, blk)
+// one call on kernel kern, t0 of 0 isn't timed
+#define MARU_STAT_END(fn, kern, n, t0)  maru_stats_call(fn, kern, n, t0)
+
+#else
+
+#define MARU_STAT_BEGIN(t)              ((void)0)
+#define MARU_STAT_KEY(fn, len, n, blk)  ((void)0)
+#define MARU_STAT_END(fn, kern, n, t0)  ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,411 @@
+/**
+  Copyright © 2017 Odzhan. All Rights Reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  3. The name of the author may not be used to endorse or promote products
+  derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY AUTHORS "AS IS" AND ANY EXPRESS OR
+  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+  STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE. */
+
+#include <stdlib.h>
+
+#include "strmap.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+// Open addressing in groups of 16 slots. Each slot has a control byte:
+// empty, deleted, or 7 bits of the hash for a full slot. A lookup
+// compares the 7 bits against a whole group at once, then the stored
+// 64-bit hash, and only then the key. Groups are probed in triangular
+// order, which visits every group of a power of 2 table.
+//
+// The hash is the first 8 bytes of maru2 for keys up to MARU2_MAX_STR,
+// so a hash from maru2_batch can be passed to the _hash calls. Longer
+// keys are hashed in full with the streaming API.
+
+#define MARU_MAP_GROUP   16
+#define MARU_MAP_EMPTY   0x80
+#define MARU_MAP_DELETED 0xFE
+#define MARU_MAP_ARENA   (64*1024)
+
+typedef struct _maru_map_ent {
+  uint64_t   hash;
+  const char *key;
+  size_t     len;
+  void       *val;
+} maru_map_ent;
+
+// keys are copied to chunks that are freed all at once
+typedef struct _maru_arena {
+  struct _maru_arena *next;
+  size_t             used, size;
+  char               buf[1];
+} maru_arena;
+
+struct _maru_map {
+  uint8_t      *ctrl;
+  maru_map_ent *ent;
+  size_t       cap;     // slots, a power of 2 and at least one group
+  size_t       used;    // full slots
+  size_t       dead;    // deleted slots
+  uint64_t     iv;
+  maru_arena   *arena;
+};
+
+static char *maru_map_copy(maru_map *m, const void *key, size_t len) {
+    maru_arena *a = m->arena;
+    char       *p;
+    size_t     size;
+
+    if (a == NULL || a->size - a->used < len + 1) {
+      size = len + 1 > MARU_MAP_ARENA ? len + 1 : MARU_MAP_ARENA;
+      a = malloc(sizeof(maru_arena) + size);
+      if (a == NULL) return NULL;
+      a->next = m->arena;
+      a->used = 0;
+      a->size = size;
+      m->arena = a;
+    }
+    p = a->buf + a->used;
+    memcpy(p, key, len);
+    p[len] = 0;
+    a->used += len + 1;
+    return p;
+}
+
+// bit i set if slot i of the group has control byte c
+static uint32_t maru_map_match(const uint8_t *g, uint8_t c) {
+#if defined(__SSE2__) || defined(_M_X64)
+    __m128i v = _mm_loadu_si128((const __m128i*)g);
+
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8((char)c)));
+#else
+    uint32_t r = 0;
+    int      i;
+
+    for (i=0; i<MARU_MAP_GROUP; i++)
+      r |= (uint32_t)(g[i] == c) << i;
+    return r;
+#endif
+}
+
+// bit i set if slot i of the group is empty or deleted
+static uint32_t maru_map_free_slots(const uint8_t *g) {
+#if defined(__SSE2__) || defined(_M_X64)
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)g));
+#else
+    uint32_t r = 0;
+    int      i;
+
+    for (i=0; i<MARU_MAP_GROUP; i++)
+      r |= (uint32_t)(g[i] >> 7) << i;
+    return r;
+#endif
+}
+
+static int maru_map_ctz(uint32_t x) {
+#ifdef __GNUC__
+    return __builtin_ctz(x);
+#else
+    int i;
+
+    for (i=0; !(x & 1); i++) x >>= 1;
+    return i;
+#endif
+}
+
+static int maru_map_init(maru_map *m, size_t cap) {
+    m->ctrl = malloc(cap);
+    m->ent  = malloc(cap * sizeof(maru_map_ent));
+    if (m->ctrl == NULL || m->ent == NULL) {
+      free(m->ctrl);
+      free(m->ent);
+      return 0;
+    }
+    memset(m->ctrl, MARU_MAP_EMPTY, cap);
+    m->cap  = cap;
+    m->used = 0;
+    m->dead = 0;
+    return 1;
+}
+
+// slot of key, or the first free slot seen if absent and ins is set
+static size_t maru_map_find(const maru_map *m, const void *key, size_t len,
+  uint64_t h, int ins, int *found)
+{
+    size_t   ng = m->cap / MARU_MAP_GROUP, g, i, s, slot = m->cap;
+    uint8_t  tag = (uint8_t)(h & 0x7F);
+    uint32_t x;
+
+    g = (size_t)(h >> 7) & (ng - 1);
+
+    for (i=1; ; g = (g + i++) & (ng - 1)) {
+      const uint8_t *c = m->ctrl + g * MARU_MAP_GROUP;
+
+      for (x = maru_map_match(c, tag); x != 0; x &= x - 1) {
+        s = g * MARU_MAP_GROUP + maru_map_ctz(x);
+        if (m->ent[s].hash == h && m->ent[s].len == len &&
+            memcmp(m->ent[s].key, key, len) == 0) {
+          *found = 1;
+          return s;
+        }
+      }
+      x = maru_map_free_slots(c);
+      if (ins && slot == m->cap && x != 0)
+        slot = g * MARU_MAP_GROUP + maru_map_ctz(x);
+      // an empty slot ends the probe sequence
+      if (maru_map_match(c, MARU_MAP_EMPTY) != 0 || i > ng) break;
+    }
+    *found = 0;
+    return slot;
+}
+
+// move entries to a table of cap slots, without hashing keys again
+static int maru_map_resize(maru_map *m, size_t cap) {
+    maru_map     old = *m;
+    maru_map_ent *e;
+    size_t       i, s;
+    int          found;
+
+    if (!maru_map_init(m, cap)) {
+      *m = old;
+      return 0;
+    }
+    for (i=0; i<old.cap; i++) {
+      if (old.ctrl[i] & 0x80) continue;
+      e = &old.ent[i];
+      s = maru_map_find(m, e->key, e->len, e->hash, 1, &found);
+      m->ctrl[s] = (uint8_t)(e->hash & 0x7F);
+      m->ent[s]  = *e;
+      m->used++;
+    }
+    free(old.ctrl);
+    free(old.ent);
+    return 1;
+}
+
+maru_map *maru_map_new(size_t n, uint64_t iv) {
+    maru_map *m = calloc(1, sizeof(maru_map));
+    size_t   cap = MARU_MAP_GROUP;
+
+    if (m == NULL) return NULL;
+
+    // room for n keys at 7/8 load
+    while (cap / 8 * 7 < n) cap *= 2;
+
+    m->iv = iv;
+    if (!maru_map_init(m, cap)) {
+      free(m);
+      return NULL;
+    }
+    return m;
+}
+
+void maru_map_free(maru_map *m) {
+    maru_arena *a, *n;
+
+    if (m == NULL) return;
+    for (a=m->arena; a!=NULL; a=n) {
+      n = a->next;
+      free(a);
+    }
+    free(m->ctrl);
+    free(m->ent);
+    free(m);
+}
+
+size_t maru_map_size(const maru_map *m) {
+    return m->used;
+}
+
+uint64_t maru_map_hash(const maru_map *m, const void *key, size_t len) {
+    maru2_ctx ctx;
+    uint64_t  h[2];
+
+    if (len <= MARU2_MAX_STR) {
+      maru2_n(key, len, m->iv, h);
+    } else {
+      maru2_init(&ctx, m->iv);
+      maru2_update(&ctx, key, len);
+      maru2_final(&ctx, h);
+    }
+    return h[0];
+}
+
+// 1 if key was added, 0 if its value was replaced, -1 if out of memory
+int maru_map_put_hash(maru_map *m, const void *key, size_t len, uint64_t h, void *val) {
+    const char *k;
+    size_t     s;
+    int        found;
+
+    s = maru_map_find(m, key, len, h, 1, &found);
+    if (found) {
+      m->ent[s].val = val;
+      return 0;
+    }
+    // grow at 7/8 full, or rebuild when deleted slots fill the table
+    if (m->used + m->dead + 1 > m->cap / 8 * 7) {
+      if (!maru_map_resize(m, m->used + 1 > m->cap / 2 ? m->cap * 2 : m->cap))
+        return -1;
+      s = maru_map_find(m, key, len, h, 1, &found);
+    }
+    k = maru_map_copy(m, key, len);
+    if (k == NULL) return -1;
+
+    if (m->ctrl[s] == MARU_MAP_DELETED) m->dead--;
+    m->ctrl[s] = (uint8_t)(h & 0x7F);
+    m->ent[s].hash = h;
+    m->ent[s].key  = k;
+    m->ent[s].len  = len;
+    m->ent[s].val  = val;
+    m->used++;
+    return 1;
+}
+
+int maru_map_get_hash(const maru_map *m, const void *key, size_t len, uint64_t h, void **val) {
+    size_t s;
+    int    found;
+
+    s = maru_map_find(m, key, len, h, 0, &found);
+    if (found && val != NULL) *val = m->ent[s].val;
+    return found;
+}
+
+int maru_map_put(maru_map *m, const void *key, size_t len, void *val) {
+    return maru_map_put_hash(m, key, len, maru_map_hash(m, key, len), val);
+}
+
+int maru_map_get(const maru_map *m, const void *key, size_t len, void **val) {
+    return maru_map_get_hash(m, key, len, maru_map_hash(m, key, len), val);
+}
+
+// the key stays in the arena until the map is freed
+int maru_map_del(maru_map *m, const void *key, size_t len) {
+    size_t s;
+    int    found;
+
+    s = maru_map_find(m, key, len, maru_map_hash(m, key, len), 0, &found);
+    if (!found) return 0;
+
+    m->ctrl[s] = MARU_MAP_DELETED;
+    m->used--;
+    m->dead++;
+    return 1;
+}
+
+#ifdef TEST
+
+#include <stdio.h>
+#include <time.h>
+
+#define NKEYS  500000
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(void) {
+    maru_map    *m;
+    char        *arena, big[200];
+    const char  **keys;
+    uint8_t     (*h)[MARU2_HASH_LEN];
+    uint64_t    x;
+    void        *v = NULL;
+    size_t      i, len;
+    double      t0, t1, t2;
+    int         equ;
+
+    keys  = malloc(NKEYS * sizeof(char*));
+    arena = malloc(NKEYS * 32);
+    h     = malloc(NKEYS * MARU2_HASH_LEN);
+    m     = maru_map_new(0, 0x15DF1E4BE5E7970FULL);
+    if (keys == NULL || arena == NULL || h == NULL || m == NULL) {
+      printf ("out of memory\n");
+      return 1;
+    }
+    for (i=0; i<NKEYS; i++) {
+      keys[i] = arena + i * 32;
+      snprintf(arena + i * 32, 32, "sym_%zu_%zx", i, i * 2654435761u);
+    }
+    // insert, growing from one group
+    t0 = now();
+    for (i=0, equ=1; i<NKEYS; i++)
+      equ &= maru_map_put(m, keys[i], strlen(keys[i]), (void*)(i + 1)) == 1;
+    t1 = now();
+    equ &= maru_map_size(m) == NKEYS;
+    printf ("maru_map_put(%d keys) : %s, %.1f ns per key\n", NKEYS,
+      equ ? "OK" : "FAIL", (t1 - t0) * 1e9 / NKEYS);
+
+    // look up, then again with hashes from maru2_batch
+    t0 = now();
+    for (i=0, equ=1; i<NKEYS; i++)
+      equ &= maru_map_get(m, keys[i], strlen(keys[i]), &v) && v == (void*)(i + 1);
+    t1 = now();
+    maru2_batch(keys, NKEYS, 0x15DF1E4BE5E7970FULL, h);
+    for (i=0; i<NKEYS; i++) {
+      memcpy(&x, h[i], 8);
+      equ &= maru_map_get_hash(m, keys[i], strlen(keys[i]), x, &v) && v == (void*)(i + 1);
+    }
+    t2 = now();
+    printf ("maru_map_get(%d keys) : %s, %.1f ns per key, %.1f with maru2_batch\n",
+      NKEYS, equ ? "OK" : "FAIL", (t1 - t0) * 1e9 / NKEYS, (t2 - t1) * 1e9 / NKEYS);
+
+    // prefixes are different keys, and are missing
+    for (i=0, equ=1; i<NKEYS; i++)
+      equ &= !maru_map_get(m, keys[i], strlen(keys[i]) - 1, NULL);
+    printf ("maru_map_get(missing keys) : %s\n", equ ? "OK" : "FAIL");
+
+    // replace, delete half and add them back
+    for (i=0, equ=1; i<NKEYS; i++)
+      equ &= maru_map_put(m, keys[i], strlen(keys[i]), (void*)(i + 2)) == 0;
+    for (i=0; i<NKEYS; i+=2)
+      equ &= maru_map_del(m, keys[i], strlen(keys[i]));
+    equ &= maru_map_size(m) == NKEYS / 2;
+    for (i=0; i<NKEYS; i++)
+      equ &= maru_map_get(m, keys[i], strlen(keys[i]), &v) == (int)(i & 1) &&
+             (!(i & 1) || v == (void*)(i + 2));
+    for (i=0; i<NKEYS; i+=2)
+      equ &= maru_map_put(m, keys[i], strlen(keys[i]), (void*)i) == 1;
+    equ &= maru_map_size(m) == NKEYS;
+    printf ("maru_map_del() : %s\n", equ ? "OK" : "FAIL");
+
+    // keys longer than MARU2_MAX_STR that share a prefix
+    memset(big, 'A', sizeof(big));
+    for (len=MARU2_MAX_STR; len<sizeof(big); len++)
+      equ &= maru_map_put(m, big, len, (void*)len) == 1;
+    for (len=MARU2_MAX_STR; len<sizeof(big); len++)
+      equ &= maru_map_get(m, big, len, &v) && v == (void*)len;
+    printf ("maru_map_put(long keys) : %s\n", equ ? "OK" : "FAIL");
+
+    maru_map_free(m);
+    free(keys);
+    free(arena);
+    free(h);
+    return 0;
+}
+#endif
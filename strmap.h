@@ -0,0 +1,58 @@
+/**
+  Copyright © 2017 Odzhan. All Rights Reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  3. The name of the author may not be used to endorse or promote products
+  derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY AUTHORS "AS IS" AND ANY EXPRESS OR
+  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+  STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE. */
+
+#ifndef STRMAP_H
+#define STRMAP_H
+
+#include "maru2.h"
+
+typedef struct _maru_map maru_map;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  maru_map *maru_map_new (size_t, uint64_t);
+  void maru_map_free (maru_map*);
+  size_t maru_map_size (const maru_map*);
+
+  uint64_t maru_map_hash (const maru_map*, const void*, size_t);
+
+  int maru_map_put (maru_map*, const void*, size_t, void*);
+  int maru_map_get (const maru_map*, const void*, size_t, void**);
+  int maru_map_del (maru_map*, const void*, size_t);
+
+  int maru_map_put_hash (maru_map*, const void*, size_t, uint64_t, void*);
+  int maru_map_get_hash (const maru_map*, const void*, size_t, uint64_t, void**);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
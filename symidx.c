@@ -0,0 +1,877 @@
+/**
+  Copyright © 2017 Odzhan. All Rights Reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  3. The name of the author may not be used to endorse or promote products
+  derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY AUTHORS "AS IS" AND ANY EXPRESS OR
+  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+  STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE. */
+
+// On-disk index from hash to name for large sets of names, made to be
+// mapped and read in place. Opening one is an mmap and a check of the
+// header, and a lookup touches a few pages of keys and one of names.
+//
+// Keys are sorted, not in Eytzinger order. Hashes are uniform, so a
+// directory on the top bits of the key narrows a lookup to about four
+// keys on one cache line, and names with the same key sit together.
+//
+// The build maps the input and splits it into jobs over the threads.
+// Each job hashes its names and radix sorts them into a run, which is
+// kept in memory while the budget allows, else written to a temporary
+// file of the thread. The runs are merged into the index at the end.
+// The pool is the input itself, with line ends changed to NUL.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "symidx.h"
+#include "keys.h"
+
+#define IDX_BATCH  1024             // names per call to the batch API
+#define IDX_MIN    (64 * 1024)      // least records in a run
+#define IDX_OUT    8192             // keys and offsets per write
+
+typedef struct _idx_rec {
+  uint64_t key;
+  uint64_t off;                     // of the name in the input
+} idx_rec;
+
+typedef struct _idx_run {
+  idx_rec *mem;                     // sorted records, or NULL if in a file
+  int     fd;
+  off_t   pos;                      // of the run in the file
+  size_t  n;
+} idx_run;
+
+typedef struct _idx_build {
+  const char *data;
+  size_t     len;
+  const char *out;
+  int        algo, variant;
+  uint64_t   iv;
+  size_t     chunk;                 // bytes of input per job
+  size_t     cap;                   // records a job can make
+  uint64_t   njobs, next;
+  size_t     mem, used;             // bytes of runs kept in memory
+  idx_run    *runs;
+  int        *fds;                  // temporary files, one per thread
+  int        nfd;
+  int        err;
+} idx_build;
+
+typedef struct _idx_buf {
+  char        *key;                 // IDX_BATCH names, NUL terminated
+  const char  *keys[IDX_BATCH];
+  uint64_t    off[IDX_BATCH];
+  uint64_t    h[IDX_BATCH];
+  uint8_t     h2[IDX_BATCH][MARU2_HASH_LEN];
+  size_t      n;
+  idx_rec     *rec, *tmp;
+  size_t      nrec;
+  int         fd;                   // temporary file of the thread
+  off_t       pos;
+} idx_buf;
+
+struct _maru_idx {
+  const uint8_t      *map;
+  size_t             size;
+  const maru_idx_hdr *h;
+  const uint64_t     *dir, *keys, *offs;
+  const char         *pool;
+};
+
+static int idx_pwrite(int fd, const void *p, size_t len, off_t pos) {
+    ssize_t r;
+
+    for (; len != 0; p = (const uint8_t*)p + r, len -= r, pos += r) {
+      r = pwrite(fd, p, len, pos);
+      if (r < 0 && errno == EINTR) r = 0;
+      else if (r <= 0) return 0;
+    }
+    return 1;
+}
+
+static int idx_pread(int fd, void *p, size_t len, off_t pos) {
+    ssize_t r;
+
+    for (; len != 0; p = (uint8_t*)p + r, len -= r, pos += r) {
+      r = pread(fd, p, len, pos);
+      if (r < 0 && errno == EINTR) r = 0;
+      else if (r <= 0) return 0;
+    }
+    return 1;
+}
+
+// directory entry of key
+static uint64_t idx_top(uint64_t key, uint64_t bits) {
+    return bits ? key >> (64 - bits) : 0;
+}
+
+// a temporary file next to the output, gone when it's closed
+static int idx_temp(const char *out, char *path, size_t size) {
+    int fd;
+
+    snprintf(path, size, "%s.XXXXXX", out);
+    fd = mkstemp(path);
+    return fd;
+}
+
+// hash the names of the batch and add their records
+static void idx_flush(idx_build *b, idx_buf *f) {
+    idx_rec *r;
+    size_t  i;
+
+    if (f->n == 0) return;
+
+    if (b->algo == MARU_IDX_MARU) {
+      maru_batch(f->keys, f->n, b->iv, f->h);
+    } else if (b->variant == MARU_IDX_CI) {
+      for (i=0; i<f->n; i++) maru2_ci(f->keys[i], b->iv, f->h2[i]);
+    } else {
+      maru2_batch(f->keys, f->n, b->iv, f->h2);
+    }
+    for (i=0; i<f->n; i++) {
+      r = &f->rec[f->nrec++];
+      if (b->algo == MARU_IDX_MARU) r->key = f->h[i];
+      else memcpy(&r->key, f->h2[i], 8);
+      r->off = f->off[i];
+    }
+    f->n = 0;
+}
+
+// LSD radix sort on the key, stable so equal keys keep input order.
+// returns a or t, whichever has the result.
+static idx_rec *idx_sort(idx_rec *a, idx_rec *t, size_t n) {
+    size_t  cnt[256], i, s, c;
+    idx_rec *x;
+    int     d;
+
+    for (d=0; n != 0 && d<64; d+=8) {
+      memset(cnt, 0, sizeof(cnt));
+      for (i=0; i<n; i++) cnt[(a[i].key >> d) & 255]++;
+      // every key has the same digit
+      if (cnt[(a[0].key >> d) & 255] == n) continue;
+
+      for (i=0, s=0; i<256; i++) {
+        c = cnt[i];
+        cnt[i] = s;
+        s += c;
+      }
+      for (i=0; i<n; i++) t[cnt[(a[i].key >> d) & 255]++] = a[i];
+      x = a; a = t; t = x;
+    }
+    return a;
+}
+
+// keep the run in memory if the budget allows, else add it to the file
+static int idx_store(idx_build *b, idx_buf *f, idx_run *run, const idx_rec *r) {
+    char   path[4096];
+    size_t bytes = f->nrec * sizeof(idx_rec);
+
+    run->n  = f->nrec;
+    run->fd = -1;
+
+    if (__atomic_add_fetch(&b->used, bytes, __ATOMIC_RELAXED) <= b->mem) {
+      run->mem = (idx_rec*)malloc(bytes ? bytes : 1);
+      if (run->mem != NULL) {
+        memcpy(run->mem, r, bytes);
+        return 1;
+      }
+    }
+    __atomic_sub_fetch(&b->used, bytes, __ATOMIC_RELAXED);
+
+    if (f->fd < 0) {
+      f->fd = idx_temp(b->out, path, sizeof(path));
+      if (f->fd < 0) return 0;
+      unlink(path);
+      b->fds[__atomic_fetch_add(&b->nfd, 1, __ATOMIC_RELAXED)] = f->fd;
+    }
+    if (!idx_pwrite(f->fd, r, bytes, f->pos)) return 0;
+    run->fd  = f->fd;
+    run->pos = f->pos;
+    f->pos  += bytes;
+    return 1;
+}
+
+static void *idx_worker(void *arg) {
+    idx_build *b = (idx_build*)arg;
+    idx_buf   *f;
+    maru_keys k;
+    uint64_t  j;
+
+    f = (idx_buf*)calloc(1, sizeof(idx_buf));
+    if (f == NULL) {
+      b->err = 1;
+      return NULL;
+    }
+    f->fd  = -1;
+    f->key = (char*)malloc(IDX_BATCH * MARU_KEY_LEN);
+    f->rec = (idx_rec*)malloc(b->cap * sizeof(idx_rec));
+    f->tmp = (idx_rec*)malloc(b->cap * sizeof(idx_rec));
+    if (f->key == NULL || f->rec == NULL || f->tmp == NULL) b->err = 1;
+
+    while (!b->err && (j = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED)) < b->njobs) {
+      maru_keys_job(&k, b->data, b->len, b->chunk, j, '\n');
+      while (maru_keys_next(&k, f->key + f->n * MARU_KEY_LEN, &f->off[f->n])) {
+        f->keys[f->n] = f->key + f->n * MARU_KEY_LEN;
+        if (++f->n == IDX_BATCH) idx_flush(b, f);
+      }
+      idx_flush(b, f);
+
+      if (!idx_store(b, f, &b->runs[j], idx_sort(f->rec, f->tmp, f->nrec))) b->err = 1;
+      f->nrec = 0;
+    }
+    free(f->key);
+    free(f->rec);
+    free(f->tmp);
+    free(f);
+    return NULL;
+}
+
+typedef struct _idx_src {
+  idx_run *run;
+  idx_rec *buf;
+  size_t  pos, len, done;
+} idx_src;
+
+// current record of s, refilled from its file, NULL at the end
+static idx_rec *idx_cur(idx_src *s, size_t max) {
+    size_t m;
+
+    if (s->pos < s->len) return &s->buf[s->pos];
+    if (s->run->mem != NULL || s->done == s->run->n) return NULL;
+
+    m = s->run->n - s->done;
+    if (m > max) m = max;
+    if (!idx_pread(s->run->fd, s->buf, m * sizeof(idx_rec),
+          s->run->pos + s->done * sizeof(idx_rec))) return NULL;
+    s->pos   = 0;
+    s->len   = m;
+    s->done += m;
+    return &s->buf[0];
+}
+
+static int idx_less(idx_src *a, idx_src *b) {
+    const idx_rec *x = &a->buf[a->pos], *y = &b->buf[b->pos];
+
+    return x->key < y->key || (x->key == y->key && x->off < y->off);
+}
+
+static void idx_down(idx_src **h, size_t n, size_t i) {
+    idx_src *t;
+    size_t  c;
+
+    for (; (c = 2 * i + 1) < n; i = c) {
+      if (c + 1 < n && idx_less(h[c + 1], h[c])) c++;
+      if (!idx_less(h[c], h[i])) break;
+      t = h[i]; h[i] = h[c]; h[c] = t;
+    }
+}
+
+typedef struct _idx_out {
+  int      fd;
+  off_t    pos;
+  size_t   n;
+  uint64_t buf[IDX_OUT];
+} idx_out;
+
+static int idx_put(idx_out *o, uint64_t v) {
+    if (o->n == IDX_OUT) {
+      if (!idx_pwrite(o->fd, o->buf, sizeof(o->buf), o->pos)) return 0;
+      o->pos += sizeof(o->buf);
+      o->n = 0;
+    }
+    o->buf[o->n++] = v;
+    return 1;
+}
+
+static int idx_end(idx_out *o) {
+    return idx_pwrite(o->fd, o->buf, o->n * sizeof(uint64_t), o->pos);
+}
+
+// merge the runs into the keys and offsets of the index
+static int idx_merge(idx_build *b, int fd, const maru_idx_hdr *h) {
+    idx_src  **heap, *src;
+    idx_out  *ko, *oo, *d;
+    idx_rec  *r;
+    uint64_t k, p;
+    size_t   i, n, max;
+    int      ok = 0;
+
+    src  = (idx_src*)calloc(b->njobs + 1, sizeof(idx_src));
+    heap = (idx_src**)calloc(b->njobs + 1, sizeof(idx_src*));
+    ko   = (idx_out*)calloc(1, sizeof(idx_out));
+    oo   = (idx_out*)calloc(1, sizeof(idx_out));
+    d    = (idx_out*)calloc(1, sizeof(idx_out));
+    if (src == NULL || heap == NULL || ko == NULL || oo == NULL || d == NULL) goto done;
+
+    // runs in files share half of the budget for their buffers
+    max = b->mem / 2 / ((b->njobs + 1) * sizeof(idx_rec));
+    if (max < 256) max = 256;
+
+    for (i=0, n=0; i<b->njobs; i++) {
+      src[i].run = &b->runs[i];
+      if (b->runs[i].mem != NULL) {
+        src[i].buf = b->runs[i].mem;
+        src[i].len = b->runs[i].n;
+      } else {
+        src[i].buf = (idx_rec*)malloc(max * sizeof(idx_rec));
+        if (src[i].buf == NULL) goto done;
+      }
+      if (idx_cur(&src[i], max) != NULL) heap[n++] = &src[i];
+    }
+    for (i=n/2; i-- > 0;) idx_down(heap, n, i);
+
+    ko->fd = oo->fd = d->fd = fd;
+    ko->pos = h->keys;
+    oo->pos = h->offs;
+    d->pos  = h->dir;
+
+    for (k=0, p=0; n != 0; k++) {
+      r = &heap[0]->buf[heap[0]->pos++];
+      // directory entries up to the prefix of this key start here
+      for (; p <= idx_top(r->key, h->dir_bits); p++)
+        if (!idx_put(d, k)) goto done;
+      if (!idx_put(ko, r->key) || !idx_put(oo, r->off)) goto done;
+      if (idx_cur(heap[0], max) == NULL) heap[0] = heap[--n];
+      idx_down(heap, n, 0);
+    }
+    for (; p <= (1ULL << h->dir_bits); p++)
+      if (!idx_put(d, k)) goto done;
+    ok = idx_end(ko) && idx_end(oo) && idx_end(d);
+done:
+    for (i=0; src != NULL && i<b->njobs; i++)
+      if (b->runs[i].mem == NULL) free(src[i].buf);
+    free(src);
+    free(heap);
+    free(ko);
+    free(oo);
+    free(d);
+    return ok;
+}
+
+// the input with line ends as NUL, and one more NUL
+static int idx_pool(idx_build *b, int fd, off_t pos) {
+    char   *buf;
+    size_t i, j, n;
+    int    ok = 1;
+
+    buf = (char*)malloc(1 << 20);
+    if (buf == NULL) return 0;
+
+    for (i=0; ok && i<=b->len; i+=n) {
+      n = (b->len + 1 - i < (1 << 20)) ? b->len + 1 - i : (1 << 20);
+      for (j=0; j<n; j++) {
+        char c = (i + j < b->len) ? b->data[i + j] : '\n';
+
+        if (c == '\r' && (i + j + 1 == b->len || b->data[i + j + 1] == '\n')) c = '\n';
+        buf[j] = (c == '\n') ? 0 : c;
+      }
+      ok = idx_pwrite(fd, buf, n, pos + i);
+    }
+    free(buf);
+    return ok;
+}
+
+static uint64_t idx_align(uint64_t x) {
+    return (x + MARU_IDX_ALIGN - 1) & ~(uint64_t)(MARU_IDX_ALIGN - 1);
+}
+
+// index the names of in, one per line, with up to mem bytes of memory.
+// the index is written next to out and renamed when it's complete.
+int maru_idx_build(const char *in, const char *out, int algo, int variant,
+  uint64_t iv, int threads, size_t mem)
+{
+    maru_idx_hdr h;
+    idx_build    b;
+    pthread_t    *id = NULL;
+    struct stat  st;
+    char         path[4096];
+    size_t       i;
+    int          fd, ofd = -1, ok = 0, t = 0;
+
+    if (algo != MARU_IDX_MARU && algo != MARU_IDX_MARU2) return -1;
+    if (variant == MARU_IDX_CI && algo != MARU_IDX_MARU2) return -1;
+    if (threads < 1) threads = 1;
+
+    memset(&b, 0, sizeof(b));
+    b.out     = out;
+    b.algo    = algo;
+    b.variant = variant;
+    b.iv      = iv;
+    b.mem     = mem;
+
+    fd = open(in, O_RDONLY);
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) < 0) {
+      close(fd);
+      return -1;
+    }
+    b.len  = (size_t)st.st_size;
+    b.data = "";
+    if (b.len != 0) {
+      b.data = mmap(NULL, b.len, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (b.data == MAP_FAILED) {
+        close(fd);
+        return -1;
+      }
+      madvise((void*)b.data, b.len, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    // a run and its sort buffer for each thread get half of the budget,
+    // a job of 2 bytes per record can't have more names than that
+    b.cap = mem / 2 / (2 * sizeof(idx_rec) * threads);
+    if (b.cap < IDX_MIN) b.cap = IDX_MIN;
+    b.chunk = 2 * (b.cap - 1);
+    b.njobs = (b.len + b.chunk - 1) / b.chunk;
+    b.mem   = mem / 2;
+    b.runs  = (idx_run*)calloc(b.njobs + 1, sizeof(idx_run));
+    b.fds   = (int*)calloc(threads, sizeof(int));
+    id      = (pthread_t*)calloc(threads, sizeof(pthread_t));
+    if (b.runs == NULL || b.fds == NULL || id == NULL) goto done;
+
+    for (t=0; t<threads; t++)
+      if (pthread_create(&id[t], NULL, idx_worker, &b) != 0) break;
+    for (i=0; i<(size_t)t; i++) pthread_join(id[i], NULL);
+    if (t == 0 || b.err) goto done;
+
+    // the header and the sections
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, MARU_IDX_MAGIC, 8);
+    h.version  = MARU_IDX_VERSION;
+    h.algo     = algo;
+    h.variant  = variant;
+    h.hash_len = (algo == MARU_IDX_MARU) ? MARU_HASH_LEN : MARU2_HASH_LEN;
+    h.iv       = iv;
+    for (i=0; i<b.njobs; i++) h.count += b.runs[i].n;
+    // about 4 keys for each entry of the directory
+    while (h.dir_bits < 40 && (4ULL << h.dir_bits) < h.count) h.dir_bits++;
+    h.dir      = MARU_IDX_ALIGN;
+    h.keys     = idx_align(h.dir + ((1ULL << h.dir_bits) + 1) * 8);
+    h.offs     = idx_align(h.keys + h.count * 8);
+    h.pool     = idx_align(h.offs + h.count * 8);
+    h.pool_len = b.len + 1;
+
+    ofd = idx_temp(out, path, sizeof(path));
+    if (ofd < 0) goto done;
+    fchmod(ofd, 0644);
+    ok = ftruncate(ofd, h.pool + h.pool_len) == 0 &&
+         idx_merge(&b, ofd, &h) &&
+         idx_pool(&b, ofd, h.pool) &&
+         idx_pwrite(ofd, &h, sizeof(h), 0);
+    ok = close(ofd) == 0 && ok;
+    if (ok) ok = rename(path, out) == 0;
+    if (!ok) unlink(path);
+done:
+    for (i=0; b.runs != NULL && i<b.njobs; i++) free(b.runs[i].mem);
+    for (i=0; i<(size_t)b.nfd; i++) close(b.fds[i]);
+    free(b.runs);
+    free(b.fds);
+    free(id);
+    if (b.len != 0) munmap((void*)b.data, b.len);
+    return ok ? 0 : -1;
+}
+
+// are n words at off aligned and inside size bytes, without overflow
+static int idx_fits(uint64_t off, uint64_t n, uint64_t size) {
+    return (off & 7) == 0 && off <= size && n <= (size - off) / 8;
+}
+
+maru_idx *maru_idx_open(const char *path) {
+    const maru_idx_hdr *h;
+    maru_idx           *x;
+    struct stat        st;
+    void               *map;
+    int                fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(maru_idx_hdr)) {
+      close(fd);
+      return NULL;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    // the sections must be in the file and the pool end with a NUL
+    h = (const maru_idx_hdr*)map;
+    if (memcmp(h->magic, MARU_IDX_MAGIC, 8) != 0 || h->version != MARU_IDX_VERSION ||
+        (h->algo != MARU_IDX_MARU && h->algo != MARU_IDX_MARU2) ||
+        h->count > (uint64_t)st.st_size / 16 || h->dir_bits > 40 ||
+        !idx_fits(h->dir, (1ULL << h->dir_bits) + 1, st.st_size) ||
+        !idx_fits(h->keys, h->count, st.st_size) ||
+        !idx_fits(h->offs, h->count, st.st_size) ||
+        (h->pool & 7) != 0 || h->pool_len == 0 || h->pool > (uint64_t)st.st_size ||
+        h->pool_len > (uint64_t)st.st_size - h->pool ||
+        ((const char*)map)[h->pool + h->pool_len - 1] != 0)
+    {
+      munmap(map, st.st_size);
+      return NULL;
+    }
+    x = (maru_idx*)malloc(sizeof(maru_idx));
+    if (x == NULL) {
+      munmap(map, st.st_size);
+      return NULL;
+    }
+    x->map  = (const uint8_t*)map;
+    x->size = st.st_size;
+    x->h    = h;
+    x->dir  = (const uint64_t*)(x->map + h->dir);
+    x->keys = (const uint64_t*)(x->map + h->keys);
+    x->offs = (const uint64_t*)(x->map + h->offs);
+    x->pool = (const char*)(x->map + h->pool);
+    madvise((void*)x->dir, x->size - h->dir, MADV_RANDOM);
+    return x;
+}
+
+void maru_idx_close(maru_idx *x) {
+    munmap((void*)x->map, x->size);
+    free(x);
+}
+
+const maru_idx_hdr *maru_idx_header(const maru_idx *x) {
+    return x->h;
+}
+
+// number of entries with key, the first is at *first
+size_t maru_idx_find(const maru_idx *x, uint64_t key, size_t *first) {
+    const uint64_t *k = x->keys;
+    uint64_t       p = idx_top(key, x->h->dir_bits);
+    size_t         lo, hi, mid, i;
+
+    // the directory gives the keys with the same top bits, a bad
+    // file can't send the search out of the keys
+    lo = x->dir[p];
+    hi = x->dir[p + 1];
+    if (hi > x->h->count) hi = x->h->count;
+    if (lo > hi) lo = hi;
+
+    while (hi - lo > 8) {
+      mid = lo + (hi - lo) / 2;
+      if (k[mid] < key) lo = mid + 1;
+      else hi = mid;
+    }
+    while (lo < hi && k[lo] < key) lo++;
+    for (i=lo; i<x->h->count && k[i] == key; i++);
+    if (first != NULL) *first = lo;
+    return i - lo;
+}
+
+// name of a hash of maru_idx_header()->hash_len bytes, or NULL.
+// the name points into the index and lives until it's closed.
+const char *maru_idx_name(const maru_idx *x, const void *hash) {
+    uint8_t    h[MARU2_HASH_LEN];
+    const char *name;
+    uint64_t   key;
+    size_t     i, n;
+
+    memcpy(&key, hash, 8);
+    for (n = maru_idx_find(x, key, &i), n += i; i<n; i++) {
+      if (x->offs[i] >= x->h->pool_len) continue;
+      name = x->pool + x->offs[i];
+      if (x->h->algo == MARU_IDX_MARU) return name;
+
+      // the key is 64 bits, check the rest of the hash
+      if (x->h->variant == MARU_IDX_CI) maru2_ci(name, x->h->iv, h);
+      else maru2(name, x->h->iv, h);
+      if (memcmp(h, hash, MARU2_HASH_LEN) == 0) return name;
+    }
+    return NULL;
+}
+
+#ifdef TEST
+
+#include <time.h>
+#include <stddef.h>
+#include <ctype.h>
+
+#define NNAMES 300000
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// name i, some long, some with CRLF, and blank lines between
+static void name_of(char *s, size_t size, int i) {
+    if (i % 97 == 0)
+      snprintf(s, size, "%08x_LongExportNameThatIsLongerThanSixtyFourCharacters_%d", i * 2654435761u, i);
+    else
+      snprintf(s, size, "Sym%d_%x", i, i * 2654435761u);
+}
+
+static int write_names(const char *path) {
+    FILE *f = fopen(path, "wb");
+    char s[128];
+    int  i;
+
+    if (f == NULL) return 0;
+    for (i=0; i<NNAMES; i++) {
+      name_of(s, sizeof(s), i);
+      fprintf(f, "%s%s", s, (i % 5 == 0) ? "\r\n" : "\n");
+      if (i % 1000 == 0) fputs("\n", f);
+    }
+    // the last name has no line end
+    fputs("LastName", f);
+    return fclose(f) == 0;
+}
+
+static int same_file(const char *a, const char *b) {
+    FILE *f = fopen(a, "rb"), *g = fopen(b, "rb");
+    int  c, d, ok = f != NULL && g != NULL;
+
+    while (ok) {
+      c = fgetc(f);
+      d = fgetc(g);
+      ok = c == d;
+      if (c == EOF) break;
+    }
+    if (f != NULL) fclose(f);
+    if (g != NULL) fclose(g);
+    return ok;
+}
+
+// every name must be found from its hash
+static int check_all(const char *path, int algo, int variant, double *open_ms, double *ns) {
+    maru_idx   *x;
+    uint8_t    (*h)[MARU2_HASH_LEN], k[MARU2_HASH_LEN];
+    uint64_t   h64;
+    const char **r;
+    char       s[128], u[128];
+    double     t0;
+    int        i, j, ok;
+
+    h = malloc((NNAMES + 1) * sizeof(h[0]));
+    r = malloc((NNAMES + 1) * sizeof(char*));
+
+    for (i=0; i<=NNAMES; i++) {
+      if (i < NNAMES) name_of(s, sizeof(s), i);
+      else strcpy(s, "LastName");
+
+      if (algo == MARU_IDX_MARU) {
+        h64 = maru(s, 0x15DF1E4BE5E7970FULL);
+        memcpy(h[i], &h64, 8);
+      } else if (variant == MARU_IDX_CI) {
+        for (j=0; s[j] != 0; j++) u[j] = (char)toupper((unsigned char)s[j]);
+        u[j] = 0;
+        maru2_ci(u, 0x15DF1E4BE5E7970FULL, h[i]);
+      } else {
+        maru2(s, 0x15DF1E4BE5E7970FULL, h[i]);
+      }
+    }
+    t0 = now();
+    x = maru_idx_open(path);
+    *open_ms = (now() - t0) * 1e3;
+    if (x == NULL) {
+      free(h);
+      free(r);
+      return 0;
+    }
+    t0 = now();
+    for (i=0; i<=NNAMES; i++) r[i] = maru_idx_name(x, h[i]);
+    *ns = (now() - t0) * 1e9 / (NNAMES + 1);
+
+    ok = maru_idx_header(x)->count == NNAMES + 1;
+    for (i=0; i<=NNAMES; i++) {
+      if (i < NNAMES) name_of(s, sizeof(s), i);
+      else strcpy(s, "LastName");
+      ok &= r[i] != NULL && strcmp(r[i], s) == 0;
+    }
+    free(h);
+    free(r);
+
+    // hashes not in the index
+    for (i=0; i<1000; i++) {
+      maru2(s, i, k);
+      ok &= maru_idx_name(x, k) == NULL || algo == MARU_IDX_MARU;
+    }
+    maru_idx_close(x);
+    return ok;
+}
+
+// headers whose sections wrap around or are misaligned must not open
+static int bad_headers(const char *path) {
+    static const struct { size_t field; uint64_t v; } bad[] = {
+      { offsetof(maru_idx_hdr, keys), ~0ULL - 7 },
+      { offsetof(maru_idx_hdr, keys), MARU_IDX_ALIGN + 4 },
+      { offsetof(maru_idx_hdr, offs), ~0ULL - 7 },
+      { offsetof(maru_idx_hdr, offs), 12 },
+      { offsetof(maru_idx_hdr, dir),  ~0ULL - 7 },
+      { offsetof(maru_idx_hdr, dir),  MARU_IDX_ALIGN + 1 },
+      { offsetof(maru_idx_hdr, pool), ~0ULL - 7 },
+      { offsetof(maru_idx_hdr, pool), 3 },
+    };
+    maru_idx_hdr h;
+    maru_idx     *x;
+    size_t       i;
+    int          fd, ok = 1;
+
+    fd = open(path, O_RDWR);
+    if (fd < 0 || !idx_pread(fd, &h, sizeof(h), 0)) return 0;
+
+    for (i=0; i<sizeof(bad)/sizeof(bad[0]); i++) {
+      ok &= idx_pwrite(fd, &bad[i].v, 8, bad[i].field);
+      x = maru_idx_open(path);
+      ok &= x == NULL;
+      if (x != NULL) maru_idx_close(x);
+      ok &= idx_pwrite(fd, &h, sizeof(h), 0);
+    }
+    close(fd);
+    return ok;
+}
+
+static int self_test(void) {
+    char   in[64], a[64], b[64];
+    double ms, ns;
+    int    ok;
+
+    snprintf(in, sizeof(in), "/tmp/symidx.%d.txt", (int)getpid());
+    snprintf(a, sizeof(a), "/tmp/symidx.%d.a", (int)getpid());
+    snprintf(b, sizeof(b), "/tmp/symidx.%d.b", (int)getpid());
+    if (!write_names(in)) {
+      printf("can't write %s\n", in);
+      return 1;
+    }
+    // all in memory, and in runs on disk, give the same file
+    ok = maru_idx_build(in, a, MARU_IDX_MARU2, 0, 0x15DF1E4BE5E7970FULL, 4, 1 << 30) == 0;
+    ok &= maru_idx_build(in, b, MARU_IDX_MARU2, 0, 0x15DF1E4BE5E7970FULL, 3, 1 << 20) == 0;
+    ok &= same_file(a, b);
+    printf("build in memory and on disk : %s\n", ok ? "OK" : "FAIL");
+
+    ok = check_all(a, MARU_IDX_MARU2, 0, &ms, &ns);
+    printf("maru2 lookup                : %s, open %.3f ms, %.0f ns per name\n", ok ? "OK" : "FAIL", ms, ns);
+
+    ok = maru_idx_build(in, a, MARU_IDX_MARU2, MARU_IDX_CI, 0x15DF1E4BE5E7970FULL, 2, 1 << 30) == 0;
+    ok &= check_all(a, MARU_IDX_MARU2, MARU_IDX_CI, &ms, &ns);
+    printf("maru2_ci lookup             : %s\n", ok ? "OK" : "FAIL");
+
+    ok = maru_idx_build(in, a, MARU_IDX_MARU, 0, 0x15DF1E4BE5E7970FULL, 2, 1 << 20) == 0;
+    ok &= check_all(a, MARU_IDX_MARU, 0, &ms, &ns);
+    printf("maru lookup                 : %s\n", ok ? "OK" : "FAIL");
+
+    ok = bad_headers(a) && check_all(a, MARU_IDX_MARU, 0, &ms, &ns);
+    printf("bad headers                 : %s\n", ok ? "OK" : "FAIL");
+
+    unlink(in);
+    unlink(a);
+    unlink(b);
+    return 0;
+}
+
+static int hex2bin(const char *s, uint8_t *out, int len) {
+    int i, hi, lo;
+
+    if ((int)strlen(s) != 2 * len) return 0;
+    for (i=0; i<len; i++) {
+      hi = isxdigit((unsigned char)s[2*i])   ? (isdigit((unsigned char)s[2*i])   ? s[2*i] - '0'   : (tolower((unsigned char)s[2*i]) - 'a' + 10))   : -1;
+      lo = isxdigit((unsigned char)s[2*i+1]) ? (isdigit((unsigned char)s[2*i+1]) ? s[2*i+1] - '0' : (tolower((unsigned char)s[2*i+1]) - 'a' + 10)) : -1;
+      if (hi < 0 || lo < 0) return 0;
+      out[i] = (uint8_t)(hi << 4 | lo);
+    }
+    return 1;
+}
+
+static void usage(void) {
+    printf("usage: symidx                            self test\n");
+    printf("       symidx -b names index [-1] [-c] [-s iv] [-t threads] [-m MB]\n");
+    printf("       symidx -l index hash...\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *build = NULL, *out = NULL, *look = NULL, *r;
+    maru_idx   *x;
+    uint8_t    h[MARU2_HASH_LEN];
+    uint64_t   iv = 0, h64;
+    size_t     mem = 1024;
+    int        i, algo = MARU_IDX_MARU2, variant = 0, nt, fail = 0;
+
+    nt = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (argc == 1) return self_test();
+
+    for (i=1; i<argc && argv[i][0] == '-'; i++) {
+      switch (argv[i][1]) {
+        case '1': algo = MARU_IDX_MARU; break;
+        case 'c': variant = MARU_IDX_CI; break;
+        case 'b':
+          if (i + 2 >= argc) { usage(); return 1; }
+          build = argv[++i];
+          out   = argv[++i];
+          break;
+        case 'l':
+        case 's':
+        case 't':
+        case 'm':
+          if (i + 1 >= argc) { usage(); return 1; }
+          if (argv[i][1] == 'l') look = argv[++i];
+          else if (argv[i][1] == 's') iv = strtoull(argv[++i], NULL, 16);
+          else if (argv[i][1] == 't') nt = atoi(argv[++i]);
+          else mem = strtoul(argv[++i], NULL, 0);
+          break;
+        default:
+          usage();
+          return 1;
+      }
+    }
+    if (build != NULL) {
+      if (maru_idx_build(build, out, algo, variant, iv, nt, mem << 20) != 0) {
+        printf("can't build %s from %s\n", out, build);
+        return 1;
+      }
+      return 0;
+    }
+    if (look == NULL) {
+      usage();
+      return 1;
+    }
+    x = maru_idx_open(look);
+    if (x == NULL) {
+      printf("can't open %s\n", look);
+      return 1;
+    }
+    // maru hashes are the 64-bit value, maru2 the bytes
+    for (; i<argc; i++) {
+      if (maru_idx_header(x)->algo == MARU_IDX_MARU) {
+        h64 = strtoull(argv[i], NULL, 16);
+        r = maru_idx_name(x, &h64);
+      } else {
+        r = hex2bin(argv[i], h, MARU2_HASH_LEN) ? maru_idx_name(x, h) : NULL;
+      }
+      printf("%s  %s\n", argv[i], r != NULL ? r : "?");
+      fail |= r == NULL;
+    }
+    maru_idx_close(x);
+    return fail;
+}
+#endif
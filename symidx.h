@@ -0,0 +1,84 @@
+/**
+  Copyright © 2017 Odzhan. All Rights Reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  3. The name of the author may not be used to endorse or promote products
+  derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY AUTHORS "AS IS" AND ANY EXPRESS OR
+  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+  STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE. */
+
+#ifndef SYMIDX_H
+#define SYMIDX_H
+
+#include "maru.h"
+#include "maru2.h"
+
+#define MARU_IDX_MAGIC    "MARUIDX1"
+#define MARU_IDX_VERSION  1
+#define MARU_IDX_ALIGN    4096  // sections start on a page
+
+#define MARU_IDX_MARU     1  // 64-bit maru
+#define MARU_IDX_MARU2    2  // 128-bit maru2, keyed by its first 64 bits
+
+#define MARU_IDX_CI       1  // variant: names hashed with maru2_ci
+
+// The file is the header, a directory of 2^dir_bits + 1 indices, count
+// 64-bit keys in order, count pool offsets of the names in the same
+// order, then the pool of names, each ending with a NUL. Entry i of the
+// directory is the first key whose top dir_bits bits are i or more.
+// Numbers are little endian.
+typedef struct _maru_idx_hdr {
+  char     magic[8];
+  uint32_t version;
+  uint32_t algo;      // MARU_IDX_MARU or MARU_IDX_MARU2
+  uint32_t variant;   // 0 or MARU_IDX_CI
+  uint32_t hash_len;
+  uint64_t iv;
+  uint64_t count;
+  uint64_t dir_bits;
+  uint64_t dir;       // file offsets of the sections
+  uint64_t keys;
+  uint64_t offs;
+  uint64_t pool;
+  uint64_t pool_len;
+} maru_idx_hdr;
+
+typedef struct _maru_idx maru_idx;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  int maru_idx_build (const char*, const char*, int, int, uint64_t, int, size_t);
+
+  maru_idx *maru_idx_open (const char*);
+  void maru_idx_close (maru_idx*);
+  const maru_idx_hdr *maru_idx_header (const maru_idx*);
+  size_t maru_idx_find (const maru_idx*, uint64_t, size_t*);
+  const char *maru_idx_name (const maru_idx*, const void*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
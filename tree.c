@@ -0,0 +1,279 @@
+/**
+  Copyright © 2017 Odzhan. All Rights Reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are
+  met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  3. The name of the author may not be used to endorse or promote products
+  derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY AUTHORS "AS IS" AND ANY EXPRESS OR
+  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+  STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE. */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tree.h"
+
+// Tree mode. The input is split into MARU2_CHUNK_LEN byte chunks and
+// each one is hashed with its index and the leaf flag in H. Pairs of
+// chaining values are hashed level by level, an odd one at the end
+// moves up as is, and the last parent gets the root flag. The shape
+// only depends on the length, so the hash is the same for any number
+// of threads.
+
+#define MARU2_TREE_SPAN  ((size_t)MARU2_TREE_JOB * MARU2_CHUNK_LEN)
+
+typedef struct _maru2_tree_ctx {
+  const uint8_t *data;
+  size_t        len;
+  uint64_t      iv;
+  uint64_t      njobs;
+  uint64_t      next;   // next job, taken by workers
+  uint8_t       (*cv)[MARU2_HASH_LEN]; // root of each job
+} maru2_tree_ctx;
+
+// hash n chaining values at level lvl up to one. idx is the index
+// of the first one, root is set if the result is the root.
+static void maru2_tree_reduce(uint8_t (*cv)[MARU2_HASH_LEN], uint64_t n,
+  uint64_t iv, uint64_t lvl, uint64_t idx, int root)
+{
+    uint64_t i;
+
+    for (; n > 1; n = (n + 1) / 2, idx /= 2) {
+      lvl++;
+      for (i=0; i<n/2; i++) {
+        maru2_tree_parent(cv[2*i], iv, (lvl << 56) | (idx/2 + i),
+          (root && n == 2) ? MARU2_TREE_ROOT : 0, cv[i]);
+      }
+      // odd one moves up
+      if (n & 1) memcpy(cv[n/2], cv[n-1], MARU2_HASH_LEN);
+    }
+}
+
+// take jobs until there are none left, a full job is a subtree
+static void *maru2_tree_worker(void *arg) {
+    maru2_tree_ctx *t = (maru2_tree_ctx*)arg;
+    uint8_t        cv[MARU2_TREE_JOB][MARU2_HASH_LEN];
+    uint64_t       j;
+    size_t         off, len;
+
+    while ((j = __atomic_fetch_add(&t->next, 1, __ATOMIC_RELAXED)) < t->njobs) {
+      off = j * MARU2_TREE_SPAN;
+      len = t->len - off;
+      if (len > MARU2_TREE_SPAN) len = MARU2_TREE_SPAN;
+
+      maru2_tree_leaves(t->data + off, len, t->iv, j * MARU2_TREE_JOB, 0, cv);
+      maru2_tree_reduce(cv, (len + MARU2_CHUNK_LEN - 1) / MARU2_CHUNK_LEN,
+        t->iv, 0, j * MARU2_TREE_JOB, t->njobs == 1);
+      memcpy(t->cv[j], cv[0], MARU2_HASH_LEN);
+    }
+    return NULL;
+}
+
+// hash len bytes of data with up to threads threads, 0 for one per core.
+// returns 0, or -1 if out of memory.
+int maru2_tree(const void *data, size_t len, uint64_t iv, int threads, void *out) {
+    maru2_tree_ctx t;
+    pthread_t      *id;
+    uint8_t        cv[1][MARU2_HASH_LEN];
+    uint64_t       lvl;
+    int            i, n;
+
+    // one chunk is the root
+    if (len <= MARU2_CHUNK_LEN) {
+      maru2_tree_leaves(data, len, iv, 0, MARU2_TREE_ROOT, cv);
+      memcpy(out, cv[0], MARU2_HASH_LEN);
+      return 0;
+    }
+    t.data  = (const uint8_t*)data;
+    t.len   = len;
+    t.iv    = iv;
+    t.njobs = (len + MARU2_TREE_SPAN - 1) / MARU2_TREE_SPAN;
+    t.next  = 0;
+    t.cv    = malloc(t.njobs * MARU2_HASH_LEN);
+    if (t.cv == NULL) return -1;
+
+    if (threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0) threads = 1;
+    if ((uint64_t)threads > t.njobs) threads = (int)t.njobs;
+
+    // this thread works too. if a thread can't start, the others do its jobs
+    id = malloc(threads * sizeof(pthread_t));
+    for (i=0, n=0; id != NULL && i<threads-1; i++) {
+      if (pthread_create(&id[n], NULL, maru2_tree_worker, &t) == 0) n++;
+    }
+    maru2_tree_worker(&t);
+    for (i=0; i<n; i++)
+      pthread_join(id[i], NULL);
+    free(id);
+
+    // jobs are subtrees at level log2(MARU2_TREE_JOB)
+    for (lvl=0; (1ULL << lvl) < MARU2_TREE_JOB; lvl++);
+    maru2_tree_reduce(t.cv, t.njobs, iv, lvl, 0, 1);
+
+    memcpy(out, t.cv[0], MARU2_HASH_LEN);
+    free(t.cv);
+    return 0;
+}
+
+// hash a file through a read only mapping.
+// returns 0, or -1 if it can't be opened or mapped.
+int maru2_tree_file(const char *path, uint64_t iv, int threads, void *out) {
+    struct stat st;
+    void        *p;
+    int         fd, r;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    if (fstat(fd, &st) != 0) {
+      close(fd);
+      return -1;
+    }
+    // empty files can't be mapped
+    if (st.st_size == 0) {
+      close(fd);
+      return maru2_tree("", 0, iv, threads, out);
+    }
+    p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return -1;
+
+    madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+    r = maru2_tree(p, (size_t)st.st_size, iv, threads, out);
+    munmap(p, (size_t)st.st_size);
+    return r;
+}
+
+#ifdef TEST
+
+#include <stdio.h>
+#include <time.h>
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// one chunk at a time with the streaming API, then level by level
+static void tree_ref(const uint8_t *p, size_t len, uint64_t iv, uint8_t *out) {
+    uint8_t   (*cv)[MARU2_HASH_LEN];
+    maru2_ctx ctx;
+    uint64_t  n, i, lvl;
+    size_t    r;
+
+    n  = len ? (len + MARU2_CHUNK_LEN - 1) / MARU2_CHUNK_LEN : 1;
+    cv = malloc(n * MARU2_HASH_LEN);
+
+    for (i=0; i<n; i++) {
+      r = len - i * MARU2_CHUNK_LEN;
+      if (r > MARU2_CHUNK_LEN) r = MARU2_CHUNK_LEN;
+      maru2_init(&ctx, iv);
+      ctx.h.q[0] ^= i;
+      ctx.h.q[1] ^= MARU2_TREE_LEAF | (n == 1 ? MARU2_TREE_ROOT : 0);
+      maru2_update(&ctx, p + i * MARU2_CHUNK_LEN, r);
+      maru2_final(&ctx, cv[i]);
+    }
+    for (lvl=1; n > 1; lvl++, n = (n + 1) / 2) {
+      for (i=0; i<n/2; i++)
+        maru2_tree_parent(cv[2*i], iv, (lvl << 56) | i, n == 2 ? MARU2_TREE_ROOT : 0, cv[i]);
+      if (n & 1) memcpy(cv[n/2], cv[n-1], MARU2_HASH_LEN);
+    }
+    memcpy(out, cv[0], MARU2_HASH_LEN);
+    free(cv);
+}
+
+static void bin2hex(const uint8_t *p, int len) {
+    int i;
+
+    for (i=0; i<len; i++) printf("%02x", p[i]);
+}
+
+int main(int argc, char *argv[]) {
+    const size_t len_tbl[] = { 0, 1, 4095, 4096, 4097, 3*4096+5, 64*4096,
+      64*4096+1, 200*4096+77, (1 << 20) + 3 };
+    const int    thr_tbl[] = { 1, 2, 3, 7 };
+    uint8_t      *p, h[MARU2_HASH_LEN], ref[MARU2_HASH_LEN];
+    size_t       i, j, len;
+    double       t0, t1;
+    int          equ, threads = 0, lanes;
+
+    // tree [-t threads] file...
+    if (argc > 1) {
+      for (i=1; i<(size_t)argc; i++) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < (size_t)argc) {
+          threads = atoi(argv[++i]);
+          continue;
+        }
+        if (maru2_tree_file(argv[i], 0, threads, h) != 0) {
+          perror(argv[i]);
+          continue;
+        }
+        bin2hex(h, MARU2_HASH_LEN);
+        printf("  %s\n", argv[i]);
+      }
+      return 0;
+    }
+    len = (size_t)256 << 20;
+    p   = malloc(len);
+    if (p == NULL) {
+      printf("out of memory\n");
+      return 1;
+    }
+    for (i=0; i<len; i++) p[i] = (uint8_t)(i * 131 + (i >> 12));
+
+    printf("using %s", maru2_kernel(&lanes));
+    printf(", %d lane(s)\n", lanes);
+
+    // same hash as the reference for any number of threads
+    for (i=0; i<sizeof(len_tbl)/sizeof(len_tbl[0]); i++) {
+      tree_ref(p, len_tbl[i], 0x15DF1E4BE5E7970FULL, ref);
+      for (j=0, equ=1; j<sizeof(thr_tbl)/sizeof(thr_tbl[0]); j++) {
+        equ &= maru2_tree(p, len_tbl[i], 0x15DF1E4BE5E7970FULL, thr_tbl[j], h) == 0;
+        equ &= memcmp(h, ref, MARU2_HASH_LEN) == 0;
+      }
+      printf("maru2_tree(%zu bytes) : ", len_tbl[i]);
+      bin2hex(h, MARU2_HASH_LEN);
+      printf(" : %s\n", equ ? "OK" : "FAIL");
+    }
+    // one thread, then one per core
+    t0 = now();
+    maru2_tree(p, len, 0, 1, h);
+    t1 = now();
+    printf("maru2_tree(%zu MB, 1 thread) : %.2f GB/s\n", len >> 20, len / (t1 - t0) / 1e9);
+    t0 = now();
+    maru2_tree(p, len, 0, 0, ref);
+    t1 = now();
+    printf("maru2_tree(%zu MB, %ld thread(s)) : %.2f GB/s, %s\n", len >> 20,
+      sysconf(_SC_NPROCESSORS_ONLN), len / (t1 - t0) / 1e9,
+      memcmp(h, ref, MARU2_HASH_LEN) == 0 ? "OK" : "FAIL");
+
+    free(p);
+    return 0;
+}
+#endif